@@ -23,13 +23,23 @@ namespace KxVFS
 				Write
 			};
 
+			// Called on the thread pool when the operation is done, 'errorCode' is a Win32 error code
+			using TCompletion = void(*)(AsyncIOContext& asyncContext, DWORD errorCode, size_t bytesTransferred);
+
 		private:
 			OVERLAPPED m_Overlapped = {0};
 			FileContext* m_FileContext = nullptr;
 			void* m_OperationContext = nullptr;
 			OperationType m_OperationType = OperationType::Unknown;
+			TCompletion m_Completion = nullptr;
+			void* m_Buffer = nullptr;
+			DWORD m_BufferSize = 0;
+			uint64_t m_CacheGeneration = 0;
 
 		private:
+			// Pooled context which isn't bound to a file yet
+			AsyncIOContext() noexcept = default;
+
 			OVERLAPPED& GetOverlapped() noexcept
 			{
 				return m_Overlapped;
@@ -38,6 +48,19 @@ namespace KxVFS
 			{
 				m_FileContext = &fileContext;
 			}
+			void SetOperation(void* context, int64_t offset, OperationType type, TCompletion onCompleted, void* buffer, DWORD size) noexcept
+			{
+				Utility::Int64ToOverlappedOffset(offset, m_Overlapped);
+				m_OperationContext = context;
+				m_OperationType = type;
+				m_Completion = onCompleted;
+				m_Buffer = buffer;
+				m_BufferSize = size;
+			}
+			void Complete(DWORD errorCode, size_t bytesTransferred)
+			{
+				std::invoke(m_Completion, *this, errorCode, bytesTransferred);
+			}
 
 		public:
 			AsyncIOContext(FileContext& fileContext) noexcept
@@ -46,6 +69,31 @@ namespace KxVFS
 			}
 
 		public:
+			// Starts the read or write on the file's handle, 'event' is signaled when it's done if provided.
+			// Returns false with 'ERROR_IO_PENDING' as the last error if the operation is in progress.
+			bool Issue(HANDLE event = nullptr) noexcept
+			{
+				// Only the offset is kept between operations
+				m_Overlapped.Internal = 0;
+				m_Overlapped.InternalHigh = 0;
+				m_Overlapped.hEvent = event;
+
+				// Actual number of bytes is known only when it's done
+				DWORD bytesTransferred = 0;
+				FileHandle& fileHandle = m_FileContext->GetHandle();
+				if (m_OperationType == OperationType::Write)
+				{
+					return fileHandle.Write(m_Buffer, m_BufferSize, bytesTransferred, &m_Overlapped);
+				}
+				return fileHandle.Read(m_Buffer, m_BufferSize, bytesTransferred, &m_Overlapped);
+			}
+
+			// Waits for an operation started with an event
+			bool WaitResult(DWORD& bytesTransferred) noexcept
+			{
+				return ::GetOverlappedResult(m_FileContext->GetHandle(), &m_Overlapped, &bytesTransferred, TRUE);
+			}
+
 			FileContext& GetFileContext() const noexcept
 			{
 				return *m_FileContext;
@@ -83,6 +131,9 @@ namespace KxVFS
 				Utility::Int64ToOverlappedOffset(0, m_Overlapped);
 				m_OperationContext = nullptr;
 				m_OperationType = OperationType::Unknown;
+				m_Completion = nullptr;
+				m_Buffer = nullptr;
+				m_BufferSize = 0;
 			}
 	};
 }
@@ -0,0 +1,311 @@
+#include "stdafx.h"
+#include "KxVFS/Utility.h"
+#include "BlockCache.h"
+
+namespace
+{
+	uint64_t MixHash(uint64_t value) noexcept
+	{
+		// Finalizer from MurmurHash3, every bit of the input affects all bits of the result
+		value ^= value >> 33;
+		value *= 0xff51afd7ed558ccdULL;
+		value ^= value >> 33;
+		value *= 0xc4ceb9fe1a85ec53ULL;
+		value ^= value >> 33;
+		return value;
+	}
+}
+
+namespace KxVFS
+{
+	size_t BlockCache::BlockKeyHash::operator()(const BlockKey& key) const noexcept
+	{
+		uint64_t hash = MixHash(key.File.FileIndex ^ (key.File.VolumeSerialNumber << 32));
+		hash = MixHash(hash ^ static_cast<uint64_t>(key.File.LastWriteTime) ^ static_cast<uint64_t>(key.File.Size));
+		return static_cast<size_t>(MixHash(hash ^ key.Index));
+	}
+	size_t BlockCache::FileIDHash::operator()(const std::pair<uint64_t, uint64_t>& fileID) const noexcept
+	{
+		return static_cast<size_t>(MixHash(fileID.second ^ (fileID.first << 32)));
+	}
+
+	BlockCache::FileKey BlockCache::GetFileKey(HANDLE fileHandle) noexcept
+	{
+		FileKey key;
+
+		BY_HANDLE_FILE_INFORMATION info = {};
+		if (::GetFileInformationByHandle(fileHandle, &info))
+		{
+			key.VolumeSerialNumber = info.dwVolumeSerialNumber;
+			key.FileIndex = (static_cast<uint64_t>(info.nFileIndexHigh) << 32)|info.nFileIndexLow;
+			key.LastWriteTime = (static_cast<int64_t>(info.ftLastWriteTime.dwHighDateTime) << 32)|info.ftLastWriteTime.dwLowDateTime;
+			key.Size = (static_cast<int64_t>(info.nFileSizeHigh) << 32)|info.nFileSizeLow;
+		}
+		return key;
+	}
+}
+
+namespace KxVFS
+{
+	BlockCache::Shard& BlockCache::GetShard(const BlockKey& key) const noexcept
+	{
+		return m_Shards[BlockKeyHash()(key) % ShardCount];
+	}
+	BlockCache::TData BlockCache::FindBlock(const BlockKey& key)
+	{
+		Shard& shard = GetShard(key);
+		ExclusiveSRWLocker lock(shard.Lock);
+
+		auto it = shard.Blocks.find(key);
+		if (it == shard.Blocks.end())
+		{
+			return nullptr;
+		}
+
+		// Repeated hits while a block is still in the FIFO queue are usually the same access, so they don't promote it
+		if (it->second.IsFrequent)
+		{
+			shard.Frequent.splice(shard.Frequent.begin(), shard.Frequent, it->second.Item);
+		}
+		return it->second.Item->Data;
+	}
+	void BlockCache::EvictBlocks(Shard& shard, size_t capacity)
+	{
+		const size_t recentLimit = capacity / 4;
+		const size_t ghostLimit = std::max<size_t>(capacity / BlockSize / 2, 1);
+
+		while (shard.RecentBytes + shard.FrequentBytes > capacity)
+		{
+			if (!shard.Recent.empty() && (shard.RecentBytes > recentLimit || shard.Frequent.empty()))
+			{
+				// Key is remembered, so if the block is requested again soon it goes to the LRU queue
+				const Block& block = shard.Recent.back();
+				shard.Ghosts.push_front(block.Key);
+				shard.GhostIndex.insert_or_assign(block.Key, shard.Ghosts.begin());
+				if (shard.Ghosts.size() > ghostLimit)
+				{
+					shard.GhostIndex.erase(shard.Ghosts.back());
+					shard.Ghosts.pop_back();
+				}
+
+				shard.RecentBytes -= block.Data->size();
+				shard.Blocks.erase(block.Key);
+				shard.Recent.pop_back();
+			}
+			else
+			{
+				const Block& block = shard.Frequent.back();
+				shard.FrequentBytes -= block.Data->size();
+				shard.Blocks.erase(block.Key);
+				shard.Frequent.pop_back();
+			}
+			shard.Evictions++;
+		}
+	}
+
+	BlockCache::BlockCache()
+		:m_Shards(std::make_unique<Shard[]>(ShardCount))
+	{
+	}
+
+	void BlockCache::SetCapacity(size_t bytes)
+	{
+		const size_t capacity = bytes / ShardCount;
+		m_ShardCapacity = capacity;
+
+		for (size_t i = 0; i < ShardCount; i++)
+		{
+			Shard& shard = m_Shards[i];
+			ExclusiveSRWLocker lock(shard.Lock);
+
+			EvictBlocks(shard, capacity);
+			if (capacity == 0)
+			{
+				shard.Ghosts.clear();
+				shard.GhostIndex.clear();
+			}
+		}
+	}
+	void BlockCache::Clear()
+	{
+		for (size_t i = 0; i < ShardCount; i++)
+		{
+			Shard& shard = m_Shards[i];
+			ExclusiveSRWLocker lock(shard.Lock);
+
+			shard.Blocks.clear();
+			shard.Recent.clear();
+			shard.Frequent.clear();
+			shard.Ghosts.clear();
+			shard.GhostIndex.clear();
+			shard.RecentBytes = 0;
+			shard.FrequentBytes = 0;
+		}
+	}
+
+	BlockCache::Statistics BlockCache::GetStatistics() const noexcept
+	{
+		Statistics statistics;
+		statistics.Hits = m_Hits.load(std::memory_order_relaxed);
+		statistics.Misses = m_Misses.load(std::memory_order_relaxed);
+		statistics.BytesServed = m_BytesServed.load(std::memory_order_relaxed);
+
+		for (size_t i = 0; i < ShardCount; i++)
+		{
+			Shard& shard = m_Shards[i];
+			SharedSRWLocker lock(shard.Lock);
+
+			statistics.Evictions += shard.Evictions;
+			statistics.CachedBytes += shard.RecentBytes + shard.FrequentBytes;
+		}
+		return statistics;
+	}
+
+	bool BlockCache::Read(const FileKey& file, int64_t offset, void* buffer, size_t size)
+	{
+		if (!IsEnabled() || !file.IsValid() || size == 0 || offset < 0 || offset + static_cast<int64_t>(size) > file.Size)
+		{
+			return false;
+		}
+
+		// Blocks are copied as they're found, if one of them is missing the caller reads the whole range from the disk anyway
+		const int64_t end = offset + static_cast<int64_t>(size);
+		const uint64_t firstBlock = static_cast<uint64_t>(offset) / BlockSize;
+		const uint64_t lastBlock = static_cast<uint64_t>(end - 1) / BlockSize;
+
+		for (uint64_t index = firstBlock; index <= lastBlock; index++)
+		{
+			TData data = FindBlock({file, index});
+			if (!data)
+			{
+				m_Misses.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+
+			const int64_t blockStart = static_cast<int64_t>(index * BlockSize);
+			const int64_t copyStart = std::max(offset, blockStart);
+			const int64_t copyEnd = std::min(end, blockStart + static_cast<int64_t>(data->size()));
+			if (copyEnd <= copyStart)
+			{
+				m_Misses.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			std::memcpy(static_cast<uint8_t*>(buffer) + (copyStart - offset), data->data() + (copyStart - blockStart), static_cast<size_t>(copyEnd - copyStart));
+		}
+
+		m_Hits.fetch_add(static_cast<size_t>(lastBlock - firstBlock + 1), std::memory_order_relaxed);
+		m_BytesServed.fetch_add(size, std::memory_order_relaxed);
+		return true;
+	}
+	void BlockCache::Insert(const FileKey& file, int64_t offset, const void* data, size_t size, uint64_t generation)
+	{
+		if (!IsEnabled() || !file.IsValid() || offset < 0)
+		{
+			return;
+		}
+
+		const int64_t end = offset + static_cast<int64_t>(size);
+		for (uint64_t index = (static_cast<uint64_t>(offset) + BlockSize - 1) / BlockSize; ; index++)
+		{
+			const int64_t blockStart = static_cast<int64_t>(index * BlockSize);
+			const int64_t blockEnd = std::min(blockStart + static_cast<int64_t>(BlockSize), file.Size);
+			if (blockEnd <= blockStart || blockEnd > end)
+			{
+				break;
+			}
+
+			// Block data is allocated before the shard is locked
+			const uint8_t* blockData = static_cast<const uint8_t*>(data) + (blockStart - offset);
+			auto blockBytes = std::make_shared<const std::vector<uint8_t>>(blockData, blockData + (blockEnd - blockStart));
+
+			const BlockKey key = {file, index};
+			Shard& shard = GetShard(key);
+			ExclusiveSRWLocker lock(shard.Lock);
+
+			// Checked under the shard lock, so 'Invalidate' either sees the block or the block isn't added
+			if (generation != m_Generation.load(std::memory_order_acquire))
+			{
+				break;
+			}
+
+			const size_t capacity = m_ShardCapacity.load(std::memory_order_relaxed);
+			if (capacity == 0 || shard.Blocks.find(key) != shard.Blocks.end())
+			{
+				continue;
+			}
+
+			// Blocks which were evicted from the FIFO queue recently are used repeatedly
+			bool isFrequent = false;
+			if (auto it = shard.GhostIndex.find(key); it != shard.GhostIndex.end())
+			{
+				shard.Ghosts.erase(it->second);
+				shard.GhostIndex.erase(it);
+				isFrequent = true;
+			}
+
+			TBlockList& blocks = isFrequent ? shard.Frequent : shard.Recent;
+			(isFrequent ? shard.FrequentBytes : shard.RecentBytes) += blockBytes->size();
+			blocks.push_front({key, std::move(blockBytes)});
+			shard.Blocks.insert_or_assign(key, ResidentBlock{blocks.begin(), isFrequent});
+
+			EvictBlocks(shard, capacity);
+		}
+	}
+
+	void BlockCache::AddReader(const FileKey& file)
+	{
+		ExclusiveSRWLocker lock(m_ReadersLock);
+		m_Readers[{file.VolumeSerialNumber, file.FileIndex}]++;
+	}
+	void BlockCache::RemoveReader(const FileKey& file) noexcept
+	{
+		ExclusiveSRWLocker lock(m_ReadersLock);
+
+		auto it = m_Readers.find({file.VolumeSerialNumber, file.FileIndex});
+		if (it != m_Readers.end() && --it->second == 0)
+		{
+			m_Readers.erase(it);
+		}
+	}
+	void BlockCache::Invalidate(const FileKey& file)
+	{
+		{
+			SharedSRWLocker lock(m_ReadersLock);
+			if (m_Readers.find({file.VolumeSerialNumber, file.FileIndex}) == m_Readers.end())
+			{
+				return;
+			}
+		}
+
+		// Reads which are in progress now can have the old data, so they must not insert it
+		m_Generation.fetch_add(1, std::memory_order_acq_rel);
+
+		auto IsFileBlock = [&file](const Block& block)
+		{
+			return block.Key.File.VolumeSerialNumber == file.VolumeSerialNumber && block.Key.File.FileIndex == file.FileIndex;
+		};
+		for (size_t i = 0; i < ShardCount; i++)
+		{
+			Shard& shard = m_Shards[i];
+			ExclusiveSRWLocker lock(shard.Lock);
+
+			for (TBlockList* blocks: {&shard.Recent, &shard.Frequent})
+			{
+				size_t& bytes = blocks == &shard.Recent ? shard.RecentBytes : shard.FrequentBytes;
+				for (auto it = blocks->begin(); it != blocks->end();)
+				{
+					if (IsFileBlock(*it))
+					{
+						bytes -= it->Data->size();
+						shard.Blocks.erase(it->Key);
+						it = blocks->erase(it);
+					}
+					else
+					{
+						++it;
+					}
+				}
+			}
+		}
+	}
+}
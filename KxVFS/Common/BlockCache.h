@@ -0,0 +1,160 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Utility.h"
+#include <list>
+#include <unordered_map>
+
+namespace KxVFS
+{
+	// Cache of file blocks shared by all files of a file system. Files are identified by their volume and file index
+	// along with size and last write time, so a file changed while it's closed gets a new identity and its old blocks
+	// are simply never used again. A file changed while it's open for reading has to be invalidated by the writer.
+	// Blocks are spread over independently locked shards and each shard uses 2Q replacement: blocks seen once
+	// go to a FIFO queue and are only promoted to the LRU one if they're requested again soon after
+	// being evicted, so a single scan through a big file doesn't flush blocks that are used repeatedly.
+	class KxVFS_API BlockCache final
+	{
+		public:
+			static constexpr size_t BlockSize = 64 * 1024;
+			static constexpr size_t ShardCount = 64;
+
+			struct FileKey
+			{
+				uint64_t VolumeSerialNumber = 0;
+				uint64_t FileIndex = 0;
+				int64_t LastWriteTime = 0;
+				int64_t Size = -1;
+
+				bool IsValid() const noexcept
+				{
+					return Size >= 0;
+				}
+				bool operator==(const FileKey& other) const noexcept
+				{
+					return VolumeSerialNumber == other.VolumeSerialNumber && FileIndex == other.FileIndex &&
+						LastWriteTime == other.LastWriteTime && Size == other.Size;
+				}
+			};
+			struct Statistics
+			{
+				size_t Hits = 0;
+				size_t Misses = 0;
+				size_t Evictions = 0;
+				size_t BytesServed = 0;
+				size_t CachedBytes = 0;
+			};
+
+		private:
+			using TData = std::shared_ptr<const std::vector<uint8_t>>;
+
+			struct BlockKey
+			{
+				FileKey File;
+				uint64_t Index = 0;
+
+				bool operator==(const BlockKey& other) const noexcept
+				{
+					return Index == other.Index && File == other.File;
+				}
+			};
+			struct BlockKeyHash
+			{
+				size_t operator()(const BlockKey& key) const noexcept;
+			};
+			struct FileIDHash
+			{
+				size_t operator()(const std::pair<uint64_t, uint64_t>& fileID) const noexcept;
+			};
+			struct Block
+			{
+				BlockKey Key;
+				TData Data;
+			};
+			using TBlockList = std::list<Block>;
+
+			struct ResidentBlock
+			{
+				TBlockList::iterator Item;
+				bool IsFrequent = false;
+			};
+			struct alignas(64) Shard
+			{
+				SRWLock Lock;
+
+				// Blocks seen once, blocks seen again after being evicted from 'Recent' and recently evicted keys
+				TBlockList Recent;
+				TBlockList Frequent;
+				std::list<BlockKey> Ghosts;
+				std::unordered_map<BlockKey, ResidentBlock, BlockKeyHash> Blocks;
+				std::unordered_map<BlockKey, std::list<BlockKey>::iterator, BlockKeyHash> GhostIndex;
+
+				size_t RecentBytes = 0;
+				size_t FrequentBytes = 0;
+				size_t Evictions = 0;
+			};
+
+		public:
+			// Returns invalid key if the file can't be identified
+			static FileKey GetFileKey(HANDLE fileHandle) noexcept;
+
+		private:
+			std::unique_ptr<Shard[]> m_Shards;
+			std::atomic<size_t> m_ShardCapacity = 0;
+			std::atomic<size_t> m_Hits = 0;
+			std::atomic<size_t> m_Misses = 0;
+			std::atomic<size_t> m_BytesServed = 0;
+			std::atomic<uint64_t> m_Generation = 0;
+
+			// Volume serial number and file index of files open for reading, with the number of their handles
+			SRWLock m_ReadersLock;
+			std::unordered_map<std::pair<uint64_t, uint64_t>, size_t, FileIDHash> m_Readers;
+
+		private:
+			Shard& GetShard(const BlockKey& key) const noexcept;
+			TData FindBlock(const BlockKey& key);
+			void EvictBlocks(Shard& shard, size_t capacity);
+
+		public:
+			BlockCache();
+			BlockCache(const BlockCache&) = delete;
+
+		public:
+			bool IsEnabled() const noexcept
+			{
+				return m_ShardCapacity.load(std::memory_order_relaxed) != 0;
+			}
+			size_t GetCapacity() const noexcept
+			{
+				return m_ShardCapacity.load(std::memory_order_relaxed) * ShardCount;
+			}
+
+			// Memory budget in bytes, zero disables the cache and releases all blocks
+			void SetCapacity(size_t bytes);
+			void Clear();
+
+			Statistics GetStatistics() const noexcept;
+
+		public:
+			// Copies [offset, offset + size) into the buffer if all the blocks it covers are cached, the range must be within the file
+			bool Read(const FileKey& file, int64_t offset, void* buffer, size_t size);
+
+			// Adds blocks which are entirely covered by the data, last block of the file can be partial. 'generation' is the value
+			// of 'GetGeneration' taken before the data was read, nothing is added if any file has been invalidated since then.
+			void Insert(const FileKey& file, int64_t offset, const void* data, size_t size, uint64_t generation);
+			uint64_t GetGeneration() const noexcept
+			{
+				return m_Generation.load(std::memory_order_acquire);
+			}
+
+			// Files read through the cache, only they can have blocks which 'Invalidate' has to drop
+			void AddReader(const FileKey& file);
+			void RemoveReader(const FileKey& file) noexcept;
+
+			// Drops all blocks of the file regardless of its size and last write time. Every block of every shard is checked,
+			// but only if the file is open for reading, so writes to files which aren't read at the same time cost nothing.
+			void Invalidate(const FileKey& file);
+
+		public:
+			BlockCache& operator=(const BlockCache&) = delete;
+	};
+}
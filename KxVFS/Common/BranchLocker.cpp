@@ -22,8 +22,11 @@ namespace KxVFS
 	{
 		node.WalkToRoot([this](FileNode& node)
 		{
-			node.GetLock().AcquireShared();
-			m_LockData.AddLockedNode(node);
+			if (node.IsLockingEnabled())
+			{
+				node.GetLock().AcquireShared();
+				m_LockData.AddLockedNode(node);
+			}
 			return true;
 		});
 	}
@@ -43,6 +46,11 @@ namespace KxVFS
 	{
 		node.WalkToRoot([this](FileNode& node)
 		{
+			if (!node.IsLockingEnabled())
+			{
+				return true;
+			}
+
 			if (m_LockData.IsStartNode(node))
 			{
 				node.GetLock().AcquireExclusive();
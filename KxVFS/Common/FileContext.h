@@ -3,6 +3,11 @@
 #include "KxVFS/IFileSystem.h"
 #include "KxVFS/Utility.h"
 #include "FileContextEventInfo.h"
+#include "FileContextState.h"
+#include "BlockCache.h"
+#include "ReadAheadState.h"
+#include "WriteBehindBuffer.h"
+#include "FileContextMetadata.h"
 
 namespace KxVFS
 {
@@ -20,12 +25,15 @@ namespace KxVFS
 			FileHandle m_Handle;
 			FileContextEventInfo m_EventInfo;
 			mutable SRWLock m_Lock;
+			FileContextState m_State;
+			bool m_IsLockingEnabled = true;
+			BlockCache::FileKey m_CacheKey;
+			BlockCache::FileKey m_WriterKey;
+			ReadAheadState m_ReadAhead;
+			WriteBehindBuffer m_WriteBuffer;
+			FileContextMetadata m_Metadata;
 
 			PTP_IO m_CompletionPort = nullptr;
-			bool m_AsyncIOActive = false;
-
-			bool m_IsCleanedUp = false;
-			bool m_IsClosed = false;
 
 		public:
 			FileContext(IFileSystem& fileSystem) noexcept
@@ -41,46 +49,65 @@ namespace KxVFS
 		public:
 			[[nodiscard]] MoveableSharedSRWLocker LockShared() noexcept
 			{
-				return m_Lock;
+				if (m_IsLockingEnabled)
+				{
+					return m_Lock;
+				}
+				return {};
+			}
+			// Doesn't wait, 'isLocked' is false and the locker is empty if the lock is held exclusively
+			[[nodiscard]] MoveableSharedSRWLocker TryLockShared(bool& isLocked) noexcept
+			{
+				isLocked = true;
+				if (m_IsLockingEnabled)
+				{
+					if (m_Lock.TryAcquireShared())
+					{
+						return {m_Lock, std::adopt_lock};
+					}
+					isLocked = false;
+				}
+				return {};
 			}
 			[[nodiscard]] MoveableExclusiveSRWLocker LockExclusive() noexcept
 			{
-				return m_Lock;
+				if (m_IsLockingEnabled)
+				{
+					return m_Lock;
+				}
+				return {};
+			}
+			void SetLockingEnabled(bool enabled) noexcept
+			{
+				m_IsLockingEnabled = enabled;
 			}
 
 			bool IsClosed() const noexcept
 			{
-				return m_IsClosed;
+				return m_State.IsClosed();
 			}
 			void MarkClosed() noexcept
 			{
-				m_IsClosed = true;
-			}
-			void MarkOpen() noexcept
-			{
-				m_IsClosed = false;
+				m_State.MarkClosed();
 			}
 
 			bool IsCleanedUp() const noexcept
 			{
-				return m_IsCleanedUp;
+				return m_State.IsCleanedUp();
 			}
 			void MarkCleanedUp() noexcept
 			{
-				m_IsCleanedUp = true;
+				m_State.MarkCleanedUp();
 			}
-			void MarkActive() noexcept
+
+			// Makes a pooled context open and active again
+			void ResetState() noexcept
 			{
-				m_IsCleanedUp = false;
+				m_State.Reset();
 			}
-
 			void InterlockedGetState(bool& isClosed, bool& isCleanedUp) const noexcept
 			{
-				if (SharedSRWLocker lock(m_Lock); true)
-				{
-					isClosed = m_IsClosed;
-					isCleanedUp = m_IsCleanedUp;
-				}
+				m_State.Get(isClosed, isCleanedUp);
 			}
 
 			IFileSystem& GetFileSystem() const noexcept
@@ -122,6 +149,44 @@ namespace KxVFS
 				m_Handle.Close();
 			}
 
+			// Valid only for files which can be read through the block cache
+			const BlockCache::FileKey& GetCacheKey() const noexcept
+			{
+				return m_CacheKey;
+			}
+			void SetCacheKey(const BlockCache::FileKey& key) noexcept
+			{
+				m_CacheKey = key;
+			}
+			void ResetCacheKey() noexcept
+			{
+				m_CacheKey = {};
+				m_WriterKey = {};
+			}
+
+			// Valid only for files which can be cached but are opened for writing, their cached blocks are dropped after each change
+			const BlockCache::FileKey& GetWriterKey() const noexcept
+			{
+				return m_WriterKey;
+			}
+			void SetWriterKey(const BlockCache::FileKey& key) noexcept
+			{
+				m_WriterKey = key;
+			}
+
+			ReadAheadState& GetReadAhead() noexcept
+			{
+				return m_ReadAhead;
+			}
+			WriteBehindBuffer& GetWriteBuffer() noexcept
+			{
+				return m_WriteBuffer;
+			}
+			FileContextMetadata& GetMetadata() noexcept
+			{
+				return m_Metadata;
+			}
+
 			const FileContextEventInfo& GetEventInfo() const noexcept
 			{
 				return m_EventInfo;
@@ -135,13 +200,28 @@ namespace KxVFS
 				m_EventInfo.Reset();
 			}
 
+			// Fails if the context is closed, otherwise 'EndAsyncIO' must follow once the operation is done or has failed to start
+			bool BeginAsyncIO() noexcept
+			{
+				return m_State.BeginAsyncIO();
+			}
+			void EndAsyncIO() noexcept
+			{
+				m_State.EndAsyncIO();
+			}
+			bool IsAsyncIOActive() const noexcept
+			{
+				return m_State.GetAsyncIOCount() != 0;
+			}
+
+			// Used by 'ThreadpoolIOBackend'
 			bool IsThreadpoolIOCreated() const noexcept
 			{
 				return m_CompletionPort != nullptr;
 			}
-			bool IsThreadpoolIOActive() const noexcept
+			PTP_IO GetThreadpoolIO() const noexcept
 			{
-				return m_AsyncIOActive;
+				return m_CompletionPort;
 			}
 			bool CreateThreadpoolIO(PTP_WIN32_IO_CALLBACK callback, TP_CALLBACK_ENVIRON& environment) noexcept
 			{
@@ -152,23 +232,12 @@ namespace KxVFS
 				}
 				return false;
 			}
-			void StartThreadpoolIO() noexcept
-			{
-				::StartThreadpoolIo(m_CompletionPort);
-				m_AsyncIOActive = true;
-			}
-			void CancelThreadpoolIO() noexcept
-			{
-				::CancelThreadpoolIo(m_CompletionPort);
-				m_AsyncIOActive = false;
-			}
 			void CloseThreadpoolIO() noexcept
 			{
 				if (m_CompletionPort)
 				{
 					::CloseThreadpoolIo(m_CompletionPort);
 					m_CompletionPort = nullptr;
-					m_AsyncIOActive = false;
 				}
 			}
 	};
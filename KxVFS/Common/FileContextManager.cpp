@@ -12,7 +12,10 @@ namespace KxVFS
 	{
 		if (!m_IsInitialized)
 		{
-			m_FileContextPool.reserve(128);
+			m_FileContextPool.Reserve(m_FileContextPoolInitialSize, [this]()
+			{
+				return new(std::nothrow) FileContext(m_FileSystem);
+			});
 			m_IsInitialized = true;
 			return true;
 		}
@@ -22,17 +25,7 @@ namespace KxVFS
 	{
 		if (m_IsInitialized)
 		{
-			if (CriticalSectionLocker lock(m_FileContextPoolCS); true)
-			{
-				for (FileContext* fileContext: m_FileContextPool)
-				{
-					DeleteContext(fileContext);
-				}
-
-				m_FileContextPool.clear();
-				m_FileContextPool.shrink_to_fit();
-				m_FileContextPoolMaxSize = 0;
-			}
+			m_FileContextPool.Clear();
 			m_IsInitialized = false;
 		}
 	}
@@ -40,11 +33,9 @@ namespace KxVFS
 	void FileContextManager::PushContext(FileContext& fileContext)
 	{
 		m_IOManager.OnPushFileContext(fileContext);
-		if (CriticalSectionLocker lock(m_FileContextPoolCS); true)
-		{
-			m_FileContextPool.push_back(&fileContext);
-			m_FileContextPoolMaxSize = std::max(m_FileContextPoolMaxSize, m_FileContextPool.size());
-		}
+		fileContext.GetReadAhead().Reset();
+		fileContext.GetWriteBuffer().Reset();
+		m_FileContextPool.Push(fileContext);
 	}
 	void FileContextManager::DeleteContext(FileContext* fileContext) noexcept
 	{
@@ -61,13 +52,7 @@ namespace KxVFS
 			return nullptr;
 		}
 
-		FileContext* fileContext = nullptr;
-		if (CriticalSectionLocker lock(m_FileContextPoolCS); !m_FileContextPool.empty())
-		{
-			fileContext = m_FileContextPool.back();
-			m_FileContextPool.pop_back();
-		}
-
+		FileContext* fileContext = m_FileContextPool.Pop();
 		if (!fileContext)
 		{
 			fileContext = new(std::nothrow) FileContext(m_FileSystem);
@@ -77,9 +62,13 @@ namespace KxVFS
 			}
 		}
 		fileContext->AssignHandle(std::move(fileHandle));
-		fileContext->MarkOpen();
-		fileContext->MarkActive();
+		fileContext->ResetState();
+		fileContext->SetLockingEnabled(m_LockingPolicy != LockingPolicy::SingleThreaded);
 		fileContext->GetEventInfo().Reset();
+		fileContext->ResetCacheKey();
+		fileContext->GetReadAhead().Reset();
+		fileContext->GetWriteBuffer().Reset();
+		fileContext->GetMetadata().Reset();
 
 		if (!m_IOManager.OnPopFileContext(*fileContext))
 		{
@@ -89,7 +78,11 @@ namespace KxVFS
 	}
 
 	FileContextManager::FileContextManager(IFileSystem& fileSystem) noexcept
-		:m_FileSystem(fileSystem), m_IOManager(fileSystem.GetIOManager())
+		:m_FileSystem(fileSystem), m_IOManager(fileSystem.GetIOManager()),
+		m_FileContextPool([this](FileContext* fileContext)
+		{
+			DeleteContext(fileContext);
+		})
 	{
 	}
 }
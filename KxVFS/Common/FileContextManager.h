@@ -1,6 +1,7 @@
 #pragma once
 #include "KxVFS/Common.hpp"
 #include "KxVFS/Common/FileContext.h"
+#include "KxVFS/Common/LockingPolicy.h"
 #include <atomic>
 
 namespace KxVFS
@@ -19,9 +20,9 @@ namespace KxVFS
 			IFileSystem& m_FileSystem;
 			IOManager& m_IOManager;	
 
-			std::vector<FileContext*> m_FileContextPool;
-			CriticalSection m_FileContextPoolCS;
-			size_t m_FileContextPoolMaxSize = 0;
+			ObjectPool<FileContext> m_FileContextPool;
+			size_t m_FileContextPoolInitialSize = 128;
+			LockingPolicy m_LockingPolicy = LockingPolicy::Full;
 
 			std::atomic<bool> m_IsUnmounted = false;
 			bool m_IsInitialized = false;
@@ -43,6 +44,27 @@ namespace KxVFS
 			bool Init();
 			void Cleanup() noexcept;
 
+			// Number of contexts created at 'Init' and number of unused contexts above which they're destroyed
+			void SetPoolSize(size_t initialSize, size_t highWaterMark) noexcept
+			{
+				m_FileContextPoolInitialSize = initialSize;
+				m_FileContextPool.SetHighWaterMark(highWaterMark);
+			}
+			BasicObjectPool::Statistics GetPoolStatistics() const noexcept
+			{
+				return m_FileContextPool.GetStatistics();
+			}
+
+			// Applied to contexts as they're taken from the pool
+			LockingPolicy GetLockingPolicy() const noexcept
+			{
+				return m_LockingPolicy;
+			}
+			void SetLockingPolicy(LockingPolicy policy) noexcept
+			{
+				m_LockingPolicy = policy;
+			}
+
 			void PushContext(FileContext& fileContext);
 			void DeleteContext(FileContext* fileContext) noexcept;
 			FileContext* PopContext(FileHandle fileHandle) noexcept;
@@ -0,0 +1,106 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Misc/IncludeWindows.h"
+#include <atomic>
+
+namespace KxVFS
+{
+	// File size and last write time as changed by writes through a single open file. They're computed from the writes themselves
+	// instead of asking the file system after each one. Dirty flag stays set until the owner refreshes its information from the handle,
+	// pending flag until the owner copies these values somewhere. Everything is lock-free, so concurrent writes don't wait for each other.
+	class FileContextMetadata final
+	{
+		private:
+			std::atomic<int64_t> m_FileSize = -1;
+			std::atomic<int64_t> m_LastWriteTime = 0;
+			std::atomic<bool> m_IsDirty = false;
+			std::atomic<bool> m_IsPending = false;
+
+		private:
+			void OnChanged() noexcept
+			{
+				FILETIME fileTime = {};
+				::GetSystemTimeAsFileTime(&fileTime);
+				m_LastWriteTime.store((static_cast<int64_t>(fileTime.dwHighDateTime) << 32)|fileTime.dwLowDateTime, std::memory_order_relaxed);
+
+				m_IsDirty.store(true, std::memory_order_release);
+				m_IsPending.store(true, std::memory_order_release);
+			}
+
+		public:
+			FileContextMetadata() noexcept = default;
+			FileContextMetadata(const FileContextMetadata&) = delete;
+
+		public:
+			bool IsDirty() const noexcept
+			{
+				return m_IsDirty.load(std::memory_order_acquire);
+			}
+			bool IsFileSizeKnown() const noexcept
+			{
+				return m_FileSize.load(std::memory_order_relaxed) >= 0;
+			}
+			int64_t GetFileSize() const noexcept
+			{
+				return m_FileSize.load(std::memory_order_relaxed);
+			}
+
+			// File size is unknown until it's given here, writes which append to the end of the file are ignored until then
+			void SetFileSize(int64_t fileSize) noexcept
+			{
+				m_FileSize.store(fileSize, std::memory_order_relaxed);
+				OnChanged();
+			}
+			void OnWritten(int64_t offset, size_t size) noexcept
+			{
+				int64_t fileSize = m_FileSize.load(std::memory_order_relaxed);
+				const int64_t end = offset + static_cast<int64_t>(size);
+				while (fileSize >= 0 && end > fileSize && !m_FileSize.compare_exchange_weak(fileSize, end, std::memory_order_relaxed))
+				{
+				}
+				OnChanged();
+			}
+			void OnAppended(size_t size) noexcept
+			{
+				int64_t fileSize = m_FileSize.load(std::memory_order_relaxed);
+				while (fileSize >= 0 && !m_FileSize.compare_exchange_weak(fileSize, fileSize + static_cast<int64_t>(size), std::memory_order_relaxed))
+				{
+				}
+				OnChanged();
+			}
+
+			// Clears the pending flag and returns current values, size is negative if it's unknown. Returns false if nothing has changed.
+			bool TakePending(int64_t& fileSize, FILETIME& lastWriteTime) noexcept
+			{
+				if (m_IsPending.exchange(false, std::memory_order_acq_rel))
+				{
+					const int64_t value = m_LastWriteTime.load(std::memory_order_relaxed);
+					lastWriteTime.dwLowDateTime = static_cast<DWORD>(value);
+					lastWriteTime.dwHighDateTime = static_cast<DWORD>(value >> 32);
+					fileSize = m_FileSize.load(std::memory_order_relaxed);
+					return true;
+				}
+				return false;
+			}
+
+			// Called once the owner has the information from the file system itself, 'fileSize' becomes the base for next writes
+			void OnRefreshed(int64_t fileSize) noexcept
+			{
+				m_IsDirty.store(false, std::memory_order_release);
+				m_IsPending.store(false, std::memory_order_release);
+				m_FileSize.store(fileSize, std::memory_order_relaxed);
+			}
+
+			// Only valid when nothing else uses the context
+			void Reset() noexcept
+			{
+				m_FileSize = -1;
+				m_LastWriteTime = 0;
+				m_IsDirty = false;
+				m_IsPending = false;
+			}
+
+		public:
+			FileContextMetadata& operator=(const FileContextMetadata&) = delete;
+	};
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+
+namespace KxVFS
+{
+	// Lifecycle of a 'FileContext' packed into one atomic word: closed and cleaned-up flags and number of async operations in flight.
+	// Context goes from open to cleaned up and then to closed, it's reset to open only when it's taken from the pool again.
+	// Async operations can be started in any state except closed and closing waits for those already started to complete.
+	class FileContextState final
+	{
+		private:
+			static constexpr uint32_t ClosedFlag = 1u << 0;
+			static constexpr uint32_t CleanedUpFlag = 1u << 1;
+			static constexpr uint32_t AsyncIOUnit = 1u << 2;
+
+		private:
+			std::atomic<uint32_t> m_Value = 0;
+
+		private:
+			static size_t GetAsyncIOCount(uint32_t value) noexcept
+			{
+				return value / AsyncIOUnit;
+			}
+
+		public:
+			FileContextState() noexcept = default;
+			FileContextState(const FileContextState&) = delete;
+
+		public:
+			bool IsClosed() const noexcept
+			{
+				return (m_Value.load(std::memory_order_acquire) & ClosedFlag) != 0;
+			}
+			bool IsCleanedUp() const noexcept
+			{
+				return (m_Value.load(std::memory_order_acquire) & CleanedUpFlag) != 0;
+			}
+			size_t GetAsyncIOCount() const noexcept
+			{
+				return GetAsyncIOCount(m_Value.load(std::memory_order_acquire));
+			}
+			void Get(bool& isClosed, bool& isCleanedUp) const noexcept
+			{
+				const uint32_t value = m_Value.load(std::memory_order_acquire);
+				isClosed = (value & ClosedFlag) != 0;
+				isCleanedUp = (value & CleanedUpFlag) != 0;
+			}
+
+			// Only valid when nothing else uses the context
+			void Reset() noexcept
+			{
+				m_Value.store(0, std::memory_order_release);
+			}
+			void MarkCleanedUp() noexcept
+			{
+				m_Value.fetch_or(CleanedUpFlag, std::memory_order_acq_rel);
+			}
+			void MarkClosed() noexcept
+			{
+				uint32_t value = m_Value.fetch_or(ClosedFlag, std::memory_order_acq_rel);
+				for (size_t i = 0; GetAsyncIOCount(value) != 0; i++)
+				{
+					if (i < 64)
+					{
+						std::this_thread::yield();
+					}
+					else
+					{
+						std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					}
+					value = m_Value.load(std::memory_order_acquire);
+				}
+			}
+
+			// Fails if the context is already closed, otherwise 'EndAsyncIO' must be called once the operation is done
+			bool BeginAsyncIO() noexcept
+			{
+				uint32_t value = m_Value.load(std::memory_order_relaxed);
+				do
+				{
+					if (value & ClosedFlag)
+					{
+						return false;
+					}
+				}
+				while (!m_Value.compare_exchange_weak(value, value + AsyncIOUnit, std::memory_order_acq_rel, std::memory_order_relaxed));
+				return true;
+			}
+			void EndAsyncIO() noexcept
+			{
+				m_Value.fetch_sub(AsyncIOUnit, std::memory_order_acq_rel);
+			}
+
+		public:
+			FileContextState& operator=(const FileContextState&) = delete;
+	};
+}
@@ -1,6 +1,13 @@
 #include "stdafx.h"
 #include "KxVFS/Utility.h"
 #include "FileNode.h"
+#include "FileNodePathIndex.h"
+
+namespace
+{
+	// Every node is prefixed with a pointer to the arena it was allocated from (null for the heap)
+	constexpr size_t AllocationHeaderSize = KxVFS::FileNodeArena::Alignment;
+}
 
 namespace KxVFS
 {
@@ -11,35 +18,90 @@ namespace KxVFS
 			return &rootNode;
 		}
 
+		// Walk doesn't lock anything, see 'FileNodeChildren'
+		EpochGuard guard;
+
 		lastScanned = &rootNode;
-		if (rootNode.HasChildren())
+		if (FileNodePathIndex* index = rootNode.GetPathIndex(); index && rootNode.IsRootNode())
 		{
-			auto ScanChildren = [&lastScanned](FileNode& scannedNode, DynamicStringRefW folderName) -> FileNode*
+			// Index takes paths without quotes, they're stripped from each component the same way the walk below does it.
+			// Components which are empty without the quotes can't match anything, such paths are left to the walk.
+			DynamicStringW unquotedPath;
+			DynamicStringRefW indexPath = relativePath;
+			bool isIndexable = true;
+			if (relativePath.find(L'"') != DynamicStringRefW::npos)
 			{
-				auto it = scannedNode.m_Children.find(folderName);
-				if (it != scannedNode.m_Children.end())
+				Utility::String::SplitBySeparator(relativePath, L'\\', [&unquotedPath, &isIndexable](DynamicStringRefW folderName)
 				{
-					lastScanned = it->second.get();
-					return lastScanned;
-				}
-				return nullptr;
-			};
-			auto StripQuotes = [](DynamicStringRefW folderName)
+					folderName = StripQuotes(folderName);
+					if (folderName.empty())
+					{
+						isIndexable = false;
+						return false;
+					}
+
+					if (!unquotedPath.empty())
+					{
+						unquotedPath += L'\\';
+					}
+					unquotedPath += folderName;
+					return true;
+				});
+				indexPath = unquotedPath;
+			}
+
+			FileNode* node = nullptr;
+			switch (isIndexable ? index->Find(indexPath, node) : FileNodePathIndex::Result::Unknown)
 			{
-				if (!folderName.empty() && folderName.front() == L'"')
+				case FileNodePathIndex::Result::Found:
+				{
+					lastScanned = node->GetParent();
+					if ((type == NavigateTo::Folder && !node->IsDirectory()) || (type == NavigateTo::File && !node->IsFile()))
+					{
+						return nullptr;
+					}
+					return node;
+				}
+				case FileNodePathIndex::Result::NotFound:
 				{
-					folderName.remove_prefix(1);
+					// Callers creating a new item need its parent, it can be found the same way unless the walk
+					// would stop somewhere above it. Leave that case to the walk to get the same 'lastScanned' node.
+					DynamicStringRefW parentPath = indexPath.substr(0, indexPath.find_last_not_of(L'\\') + 1);
+					parentPath = parentPath.substr(0, parentPath.rfind(L'\\') + 1);
+					while (!parentPath.empty() && parentPath.back() == L'\\')
+					{
+						parentPath.remove_suffix(1);
+					}
+
+					// Root is already in 'lastScanned'
+					if (parentPath.empty())
+					{
+						return nullptr;
+					}
+					if (FileNode* parentNode = nullptr; index->Find(parentPath, parentNode) == FileNodePathIndex::Result::Found)
+					{
+						lastScanned = parentNode;
+						return nullptr;
+					}
+					break;
 				}
-				if (!folderName.empty() && folderName.back() == L'"')
+			}
+		}
+
+		if (rootNode.HasChildren())
+		{
+			auto ScanChildren = [&lastScanned](FileNode& scannedNode, DynamicStringRefW folderName) -> FileNode*
+			{
+				if (FileNode* node = scannedNode.m_Children.find(folderName, HashFileName(folderName)))
 				{
-					folderName.remove_suffix(1);
+					lastScanned = node;
+					return lastScanned;
 				}
-				return folderName;
+				return nullptr;
 			};
-
 			FileNode* finalNode = nullptr;
 			DynamicStringW relativePathLC = Utility::StringToLower(relativePath);
-			Utility::String::SplitBySeparator(relativePathLC, L'\\', [&ScanChildren, &StripQuotes, &finalNode, &rootNode](DynamicStringRefW folderName)
+			Utility::String::SplitBySeparator(relativePathLC, L'\\', [&ScanChildren, &finalNode, &rootNode](DynamicStringRefW folderName)
 			{
 				finalNode = ScanChildren(finalNode ? *finalNode : rootNode, StripQuotes(folderName));
 				return finalNode != nullptr;
@@ -66,97 +128,252 @@ namespace KxVFS
 	{
 		return Utility::Comparator::StringHashNoCase()(name);
 	}
-
-	void FileNode::UpdatePaths()
+	DynamicStringRefW FileNode::StripQuotes(DynamicStringRefW name) noexcept
 	{
-		if (!m_VirtualDirectory.empty())
+		if (!name.empty() && name.front() == L'"')
 		{
-			m_Item.SetSource(ConstructPath(PathParts::BaseDirectory|PathParts::RelativePath));
-			m_FullPath = ConstructPath(PathParts::BaseDirectory|PathParts::RelativePath|PathParts::Name);
-			m_RelativePath = ConstructPath(PathParts::RelativePath|PathParts::Name);
+			name.remove_prefix(1);
 		}
-		else
+		if (!name.empty() && name.back() == L'"')
 		{
-			m_Item.SetSource({});
-			m_FullPath.clear();
-			m_RelativePath.clear();
+			name.remove_suffix(1);
 		}
-		m_NameLC = Utility::StringToLower(m_Item.GetName());
+		return name;
 	}
-	bool FileNode::RenameThisNode(DynamicStringRefW newName)
+
+	void* FileNode::operator new(size_t size)
 	{
-		// Rename this node in parent's children
-		Map& parentItems = m_Parent->m_Children;
+		return operator new(size, nullptr);
+	}
+	void* FileNode::operator new(size_t size, FileNodeArena* arena)
+	{
+		const size_t blockSize = size + AllocationHeaderSize;
+		void* block = arena ? arena->Allocate(blockSize) : ::operator new(blockSize);
 
-		// Node name must still be old name when this function is called
-		if (auto nodeHandle = parentItems.extract(m_NameLC))
+		*static_cast<FileNodeArena**>(block) = arena;
+		return static_cast<uint8_t*>(block) + AllocationHeaderSize;
+	}
+	void FileNode::operator delete(void* ptr, size_t size) noexcept
+	{
+		if (ptr)
 		{
-			nodeHandle.key() = Utility::StringToLower(newName);
-			parentItems.insert(std::move(nodeHandle));
+			void* block = static_cast<uint8_t*>(ptr) - AllocationHeaderSize;
+			if (FileNodeArena* arena = *static_cast<FileNodeArena**>(block))
+			{
+				arena->Deallocate(block, size + AllocationHeaderSize);
+			}
+			else
+			{
+				::operator delete(block);
+			}
+		}
+	}
+	void FileNode::operator delete(void* ptr, FileNodeArena* arena) noexcept
+	{
+		operator delete(ptr, sizeof(FileNode));
+	}
 
-			// If we succeed, the caller must change the name in 'm_Item' and call 'UpdatePaths'
+	FileNode::~FileNode() noexcept
+	{
+		ReleaseNames();
+	}
+
+	void FileNode::AssignName(DynamicStringRefW name)
+	{
+		// Old names are released only after the new ones are in place, readers may still see them until the epoch ends
+		FileNodeArena& arena = GetArena();
+		DynamicStringW nameLC = Utility::StringToLower(name);
+		const InternedString newName = arena.AddString(name);
+		const InternedString newNameLC = arena.AddString(nameLC);
+
+		m_NameHash.store(HashFileName(nameLC), std::memory_order_relaxed);
+		arena.ReleaseString(m_Name.exchange(newName, std::memory_order_acq_rel));
+		arena.ReleaseString(m_NameLC.exchange(newNameLC, std::memory_order_acq_rel));
+	}
+	void FileNode::ReleaseNames() noexcept
+	{
+		FileNodeArena& arena = GetArena();
+		arena.ReleaseString(m_Name.exchange({}, std::memory_order_acq_rel));
+		arena.ReleaseString(m_NameLC.exchange({}, std::memory_order_acq_rel));
+		arena.ReleaseString(m_VirtualDirectory.exchange({}, std::memory_order_acq_rel));
+	}
+	bool FileNode::RenameThisNode(DynamicStringRefW newName)
+	{
+		// Rename this node in parent's children. Children are keyed by the node's own name,
+		// so take it out using the old name and put it back after the name is changed.
+		FileNode* parent = GetParent();
+		if (std::unique_ptr<FileNode> thisNode = parent->m_Children.extract(*this))
+		{
+			// Paths of the whole branch change with the name
+			if (FileNodePathIndex* index = GetPathIndex())
+			{
+				index->RemoveBranch(*this);
+			}
+
+			AssignName(newName);
+			parent->AddChild(std::move(thisNode));
 			return true;
 		}
 		return false;
 	}
-	DynamicStringW FileNode::ConstructPath(FlagSet<PathParts> options) const
+	bool FileNode::MoveTo(FileNode& newParent, DynamicStringRefW newName)
 	{
-		DynamicStringW fullPath = options & PathParts::Namespace ? Utility::GetLongPathPrefix() : NullDynamicStringW;
-		if (options & PathParts::BaseDirectory)
+		// Same as renaming except the node is put into another parent
+		FileNode* parent = GetParent();
+		if (std::unique_ptr<FileNode> thisNode = parent ? parent->m_Children.extract(*this) : nullptr)
 		{
-			fullPath += m_VirtualDirectory;
-			fullPath += L'\\';
-		}
+			if (FileNodePathIndex* index = GetPathIndex())
+			{
+				index->RemoveBranch(*this);
+			}
 
-		if (options & PathParts::RelativePath)
+			SetParent(&newParent);
+			AssignName(newName);
+			newParent.AddChild(std::move(thisNode));
+			return true;
+		}
+		return false;
+	}
+	size_t FileNode::ConstructPath(FlagSet<PathParts> options, wchar_t* buffer, size_t bufferSize) const noexcept
+	{
+		// Measure the path first and then fill it from the end, walking up to the root only once per pass.
+		// Names aren't locked, so a concurrent rename or move can change the path between the passes. Each name and parent is
+		// a single atomic pointer read once per pass, and if the passes don't agree on the length the path is constructed again.
+		// Replaced names are freed only after the epoch, so the ones read here stay valid until the guard is left.
+		EpochGuard guard;
+		for (;;)
 		{
-			DynamicStringW relativePath;
-			WalkToRoot([this, &relativePath](const FileNode& node)
+			const InternedString virtualDirectory = m_VirtualDirectory.load(std::memory_order_acquire);
+			const InternedString name = m_Name.load(std::memory_order_acquire);
+			if (virtualDirectory.empty())
 			{
-				if (&node != this)
+				if (buffer && bufferSize != 0)
 				{
-					DynamicStringW name = node.GetName();
-					name += L'\\';
-					name += relativePath;
-					relativePath = name;
+					*buffer = L'\0';
 				}
-				return true;
-			});
-			fullPath += relativePath;
-		}
+				return 0;
+			}
 
-		if (options & PathParts::Name)
-		{
-			fullPath += GetName();
+			const DynamicStringRefW prefix = options & PathParts::Namespace ? Utility::GetLongPathPrefix() : DynamicStringRefW();
+			size_t length = prefix.length();
+			if (options & PathParts::BaseDirectory)
+			{
+				length += virtualDirectory.length() + 1;
+			}
+			if (options & PathParts::RelativePath)
+			{
+				for (const FileNode* node = GetParent(); node && !node->IsRootNode(); node = node->GetParent())
+				{
+					const InternedString parentName = node->m_Name.load(std::memory_order_acquire);
+					length += parentName.length() + 1;
+				}
+			}
+			if (options & PathParts::Name)
+			{
+				length += name.length();
+			}
+
+			// Without the name the path ends with a separator which isn't a part of the result
+			const bool removeTrailingSlash = !(options & PathParts::Name) && length > prefix.length();
+			const size_t resultLength = removeTrailingSlash ? length - 1 : length;
+			if (buffer == nullptr || bufferSize <= resultLength)
+			{
+				return resultLength;
+			}
+
+			size_t position = length;
+			bool isChanged = false;
+			auto Prepend = [buffer, &position, &isChanged](DynamicStringRefW value)
+			{
+				if (!isChanged && value.length() <= position)
+				{
+					position -= value.length();
+					Utility::CopyMemory(buffer + position, value.data(), value.length());
+				}
+				else
+				{
+					isChanged = true;
+				}
+			};
+			auto PrependSeparator = [buffer, &position, &isChanged, resultLength]()
+			{
+				if (isChanged || position == 0)
+				{
+					isChanged = true;
+				}
+				else if (--position != resultLength)
+				{
+					// The last separator would go right where the null terminator is
+					buffer[position] = L'\\';
+				}
+			};
+
+			if (options & PathParts::Name)
+			{
+				Prepend(name);
+			}
+			if (options & PathParts::RelativePath)
+			{
+				for (const FileNode* node = GetParent(); node && !node->IsRootNode(); node = node->GetParent())
+				{
+					const InternedString parentName = node->m_Name.load(std::memory_order_acquire);
+					PrependSeparator();
+					Prepend(parentName);
+				}
+			}
+			if (options & PathParts::BaseDirectory)
+			{
+				PrependSeparator();
+				Prepend(virtualDirectory);
+			}
+			Prepend(prefix);
+
+			if (!isChanged && position == 0)
+			{
+				buffer[resultLength] = L'\0';
+				return resultLength;
+			}
 		}
-		else
+	}
+	void FileNode::ConstructPath(FlagSet<PathParts> options, DynamicStringW& buffer) const
+	{
+		// Path can change between the calls, so it's measured again until it fits
+		size_t length = ConstructPath(options, nullptr, 0);
+		for (;;)
 		{
-			// Remove trailing slash
-			fullPath.erase(fullPath.length() - 1, 1);
+			// Dynamic string always keeps space for the null terminator past its length
+			buffer.resize(length);
+			const size_t resultLength = ConstructPath(options, buffer.data(), length + 1);
+			if (resultLength <= length)
+			{
+				buffer.resize(resultLength);
+				break;
+			}
+			length = resultLength;
 		}
-		return fullPath;
 	}
-	void FileNode::UpdateFileTree(DynamicStringRefW searchPath, bool queryShortNames)
+	void FileNode::UpdateFileTree(DynamicStringRefW searchPath)
 	{
-		m_VirtualDirectory = searchPath;
-		UpdatePaths();
+		SetVirtualDirectory(searchPath);
 		ClearChildren();
 
-		auto BuildTreeBranch = [this, queryShortNames](FileNode::RefVector& directories, DynamicStringRefW path, FileNode& treeNode, FileNode* parentNode)
+		auto BuildTreeBranch = [this](FileNode::RefVector& directories, DynamicStringRefW path, FileNode& treeNode, FileNode* parentNode)
 		{
+			std::vector<std::unique_ptr<FileNode>> nodes;
+
 			FileFinder finder(path, L"*");
-			finder.QueryShortNames(queryShortNames);
 			for (FileItem item = finder.FindNext(); item.IsOK(); item = finder.FindNext())
 			{
 				if (item.IsNormalItem())
 				{
-					FileNode& node = treeNode.AddChild(std::make_unique<FileNode>(item, parentNode));
-					if (node.IsDirectory())
+					std::unique_ptr<FileNode>& node = nodes.emplace_back(Create(m_Arena, item, parentNode));
+					if (node->IsDirectory())
 					{
-						directories.emplace_back(&node);
+						directories.emplace_back(node.get());
 					}
 				}
 			}
+			treeNode.AddChildren(std::move(nodes));
 		};
 
 		// Build top level
@@ -164,6 +381,7 @@ namespace KxVFS
 		BuildTreeBranch(directories, searchPath, *this, this);
 
 		// Build subdirectories
+		DynamicStringW directoryPath;
 		while (!directories.empty())
 		{
 			FileNode::RefVector roundDirectories;
@@ -171,7 +389,8 @@ namespace KxVFS
 
 			for (FileNode* node: directories)
 			{
-				BuildTreeBranch(roundDirectories, node->GetFullPath(), *node, node);
+				node->ConstructPath(PathParts::BaseDirectory|PathParts::RelativePath|PathParts::Name, directoryPath);
+				BuildTreeBranch(roundDirectories, directoryPath, *node, node);
 			}
 			directories = std::move(roundDirectories);
 		}
@@ -179,51 +398,114 @@ namespace KxVFS
 	void FileNode::MakeNull() noexcept
 	{
 		ClearChildren();
-		m_Item = {};
-		m_NameLC.clear();
-		m_VirtualDirectory = {};
-		m_FullPath.clear();
-		m_RelativePath.clear();
-		m_Parent = nullptr;
+		m_Info.MakeNull();
+		ReleaseNames();
+		m_NameHash.store(0, std::memory_order_relaxed);
+		m_Layers = {};
+		SetParent(nullptr);
 	}
 
-	const FileNode* FileNode::WalkTree(const TreeWalker& func) const
+	DynamicStringW FileNode::GetFileExtension() const
 	{
-		std::function<const FileNode* (const FileNode::Map&)> Recurse;
-		Recurse = [&Recurse, &func](const FileNode::Map& children) -> const FileNode*
+		if (IsFile())
 		{
-			for (const auto& [name, node]: children)
+			const DynamicStringRefW name = GetName();
+			const size_t pos = name.rfind(L'.');
+			if (pos != DynamicStringRefW::npos)
 			{
-				if (!func(*node))
-				{
-					return node.get();
-				}
-
-				if (node->HasChildren())
-				{
-					Recurse(node->GetChildren());
-				}
+				return name.substr(pos + 1);
 			}
-			return nullptr;
-		};
-		return Recurse(m_Children);
+		}
+		return {};
 	}
-
-	bool FileNode::RemoveChild(FileNode& node) noexcept
+	bool FileNode::UpdateItemInfo(DynamicStringRefW fullPath)
 	{
-		auto it = m_Children.find(node.GetNameLC());
-		if (it != m_Children.end())
+		FileFinder finder(fullPath);
+		if (FileItem item = finder.FindNext(); item.IsOK())
 		{
-			m_Children.erase(it);
+			AssignItemInfo(item);
 			return true;
 		}
+
+		m_Info.MakeNull();
 		return false;
 	}
+	void FileNode::AssignItemInfo(const FileItem& item)
+	{
+		m_Info.FromFileItem(item);
+		AssignName(item.GetName());
+	}
+
+	void FileNode::ClearChildren() noexcept
+	{
+		if (FileNodePathIndex* index = GetPathIndex())
+		{
+			EpochGuard guard;
+			m_Children.for_each([index](const FileNode& node)
+			{
+				index->RemoveBranch(node);
+				return true;
+			});
+		}
+		m_Children.clear();
+	}
+	bool FileNode::RemoveChild(FileNode& node) noexcept
+	{
+		if (FileNodePathIndex* index = GetPathIndex(); index && node.GetParent() == this)
+		{
+			index->RemoveBranch(node);
+		}
+		return m_Children.erase(node);
+	}
 	FileNode& FileNode::AddChild(std::unique_ptr<FileNode> node)
 	{
-		DynamicStringW name = node->GetNameLC();
-		auto [it, inserted] = m_Children.insert_or_assign(std::move(name), std::move(node));
-		return *it->second;
+		FileNode& ref = *node;
+
+		std::vector<std::unique_ptr<FileNode>> nodes;
+		nodes.emplace_back(std::move(node));
+		AddChildren(std::move(nodes));
+
+		return ref;
+	}
+	FileNode& FileNode::AddChildIfAbsent(std::unique_ptr<FileNode> node, bool& isAdded)
+	{
+		FileNode& ref = m_Children.insert_if_absent(std::move(node), isAdded);
+		if (FileNodePathIndex* index = GetPathIndex(); index && isAdded)
+		{
+			index->AddBranch(ref);
+		}
+		return ref;
+	}
+	void FileNode::AddChildren(std::vector<std::unique_ptr<FileNode>> nodes)
+	{
+		// Small directories are copy-on-write and big ones may need a bigger table, adding children all at once makes a single copy
+		RefVector addedNodes;
+		FileNodePathIndex* index = GetPathIndex();
+		if (index)
+		{
+			addedNodes.reserve(nodes.size());
+			for (const auto& node: nodes)
+			{
+				// Child with the same name is replaced, so its branch is no longer in the tree
+				if (FileNode* existingNode = m_Children.find(node->GetNameLC(), node->GetNameHash()); existingNode && existingNode != node.get())
+				{
+					index->RemoveBranch(*existingNode);
+				}
+				addedNodes.push_back(node.get());
+			}
+		}
+
+		// A later node with the same name replaces an earlier one from the same batch, only the ones in the directory are indexed.
+		// Replaced nodes are retired by the insert, so they can still be compared with while the guard is held.
+		EpochGuard guard;
+		m_Children.insert(std::move(nodes));
+		for (FileNode* node: addedNodes)
+		{
+			if (m_Children.find(node->GetNameLC(), node->GetNameHash()) == node)
+			{
+				index->AddBranch(*node);
+			}
+		}
 	}
 
 	BranchSharedLocker FileNode::LockBranchShared()
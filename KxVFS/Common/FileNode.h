@@ -2,6 +2,9 @@
 #include "KxVFS/Common.hpp"
 #include "KxVFS/Utility.h"
 #include "BranchLocker.h"
+#include "FileNodeChildren.h"
+#include "FileNodeArena.h"
+#include "FileNodeInfo.h"
 
 namespace KxVFS
 {
@@ -24,7 +27,6 @@ namespace KxVFS
 		friend class BranchExclusiveLocker;
 
 		public:
-			using Map = std::map<DynamicStringW, std::unique_ptr<FileNode>>;
 			using RefVector = std::vector<FileNode*>;
 			using CRefVector = std::vector<const FileNode*>;
 
@@ -70,85 +72,132 @@ namespace KxVFS
 				return node;
 			}
 			
-			template<class TItems, class TFunctor>
-			auto DoWalkChildren(TItems&& children, TFunctor&& func) const -> FileNode*
+			template<class TFunctor>
+			FileNode* DoWalkChildren(TFunctor&& func) const
+			{
+				EpochGuard guard;
+				return m_Children.for_each(func);
+			}
+			static void PushChildren(const FileNode& node, CRefVector& stack)
 			{
-				for (auto&& [name, item]: children)
+				node.m_Children.for_each([&stack](const FileNode& child)
 				{
-					if (!func(*item))
-					{
-						return item.get();
-					}
-				}
-				return nullptr;
+					stack.push_back(&child);
+					return true;
+				});
 			}
 
 		public:
 			static bool IsRequestToRootNode(DynamicStringRefW relativePath) noexcept;
 			static size_t HashFileName(DynamicStringRefW name) noexcept;
 
+			// Path components may be quoted, lookups ignore the quotes
+			static DynamicStringRefW StripQuotes(DynamicStringRefW name) noexcept;
+
+			// Allocates node from the arena if one is provided or from the heap otherwise.
+			// Node names are always interned in the arena, or in the shared one if there's no arena.
+			template<class... Args>
+			static std::unique_ptr<FileNode> Create(FileNodeArena* arena, Args&&... arg)
+			{
+				return std::unique_ptr<FileNode>(new(arena) FileNode(arena, std::forward<Args>(arg)...));
+			}
+
+		public:
+			static void* operator new(size_t size);
+			static void* operator new(size_t size, FileNodeArena* arena);
+			static void operator delete(void* ptr, size_t size) noexcept;
+			static void operator delete(void* ptr, FileNodeArena* arena) noexcept;
+
 		private:
-			Map m_Children;
-			FileItem m_Item;
-			DynamicStringW m_NameLC;
-			DynamicStringW m_FullPath;
-			DynamicStringW m_RelativePath;
-			DynamicStringRefW m_VirtualDirectory;
-			FileNode* m_Parent = nullptr;
+			FileNodeChildren m_Children;
+			FileNodeInfo m_Info;
+			// Names and the parent are changed by renames and moves while paths are constructed without locks,
+			// see 'ConstructPath'. Replaced names are retired through 'EpochReclaimer'.
+			std::atomic<InternedString> m_Name = InternedString();
+			std::atomic<InternedString> m_NameLC = InternedString();
+			std::atomic<InternedString> m_VirtualDirectory = InternedString();
+			InternedLayerSet m_Layers;
+			std::atomic<size_t> m_NameHash = 0;
+			std::atomic<FileNode*> m_Parent = nullptr;
+			FileNodeArena* m_Arena = nullptr;
 			SRWLock m_Lock;
 
 		private:
-			void Init(FileNode* parent = nullptr)
+			void Init()
 			{
-				if (m_Parent)
+				if (const FileNode* parent = GetParent())
 				{
-					m_VirtualDirectory = m_Parent->m_VirtualDirectory;
+					m_VirtualDirectory.store(GetArena().AddString(parent->GetVirtualDirectory()), std::memory_order_release);
 				}
-				UpdatePaths();
 			}
 			void SetParent(FileNode* parent) noexcept
 			{
-				m_Parent = parent;
+				m_Parent.store(parent, std::memory_order_release);
+			}
+			FileNodeArena& GetArena() const
+			{
+				return m_Arena ? *m_Arena : FileNodeArena::GetShared();
 			}
-			void UpdatePaths();
+			FileNodePathIndex* GetPathIndex() const noexcept
+			{
+				return m_Arena ? m_Arena->GetPathIndex() : nullptr;
+			}
+			void AssignName(DynamicStringRefW name);
+			void ReleaseNames() noexcept;
 			bool RenameThisNode(DynamicStringRefW newName);
 
 			SRWLock& GetLock() noexcept
 			{
 				return m_Lock;
 			}
-			DynamicStringW ConstructPath(FlagSet<PathParts> options) const;
+			DynamicStringW ConstructPath(FlagSet<PathParts> options) const
+			{
+				DynamicStringW path;
+				ConstructPath(options, path);
+				return path;
+			}
 
 		public:
-			FileNode() = default;
-			FileNode(const FileItem& item, FileNode* parent = nullptr)
-				:m_Item(item), m_Parent(parent)
+			explicit FileNode(FileNodeArena* arena = nullptr) noexcept
+				:m_Arena(arena)
+			{
+			}
+			FileNode(FileNodeArena* arena, const FileItem& item, FileNode* parent = nullptr)
+				:m_Info(item), m_Parent(parent), m_Arena(arena)
+			{
+				Init();
+				AssignName(item.GetName());
+			}
+			FileNode(FileNodeArena* arena, DynamicStringRefW fullPath, FileNode* parent = nullptr)
+				:FileNode(arena, FileItem(fullPath), parent)
 			{
-				Init(parent);
 			}
-			FileNode(FileItem&& item, FileNode* parent = nullptr)
-				:m_Item(std::move(item)), m_Parent(parent)
+			FileNode(FileNodeArena* arena, DynamicStringRefW name, const FileNodeInfo& info, FileNode* parent = nullptr)
+				:m_Info(info), m_Parent(parent), m_Arena(arena)
 			{
-				Init(parent);
+				Init();
+				AssignName(name);
 			}
-			FileNode(DynamicStringRefW fullPath, FileNode* parent = nullptr)
-				:m_Item(fullPath), m_Parent(parent)
+			FileNode(FileNodeArena* arena, const FileNode& other, FileNode* parent = nullptr)
+				:m_Info(other.m_Info), m_Parent(parent), m_Arena(arena)
 			{
-				Init(parent);
+				AssignName(other.GetName());
+				CopyBasicAttributes(other);
+				SetLayers(std::vector<uint32_t>(other.m_Layers.begin(), other.m_Layers.end()));
 			}
-			~FileNode() = default;
+			FileNode(const FileNode&) = delete;
+			~FileNode() noexcept;
 
 		public:
 			bool IsRootNode() const noexcept
 			{
-				return m_Parent == nullptr;
+				return GetParent() == nullptr;
 			}
 			void CopyBasicAttributes(const FileNode& other)
 			{
-				m_VirtualDirectory = other.m_VirtualDirectory;
-				UpdatePaths();
+				SetVirtualDirectory(other.GetVirtualDirectory());
 			}
-			void UpdateFileTree(DynamicStringRefW searchPath, bool queryShortNames = false);
+			void UpdateFileTree(DynamicStringRefW searchPath);
 			void MakeNull() noexcept;
 
 			FileNode* NavigateToFolder(DynamicStringRefW relativePath) noexcept
@@ -181,7 +230,68 @@ namespace KxVFS
 				return NavigateToElement(*this, relativePath, NavigateTo::Any, lastScanned);
 			}
 
-			const FileNode* WalkTree(const TreeWalker& func) const;
+			// Visits every node below this one until 'func(node)' returns false and returns that node.
+			// Parents are visited before their children, otherwise the order is unspecified.
+			template<class TFunctor>
+			const FileNode* WalkTree(TFunctor&& func) const
+			{
+				EpochGuard guard;
+
+				CRefVector stack;
+				PushChildren(*this, stack);
+				while (!stack.empty())
+				{
+					const FileNode* node = stack.back();
+					stack.pop_back();
+
+					if (!func(*node))
+					{
+						return node;
+					}
+					PushChildren(*node, stack);
+				}
+				return nullptr;
+			}
+
+			// Same as 'WalkTree' but subtrees are spread over up to 'threadCount' threads, zero means one per hardware thread.
+			// Each thread gets its own copy of 'initial' which is passed to 'func(node, state)', then they're combined with
+			// 'reduce(result, std::move(state))' into a copy of 'initial'. Walk stops on all threads once any 'func' call returns false.
+			template<class TState, class TFunctor, class TReducer>
+			TState WalkTreeParallel(const TState& initial, TFunctor&& func, TReducer&& reduce, size_t threadCount = 0) const
+			{
+				struct alignas(64) WorkerState
+				{
+					TState Value;
+				};
+
+				if (threadCount == 0)
+				{
+					threadCount = Utility::GetHardwareThreadCount();
+				}
+				std::vector<WorkerState> states(threadCount, WorkerState{initial});
+
+				// Guard of the calling thread keeps every node that's reachable during the walk alive for all threads
+				EpochGuard guard;
+
+				CRefVector roots;
+				PushChildren(*this, roots);
+				Utility::ParallelWalk(std::move(roots), threadCount, [&](size_t workerIndex, const FileNode* node, CRefVector& stack)
+				{
+					if (!func(*node, states[workerIndex].Value))
+					{
+						return false;
+					}
+					PushChildren(*node, stack);
+					return true;
+				});
+
+				TState result = initial;
+				for (WorkerState& state: states)
+				{
+					reduce(result, std::move(state.Value));
+				}
+				return result;
+			}
 			
 			template<class TFunctor>
 			const FileNode* WalkToRoot(TFunctor&& func) const
@@ -198,13 +308,13 @@ namespace KxVFS
 			template<class TFunctor>
 			const FileNode* WalkChildren(TFunctor&& func) const
 			{
-				return DoWalkChildren(m_Children, func);
+				return DoWalkChildren(func);
 			}
 			
 			template<class TFunctor>
 			FileNode* WalkChildren(TFunctor&& func)
 			{
-				return DoWalkChildren(m_Children, func);
+				return DoWalkChildren(func);
 			}
 
 			bool HasChildren() const noexcept
@@ -215,28 +325,27 @@ namespace KxVFS
 			{
 				return m_Children.size();
 			}
-			const Map& GetChildren() const noexcept
+			const FileNodeChildren& GetChildren() const noexcept
 			{
 				return m_Children;
 			}
-			void ClearChildren() noexcept
-			{
-				m_Children.clear();
-			}
-			
-			void ReserveChildren(size_t capacity)
-			{
-				//m_Children.reserve(capacity);
-			}
+			void ClearChildren() noexcept;
 			bool RemoveChild(FileNode& node) noexcept;
 			void RemoveThisChild() noexcept
 			{
-				if (m_Parent)
+				if (FileNode* parent = GetParent())
 				{
-					m_Parent->RemoveChild(*this);
+					parent->RemoveChild(*this);
 				}
 			}
 			FileNode& AddChild(std::unique_ptr<FileNode> node);
+			void AddChildren(std::vector<std::unique_ptr<FileNode>> nodes);
+
+			// For branches which aren't in the tree yet, they're indexed once the branch itself is added
+			void AddDetachedChildren(std::vector<std::unique_ptr<FileNode>> nodes)
+			{
+				m_Children.insert(std::move(nodes));
+			}
 			FileNode& AddChild(std::unique_ptr<FileNode> node, DynamicStringRefW virtualDirectory)
 			{
 				FileNode& ref = AddChild(std::move(node));
@@ -244,17 +353,20 @@ namespace KxVFS
 				return ref;
 			}
 
+			// Doesn't block lookups or other inserts into big directories, returns the existing child if there's one
+			FileNode& AddChildIfAbsent(std::unique_ptr<FileNode> node, bool& isAdded);
+
 			bool HasParent() const noexcept
 			{
-				return m_Parent != nullptr;
+				return GetParent() != nullptr;
 			}
 			const FileNode* GetParent() const noexcept
 			{
-				return m_Parent;
+				return m_Parent.load(std::memory_order_acquire);
 			}
 			FileNode* GetParent() noexcept
 			{
-				return m_Parent;
+				return m_Parent.load(std::memory_order_acquire);
 			}
 			
 			const FileNode* GetRootNode() const noexcept
@@ -268,174 +380,221 @@ namespace KxVFS
 
 			DynamicStringRefW GetNameLC() const noexcept
 			{
-				return m_NameLC;
+				return m_NameLC.load(std::memory_order_acquire);
+			}
+			size_t GetNameHash() const noexcept
+			{
+				return m_NameHash.load(std::memory_order_relaxed);
 			}
 			DynamicStringRefW GetName() const noexcept
 			{
-				return m_Item.GetName();
+				return m_Name.load(std::memory_order_acquire);
 			}
 			bool SetName(DynamicStringRefW name)
 			{
-				if (!HasParent() || RenameThisNode(name))
+				if (HasParent())
 				{
-					m_Item.SetName(name);
-					UpdatePaths();
-					return true;
+					return RenameThisNode(name);
 				}
-				return false;
-			}
-			DynamicStringW GetFileExtension() const
-			{
-				return m_Item.GetFileExtension();
+
+				AssignName(name);
+				return true;
 			}
 
-			DynamicStringRefW GetSource() const noexcept
+			// Moves the node along with its branch under another parent, fails if the node isn't in its parent anymore
+			bool MoveTo(FileNode& newParent, DynamicStringRefW newName);
+			DynamicStringW GetFileExtension() const;
+
+			// Paths aren't stored in the node, they're constructed from the parent chain on each call.
+			// Writes the path into the caller's buffer if it's large enough (including the null terminator)
+			// and returns the path length. The buffer is left untouched otherwise.
+			size_t ConstructPath(FlagSet<PathParts> options, wchar_t* buffer, size_t bufferSize) const noexcept;
+			void ConstructPath(FlagSet<PathParts> options, DynamicStringW& buffer) const;
+
+			DynamicStringW GetSource() const
 			{
-				return m_Item.GetSource();
+				return ConstructPath(PathParts::BaseDirectory|PathParts::RelativePath);
 			}
 			DynamicStringW GetSourceWithNS() const
 			{
-				DynamicStringW path = Utility::GetLongPathPrefix();
-				path += m_Item.GetSource();
-				return path;
+				return ConstructPath(PathParts::Namespace|PathParts::BaseDirectory|PathParts::RelativePath);
 			}
 
-			DynamicStringRefW GetFullPath() const noexcept
+			DynamicStringW GetFullPath() const
 			{
-				return m_FullPath;
+				return ConstructPath(PathParts::BaseDirectory|PathParts::RelativePath|PathParts::Name);
 			}
 			DynamicStringW GetFullPathWithNS() const
 			{
-				DynamicStringW path = Utility::GetLongPathPrefix();
-				path += m_FullPath;
-				return path;
+				return ConstructPath(PathParts::Namespace|PathParts::BaseDirectory|PathParts::RelativePath|PathParts::Name);
 			}
 			
-			DynamicStringRefW GetRelativePath() const noexcept
+			DynamicStringW GetRelativePath() const
 			{
-				if (!m_VirtualDirectory.empty())
-				{
-					return m_RelativePath;
-				}
-				return {};
+				return ConstructPath(PathParts::RelativePath|PathParts::Name);
 			}
 			DynamicStringRefW GetVirtualDirectory() const noexcept
 			{
-				return m_VirtualDirectory;
+				return m_VirtualDirectory.load(std::memory_order_acquire);
 			}
 			void SetVirtualDirectory(DynamicStringRefW path)
 			{
-				m_VirtualDirectory = path;
-				UpdatePaths();
+				FileNodeArena& arena = GetArena();
+				arena.ReleaseString(m_VirtualDirectory.exchange(arena.AddString(path), std::memory_order_acq_rel));
 			}
 
-			const FileItem& GetItem() const noexcept
+			// IDs of the layers (virtual folders) which have an item at this node's path, as assigned by the tree owner
+			InternedLayerSet GetLayers() const noexcept
 			{
-				return m_Item;
+				return m_Layers;
 			}
-			const FileItem& CopyItem(const FileNode& other)
+			void SetLayers(const std::vector<uint32_t>& ids)
 			{
-				m_Item = other.m_Item;
-				return m_Item;
+				m_Layers = GetArena().AddLayerSet(ids);
 			}
-			const FileItem& TakeItem(FileNode&& other) noexcept
+
+			const FileNodeInfo& GetInfo() const noexcept
 			{
-				m_Item = std::move(other.m_Item);
-				return m_Item;
+				return m_Info;
 			}
-			const FileItem& UpdateItemInfo(bool queryShortName = false)
+			const FileNodeInfo& CopyInfo(const FileNode& other) noexcept
 			{
-				m_Item.UpdateInfo(m_FullPath, queryShortName);
-				return m_Item;
+				m_Info = other.m_Info;
+				return m_Info;
 			}
-			const FileItem& UpdateItemInfo(DynamicStringRefW fullPath, bool queryShortName = false)
+			bool UpdateItemInfo()
 			{
-				m_Item.UpdateInfo(fullPath, queryShortName);
-				return m_Item;
+				return UpdateItemInfo(GetFullPath());
 			}
+			bool UpdateItemInfo(DynamicStringRefW fullPath);
+			void AssignItemInfo(const FileItem& item);
 
 			FlagSet<FileAttributes> GetAttributes() const noexcept
 			{
-				return m_Item.GetAttributes();
+				return m_Info.GetAttributes();
 			}
 			void SetAttributes(FlagSet<FileAttributes> attributes) noexcept
 			{
-				m_Item.SetAttributes(attributes);
+				m_Info.SetAttributes(attributes);
 			}
 
 			bool IsReadOnly() const noexcept
 			{
-				return m_Item.IsReadOnly();
+				return m_Info.IsReadOnly();
 			}
 			bool IsDirectory() const noexcept
 			{
-				return m_Item.IsDirectory();
+				return m_Info.IsDirectory();
 			}
 			bool IsFile() const noexcept
 			{
-				return m_Item.IsFile();
+				return m_Info.IsFile();
 			}
 			
 			int64_t GetFileSize() const noexcept
 			{
-				return m_Item.GetFileSize();
+				return m_Info.GetFileSize();
 			}
 			void SetFileSize(int64_t fileSize) noexcept
 			{
-				m_Item.SetFileSize(fileSize);
+				m_Info.SetFileSize(fileSize);
 			}
 
 			FILETIME GetCreationTime() const noexcept
 			{
-				return m_Item.GetCreationTime();
+				return m_Info.GetCreationTime();
 			}
 			
 			template<class T>
 			void SetCreationTime(T&& value) noexcept
 			{
-				m_Item.SetCreationTime(value);
+				m_Info.SetCreationTime(value);
 			}
 
 			FILETIME GetModificationTime() const noexcept
 			{
-				return m_Item.GetModificationTime();
+				return m_Info.GetModificationTime();
 			}
 			
 			template<class T>
 			void SetModificationTime(T&& value) noexcept
 			{
-				m_Item.SetModificationTime(value);
+				m_Info.SetModificationTime(value);
 			}
 
 			FILETIME GetLastAccessTime() const noexcept
 			{
-				return m_Item.GetLastAccessTime();
+				return m_Info.GetLastAccessTime();
 			}
 			
 			template<class T>
 			void SetLastAccessTime(T&& value) noexcept
 			{
-				m_Item.SetLastAccessTime(value);
+				m_Info.SetLastAccessTime(value);
 			}
 
 		public:
+			void ToWIN32_FIND_DATA(WIN32_FIND_DATAW& findData) const noexcept
+			{
+				m_Info.ToWIN32_FIND_DATA(findData, GetName());
+			}
+			void ToBY_HANDLE_FILE_INFORMATION(BY_HANDLE_FILE_INFORMATION& byHandleInfo) const noexcept
+			{
+				m_Info.ToBY_HANDLE_FILE_INFORMATION(byHandleInfo);
+			}
 			void FromBY_HANDLE_FILE_INFORMATION(const BY_HANDLE_FILE_INFORMATION& byHandleInfo) noexcept
 			{
-				m_Item.FromBY_HANDLE_FILE_INFORMATION(byHandleInfo);
+				m_Info.FromBY_HANDLE_FILE_INFORMATION(byHandleInfo);
 			}
 			void FromFILE_BASIC_INFORMATION(const Dokany2::FILE_BASIC_INFORMATION& basicInfo) noexcept
 			{
-				m_Item.FromFILE_BASIC_INFORMATION(basicInfo);
+				m_Info.FromFILE_BASIC_INFORMATION(basicInfo);
 			}
 
 		public:
+			bool IsLockingEnabled() const noexcept
+			{
+				return GetArena().GetLockingPolicy() == LockingPolicy::Full;
+			}
 			[[nodiscard]] MoveableSharedSRWLocker LockShared() noexcept
 			{
-				return MoveableSharedSRWLocker(m_Lock);
+				if (IsLockingEnabled())
+				{
+					return MoveableSharedSRWLocker(m_Lock);
+				}
+				return {};
 			}
 			[[nodiscard]] MoveableExclusiveSRWLocker LockExclusive() noexcept
 			{
-				return MoveableExclusiveSRWLocker(m_Lock);
+				if (IsLockingEnabled())
+				{
+					return MoveableExclusiveSRWLocker(m_Lock);
+				}
+				return {};
+			}
+
+			// Doesn't wait if the node is locked by someone else, returns false then
+			[[nodiscard]] bool TryLockExclusive(MoveableExclusiveSRWLocker& locker) noexcept
+			{
+				if (IsLockingEnabled())
+				{
+					if (!m_Lock.TryAcquireExclusive())
+					{
+						return false;
+					}
+					locker = MoveableExclusiveSRWLocker(m_Lock, std::adopt_lock);
+				}
+				return true;
+			}
+
+			// For nodes locked by almost every request, like the root and top-level directories. Makes shared locking
+			// scale across cores at the cost of slower exclusive locking, see 'BasicReaderBiasedLock'.
+			void EnableReaderBias()
+			{
+				if constexpr(!Setup::DisableLocks)
+				{
+					m_Lock.EnableReaderBias();
+				}
 			}
 			
 			[[nodiscard]] BranchSharedLocker LockBranchShared();
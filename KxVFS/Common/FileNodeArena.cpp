@@ -0,0 +1,233 @@
+#include "stdafx.h"
+#include "KxVFS/Utility.h"
+#include "FileNodeArena.h"
+
+namespace KxVFS
+{
+	uint8_t* FileNodeArena::AllocateSlab(size_t size)
+	{
+		// Default 'new[]' alignment is at least 'alignof(std::max_align_t)'. Not using 'make_unique' to skip zero-initialization.
+		auto& slab = m_Slabs.emplace_back(new uint8_t[size]);
+		m_TotalSize += size;
+		return slab.get();
+	}
+	uint8_t* FileNodeArena::AllocateData(size_t size)
+	{
+		// Length prefix followed by the data, keep the prefix aligned
+		size = (size + alignof(uint32_t) - 1) & ~(alignof(uint32_t) - 1);
+		if (size > StringSlabSize / 4)
+		{
+			return AllocateSlab(size);
+		}
+
+		if (size > m_StringSlabRemaining)
+		{
+			m_StringSlabPtr = AllocateSlab(StringSlabSize);
+			m_StringSlabRemaining = StringSlabSize;
+		}
+		uint8_t* block = m_StringSlabPtr;
+		m_StringSlabPtr += size;
+		m_StringSlabRemaining -= size;
+		return block;
+	}
+
+	void FileNodeArena::DestroyString(void* block) noexcept
+	{
+		const StringHeader* header = static_cast<const StringHeader*>(block);
+		header->Arena->Deallocate(block, GetStringBlockSize(header->Length));
+	}
+
+	FileNodeArena& FileNodeArena::GetShared()
+	{
+		static FileNodeArena arena;
+		return arena;
+	}
+
+	FileNodeArena::FileNodeArena()
+	{
+		// Make sure the reclaimer outlives every arena, it may still hold nodes allocated from them
+		EpochReclaimer::Get();
+	}
+	FileNodeArena::~FileNodeArena()
+	{
+		m_IsResetting = true;
+		EpochReclaimer::Get().Synchronize();
+	}
+
+	void* FileNodeArena::AllocateBlock(size_t size)
+	{
+		// Reuse previously freed block of the same size
+		const size_t sizeClass = size / Alignment;
+		if (sizeClass < m_FreeLists.size() && m_FreeLists[sizeClass])
+		{
+			FreeBlock* block = m_FreeLists[sizeClass];
+			m_FreeLists[sizeClass] = block->Next;
+			m_UsedSize += size;
+			return block;
+		}
+
+		// Oversized blocks get their own slab
+		if (size > SlabSize / 4)
+		{
+			m_UsedSize += size;
+			return AllocateSlab(size);
+		}
+
+		if (size > m_SlabRemaining)
+		{
+			m_SlabPtr = AllocateSlab(SlabSize);
+			m_SlabRemaining = SlabSize;
+		}
+
+		void* ptr = m_SlabPtr;
+		m_SlabPtr += size;
+		m_SlabRemaining -= size;
+		m_UsedSize += size;
+		return ptr;
+	}
+	void FileNodeArena::DeallocateBlock(void* ptr, size_t size) noexcept
+	{
+		const size_t sizeClass = size / Alignment;
+		if (sizeClass >= m_FreeLists.size())
+		{
+			// Can't do much if this fails, the block just won't be reused until reset
+			try
+			{
+				m_FreeLists.resize(sizeClass + 1, nullptr);
+			}
+			catch (...)
+			{
+				return;
+			}
+		}
+
+		FreeBlock* block = new(ptr) FreeBlock();
+		block->Next = m_FreeLists[sizeClass];
+		m_FreeLists[sizeClass] = block;
+		m_UsedSize -= size;
+	}
+
+	void* FileNodeArena::Allocate(size_t size)
+	{
+		size = AlignSize(size);
+		CriticalSectionLocker lock(m_Lock);
+
+		return AllocateBlock(size);
+	}
+	void FileNodeArena::Deallocate(void* ptr, size_t size) noexcept
+	{
+		if (ptr)
+		{
+			size = AlignSize(size);
+			CriticalSectionLocker lock(m_Lock);
+
+			DeallocateBlock(ptr, size);
+		}
+	}
+	void FileNodeArena::Reset() noexcept
+	{
+		// Retired nodes are returned to the arena when they're destroyed. Their names are dropped with everything else,
+		// there's no point in releasing them one by one.
+		if (CriticalSectionLocker lock(m_Lock); true)
+		{
+			m_IsResetting = true;
+		}
+		EpochReclaimer::Get().Synchronize();
+		CriticalSectionLocker lock(m_Lock);
+
+		m_Slabs.clear();
+		m_FreeLists.clear();
+		m_SlabPtr = nullptr;
+		m_SlabRemaining = 0;
+
+		m_Strings.clear();
+		m_LayerSets.clear();
+		m_StringSlabPtr = nullptr;
+		m_StringSlabRemaining = 0;
+		m_TotalSize = 0;
+		m_UsedSize = 0;
+		m_IsResetting = false;
+	}
+
+	InternedString FileNodeArena::AddString(DynamicStringRefW value)
+	{
+		if (value.empty())
+		{
+			return {};
+		}
+		CriticalSectionLocker lock(m_Lock);
+
+		if (auto it = m_Strings.find(value); it != m_Strings.end())
+		{
+			reinterpret_cast<StringHeader*>(const_cast<wchar_t*>(it->data()))[-1].RefCount++;
+			return InternedString(it->data());
+		}
+
+		// Header with the length right before the null-terminated characters
+		StringHeader* header = new(AllocateBlock(AlignSize(GetStringBlockSize(value.length())))) StringHeader();
+		header->Arena = this;
+		header->RefCount = 1;
+		header->Length = static_cast<uint32_t>(value.length());
+
+		wchar_t* data = reinterpret_cast<wchar_t*>(header + 1);
+		Utility::CopyMemory(data, value.data(), value.length());
+		data[value.length()] = L'\0';
+
+		try
+		{
+			m_Strings.insert(DynamicStringRefW(data, value.length()));
+		}
+		catch (...)
+		{
+			DeallocateBlock(header, AlignSize(GetStringBlockSize(value.length())));
+			throw;
+		}
+		return InternedString(data);
+	}
+	void FileNodeArena::ReleaseString(InternedString value) noexcept
+	{
+		if (value.m_Data)
+		{
+			StringHeader* header = reinterpret_cast<StringHeader*>(const_cast<wchar_t*>(value.m_Data)) - 1;
+			if (CriticalSectionLocker lock(m_Lock); true)
+			{
+				if (m_IsResetting || --header->RefCount != 0)
+				{
+					return;
+				}
+
+				// New nodes can't find it anymore, but concurrent readers may still hold the pointer
+				m_Strings.erase(value.get_view());
+			}
+
+			try
+			{
+				EpochReclaimer::Get().Retire(header, DestroyString);
+			}
+			catch (...)
+			{
+				// Leaked until the arena is reset
+			}
+		}
+	}
+	InternedLayerSet FileNodeArena::AddLayerSet(const std::vector<uint32_t>& ids)
+	{
+		if (ids.empty())
+		{
+			return {};
+		}
+		CriticalSectionLocker lock(m_Lock);
+
+		if (auto it = m_LayerSets.find(ids); it != m_LayerSets.end())
+		{
+			return InternedLayerSet(it->second);
+		}
+
+		uint32_t* block = reinterpret_cast<uint32_t*>(AllocateData((ids.size() + 1) * sizeof(uint32_t)));
+		*block = static_cast<uint32_t>(ids.size());
+		Utility::CopyMemory(block + 1, ids.data(), ids.size());
+
+		m_LayerSets.emplace(ids, block + 1);
+		return InternedLayerSet(block + 1);
+	}
+}
@@ -0,0 +1,235 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Utility.h"
+#include "LockingPolicy.h"
+#include <cstddef>
+
+namespace KxVFS
+{
+	// Null-terminated string interned in a 'FileNodeArena', length is stored right before the first character.
+	// Only a single pointer is stored, so it can be replaced without tearing while other threads read it.
+	// It doesn't own the string, the owner releases it back to the arena (see 'FileNodeArena::ReleaseString').
+	class InternedString final
+	{
+		friend class FileNodeArena;
+
+		private:
+			const wchar_t* m_Data = nullptr;
+
+		private:
+			explicit InternedString(const wchar_t* data) noexcept
+				:m_Data(data)
+			{
+			}
+
+		public:
+			InternedString() noexcept = default;
+
+		public:
+			bool empty() const noexcept
+			{
+				return m_Data == nullptr || *m_Data == L'\0';
+			}
+			size_t length() const noexcept
+			{
+				return m_Data ? reinterpret_cast<const uint32_t*>(m_Data)[-1] : 0;
+			}
+			const wchar_t* data() const noexcept
+			{
+				return m_Data ? m_Data : L"";
+			}
+			DynamicStringRefW get_view() const noexcept
+			{
+				return DynamicStringRefW(data(), length());
+			}
+
+		public:
+			operator DynamicStringRefW() const noexcept
+			{
+				return get_view();
+			}
+	};
+
+	// Sorted set of layer IDs interned in a 'FileNodeArena', stored the same way as 'InternedString'
+	class InternedLayerSet final
+	{
+		friend class FileNodeArena;
+
+		private:
+			const uint32_t* m_Data = nullptr;
+
+		private:
+			explicit InternedLayerSet(const uint32_t* data) noexcept
+				:m_Data(data)
+			{
+			}
+
+		public:
+			InternedLayerSet() noexcept = default;
+
+		public:
+			bool empty() const noexcept
+			{
+				return size() == 0;
+			}
+			size_t size() const noexcept
+			{
+				return m_Data ? m_Data[-1] : 0;
+			}
+			const uint32_t* begin() const noexcept
+			{
+				return m_Data;
+			}
+			const uint32_t* end() const noexcept
+			{
+				return m_Data + size();
+			}
+			bool contains(uint32_t id) const noexcept
+			{
+				return std::binary_search(begin(), end(), id);
+			}
+	};
+}
+
+namespace KxVFS
+{
+	class FileNodePathIndex;
+}
+
+namespace KxVFS
+{
+	// Slab allocator for file tree nodes. Memory is carved from large slabs with a bump pointer,
+	// freed blocks go to a per-size free list and are reused by the next allocation of the same size.
+	// All slabs are released at once by 'Reset' which must only be called when no blocks are in use,
+	// except for nodes retired to 'EpochReclaimer' which are destroyed before that.
+	// Also serves as a pool of interned node names and layer sets. Names are reference counted and freed once no node uses them,
+	// so renamed and deleted items don't accumulate. Layer sets are few and live until the arena is reset.
+	class FileNodeArena final
+	{
+		private:
+			struct FreeBlock
+			{
+				FreeBlock* Next = nullptr;
+			};
+			struct StringHeader
+			{
+				FileNodeArena* Arena = nullptr;
+				uint32_t RefCount = 0;
+				uint32_t Length = 0;
+			};
+			static_assert(sizeof(StringHeader) == offsetof(StringHeader, Length) + sizeof(uint32_t), "length must be right before the data");
+			struct LayerSetHash
+			{
+				size_t operator()(const std::vector<uint32_t>& value) const noexcept
+				{
+					size_t hash = value.size();
+					for (uint32_t id: value)
+					{
+						hash = hash * 31 + id;
+					}
+					return hash;
+				}
+			};
+
+		public:
+			static constexpr size_t Alignment = alignof(std::max_align_t);
+			static constexpr size_t SlabSize = 1024 * 1024;
+			static constexpr size_t StringSlabSize = 256 * 1024;
+
+		public:
+			// Arena for nodes created without one, it's never reset
+			static FileNodeArena& GetShared();
+
+		private:
+			std::vector<std::unique_ptr<uint8_t[]>> m_Slabs;
+			std::vector<FreeBlock*> m_FreeLists;
+			uint8_t* m_SlabPtr = nullptr;
+			size_t m_SlabRemaining = 0;
+
+			std::unordered_set<DynamicStringRefW> m_Strings;
+			std::unordered_map<std::vector<uint32_t>, const uint32_t*, LayerSetHash> m_LayerSets;
+			uint8_t* m_StringSlabPtr = nullptr;
+			size_t m_StringSlabRemaining = 0;
+
+			size_t m_TotalSize = 0;
+			size_t m_UsedSize = 0;
+			CriticalSection m_Lock;
+			FileNodePathIndex* m_PathIndex = nullptr;
+			LockingPolicy m_LockingPolicy = LockingPolicy::Full;
+			bool m_IsResetting = false;
+
+		private:
+			static size_t AlignSize(size_t size) noexcept
+			{
+				return (size + Alignment - 1) & ~(Alignment - 1);
+			}
+			static size_t GetStringBlockSize(size_t length) noexcept
+			{
+				return sizeof(StringHeader) + (length + 1) * sizeof(wchar_t);
+			}
+			static void DestroyString(void* block) noexcept;
+
+			uint8_t* AllocateSlab(size_t size);
+			uint8_t* AllocateData(size_t size);
+			void* AllocateBlock(size_t size);
+			void DeallocateBlock(void* ptr, size_t size) noexcept;
+
+		public:
+			FileNodeArena();
+			FileNodeArena(const FileNodeArena&) = delete;
+			~FileNodeArena();
+
+		public:
+			void* Allocate(size_t size);
+			void Deallocate(void* ptr, size_t size) noexcept;
+			void Reset() noexcept;
+
+			// Returned string holds a reference which must be given back to 'ReleaseString' of the same arena.
+			// Released string is freed through 'EpochReclaimer', so readers inside 'EpochGuard' can still use it.
+			InternedString AddString(DynamicStringRefW value);
+			void ReleaseString(InternedString value) noexcept;
+			size_t GetStringCount() const noexcept
+			{
+				return m_Strings.size();
+			}
+
+			// IDs must be sorted and unique
+			InternedLayerSet AddLayerSet(const std::vector<uint32_t>& ids);
+
+			// Path index of the tree allocated from this arena, if any. It's kept when the arena is reset.
+			FileNodePathIndex* GetPathIndex() const noexcept
+			{
+				return m_PathIndex;
+			}
+			void SetPathIndex(FileNodePathIndex* index) noexcept
+			{
+				m_PathIndex = index;
+			}
+
+			// Nodes from this arena are only locked with the full policy. Must not be changed while any node is locked.
+			LockingPolicy GetLockingPolicy() const noexcept
+			{
+				return m_LockingPolicy;
+			}
+			void SetLockingPolicy(LockingPolicy policy) noexcept
+			{
+				m_LockingPolicy = policy;
+			}
+
+			size_t GetSlabCount() const noexcept
+			{
+				return m_Slabs.size();
+			}
+			size_t GetTotalSize() const noexcept
+			{
+				return m_TotalSize;
+			}
+			size_t GetUsedSize() const noexcept
+			{
+				return m_UsedSize;
+			}
+
+		public:
+			FileNodeArena& operator=(const FileNodeArena&) = delete;
+	};
+}
@@ -0,0 +1,478 @@
+#include "stdafx.h"
+#include "KxVFS/Utility.h"
+#include "FileNodeChildren.h"
+#include "FileNode.h"
+
+namespace
+{
+	// Writers are serialized per container only in sorted mode and when the table is replaced,
+	// so a small set of locks shared between all containers is enough.
+	constexpr size_t WriterLockCount = 64;
+
+	void DeleteNode(void* node) noexcept
+	{
+		delete static_cast<KxVFS::FileNode*>(node);
+	}
+}
+
+namespace KxVFS
+{
+	FileNode* FileNodeChildren::Storage::Find(DynamicStringRefW nameLC, size_t hash) const noexcept
+	{
+		if (IsTable())
+		{
+			for (size_t slot = hash & Mask, probes = 0; probes <= Mask; slot = (slot + 1) & Mask, probes++)
+			{
+				FileNode* node = Slots[slot].load(std::memory_order_acquire);
+				if (node == nullptr)
+				{
+					break;
+				}
+				if (IsLive(node) && node->GetNameHash() == hash && node->GetNameLC() == nameLC)
+				{
+					return node;
+				}
+			}
+			return nullptr;
+		}
+
+		const size_t position = FindPosition(nameLC, hash);
+		return position != npos ? Items[position].Node : nullptr;
+	}
+	FileNodeChildren::TItems::const_iterator FileNodeChildren::Storage::LowerBound(DynamicStringRefW nameLC) const noexcept
+	{
+		return std::lower_bound(Items.begin(), Items.end(), nameLC, [](const Item& item, DynamicStringRefW name)
+		{
+			return item.Node->GetNameLC() < name;
+		});
+	}
+	size_t FileNodeChildren::Storage::FindPosition(DynamicStringRefW nameLC, size_t hash) const noexcept
+	{
+		// Hash is compared first, it rules out the other name in most cases without touching the node
+		if (auto it = LowerBound(nameLC); it != Items.end() && it->Hash == hash && it->Node->GetNameLC() == nameLC)
+		{
+			return static_cast<size_t>(it - Items.begin());
+		}
+		return npos;
+	}
+	FileNode* FileNodeChildren::Storage::InsertSorted(FileNode& node)
+	{
+		const size_t hash = node.GetNameHash();
+		const DynamicStringRefW nameLC = node.GetNameLC();
+
+		const size_t position = static_cast<size_t>(LowerBound(nameLC) - Items.begin());
+		if (position != Items.size() && Items[position].Hash == hash && Items[position].Node->GetNameLC() == nameLC)
+		{
+			return std::exchange(Items[position].Node, &node);
+		}
+
+		Items.insert(Items.begin() + position, Item{hash, &node});
+		return nullptr;
+	}
+	void FileNodeChildren::Storage::RemoveAt(size_t position)
+	{
+		Items.erase(Items.begin() + position);
+	}
+
+	void FileNodeChildren::Storage::MakeTable(size_t capacity)
+	{
+		// Leave room to double the size before the table has to be replaced
+		size_t slotCount = SortedModeLimit * 4;
+		while (slotCount < capacity * 4)
+		{
+			slotCount *= 2;
+		}
+
+		Slots = std::make_unique<std::atomic<FileNode*>[]>(slotCount);
+		Mask = slotCount - 1;
+		for (size_t i = 0; i < slotCount; i++)
+		{
+			Slots[i].store(nullptr, std::memory_order_relaxed);
+		}
+	}
+	FileNodeChildren::InsertResult FileNodeChildren::Storage::InsertTable(FileNode& node, bool replace, FileNode*& otherNode) noexcept
+	{
+		// Every thread probes the same sequence of slots for the same name, so if two threads insert the same name
+		// concurrently, the one which loses the race for a free slot sees the winner's node in that slot.
+		const size_t hash = node.GetNameHash();
+		const DynamicStringRefW nameLC = node.GetNameLC();
+
+		for (size_t slot = hash & Mask, probes = 0; probes <= Mask; slot = (slot + 1) & Mask, probes++)
+		{
+			FileNode* current = Slots[slot].load(std::memory_order_acquire);
+			while (true)
+			{
+				if (current == nullptr)
+				{
+					// End of the probe sequence, the name isn't in the table
+					if (Used.fetch_add(1, std::memory_order_relaxed) >= GetUsedLimit())
+					{
+						Used.fetch_sub(1, std::memory_order_relaxed);
+						return InsertResult::Full;
+					}
+					if (Slots[slot].compare_exchange_strong(current, &node, std::memory_order_acq_rel, std::memory_order_acquire))
+					{
+						Count.fetch_add(1, std::memory_order_relaxed);
+						return InsertResult::Inserted;
+					}
+					Used.fetch_sub(1, std::memory_order_relaxed);
+					continue;
+				}
+
+				if (IsLive(current) && current->GetNameHash() == hash && current->GetNameLC() == nameLC)
+				{
+					otherNode = current;
+					if (!replace)
+					{
+						return InsertResult::Existing;
+					}
+					if (Slots[slot].compare_exchange_strong(current, &node, std::memory_order_acq_rel, std::memory_order_acquire))
+					{
+						return InsertResult::Replaced;
+					}
+					otherNode = nullptr;
+					continue;
+				}
+				break;
+			}
+		}
+		return InsertResult::Full;
+	}
+	bool FileNodeChildren::Storage::RemoveTable(const FileNode& node) noexcept
+	{
+		const size_t hash = node.GetNameHash();
+		for (size_t slot = hash & Mask, probes = 0; probes <= Mask; slot = (slot + 1) & Mask, probes++)
+		{
+			FileNode* current = Slots[slot].load(std::memory_order_acquire);
+			if (current == nullptr)
+			{
+				break;
+			}
+			if (current == &node)
+			{
+				// Fails if the node was replaced meanwhile
+				if (Slots[slot].compare_exchange_strong(current, GetTombstone(), std::memory_order_acq_rel))
+				{
+					Count.fetch_sub(1, std::memory_order_relaxed);
+					return true;
+				}
+				break;
+			}
+		}
+		return false;
+	}
+	FileNodeChildren::TItems FileNodeChildren::Storage::GetItems() const
+	{
+		if (!IsTable())
+		{
+			return Items;
+		}
+
+		TItems items;
+		items.reserve(GetCount());
+		ForEach([&items](FileNode& node)
+		{
+			items.push_back(Item{node.GetNameHash(), &node});
+			return true;
+		});
+		return items;
+	}
+}
+
+namespace KxVFS
+{
+	SRWLock& FileNodeChildren::GetWriterLock() const noexcept
+	{
+		static std::array<SRWLock, WriterLockCount> ms_Locks;
+		return ms_Locks[(reinterpret_cast<uintptr_t>(this) / sizeof(void*)) % ms_Locks.size()];
+	}
+	void FileNodeChildren::Publish(std::unique_ptr<Storage> storage)
+	{
+		// Empty version is represented by null so empty directories don't keep any memory
+		Storage* newStorage = storage && storage->GetCount() != 0 ? storage.release() : nullptr;
+		if (Storage* oldStorage = m_Storage.exchange(newStorage, std::memory_order_acq_rel))
+		{
+			EpochReclaimer::Get().Retire(oldStorage);
+		}
+	}
+	std::unique_ptr<FileNodeChildren::Storage> FileNodeChildren::Rebuild(TItems items) const
+	{
+		// Items must have unique names, the storage has room for at least as many more
+		auto storage = std::make_unique<Storage>();
+		if (items.size() > SortedModeLimit)
+		{
+			storage->MakeTable(items.size());
+			for (const Item& item: items)
+			{
+				FileNode* otherNode = nullptr;
+				storage->InsertTable(*item.Node, true, otherNode);
+			}
+		}
+		else
+		{
+			std::sort(items.begin(), items.end(), [](const Item& left, const Item& right)
+			{
+				return left.Node->GetNameLC() < right.Node->GetNameLC();
+			});
+			storage->Items = std::move(items);
+		}
+		return storage;
+	}
+
+	FileNode* FileNodeChildren::DoInsert(FileNode& node, bool replace)
+	{
+		// Concurrent insert if the table has a free slot
+		FileNode* otherNode = nullptr;
+		if (SharedSRWLocker lock(GetWriterLock()); true)
+		{
+			if (Storage* storage = GetStorage(); storage && storage->IsTable())
+			{
+				if (storage->InsertTable(node, replace, otherNode) != InsertResult::Full)
+				{
+					return otherNode;
+				}
+			}
+		}
+
+		ExclusiveSRWLocker lock(GetWriterLock());
+		Storage* storage = GetStorage();
+		if (storage && storage->IsTable())
+		{
+			// Another thread could have replaced the table already
+			if (storage->InsertTable(node, replace, otherNode) != InsertResult::Full)
+			{
+				return otherNode;
+			}
+
+			// Full table doesn't have this name, rebuild it without tombstones
+			TItems items = storage->GetItems();
+			items.push_back(Item{node.GetNameHash(), &node});
+			Publish(Rebuild(std::move(items)));
+			return nullptr;
+		}
+
+		if (storage && !replace)
+		{
+			if (FileNode* existingNode = storage->Find(node.GetNameLC(), node.GetNameHash()))
+			{
+				return existingNode;
+			}
+		}
+
+		auto newStorage = std::make_unique<Storage>();
+		if (storage)
+		{
+			newStorage->Items = storage->Items;
+		}
+		otherNode = newStorage->InsertSorted(node);
+
+		if (newStorage->Items.size() > SortedModeLimit)
+		{
+			newStorage = Rebuild(std::move(newStorage->Items));
+		}
+		Publish(std::move(newStorage));
+		return otherNode;
+	}
+	void FileNodeChildren::ShrinkIfNeeded()
+	{
+		ExclusiveSRWLocker lock(GetWriterLock());
+		if (const Storage* storage = GetStorage(); storage && storage->IsTable() && storage->GetCount() < SortedModeLimit / 2)
+		{
+			Publish(Rebuild(storage->GetItems()));
+		}
+	}
+
+	FileNodeChildren::FileNodeChildren() noexcept = default;
+	FileNodeChildren::~FileNodeChildren()
+	{
+		// Nobody can see the owning node anymore, so there are no readers to wait for
+		if (Storage* storage = m_Storage.exchange(nullptr))
+		{
+			storage->ForEach([](FileNode& node)
+			{
+				delete &node;
+				return true;
+			});
+			delete storage;
+		}
+	}
+
+	FileNode* FileNodeChildren::find(DynamicStringRefW nameLC, size_t hash) const noexcept
+	{
+		EpochGuard guard;
+		if (const Storage* storage = GetStorage())
+		{
+			return storage->Find(nameLC, hash);
+		}
+		return nullptr;
+	}
+	FileNode* FileNodeChildren::find(DynamicStringRefW nameLC) const noexcept
+	{
+		return find(nameLC, FileNode::HashFileName(nameLC));
+	}
+
+	FileNode& FileNodeChildren::insert(std::unique_ptr<FileNode> node)
+	{
+		FileNode& ref = *node;
+		FileNode* replacedNode = DoInsert(*node, true);
+		node.release();
+
+		if (replacedNode)
+		{
+			EpochReclaimer::Get().Retire(replacedNode, DeleteNode);
+		}
+		return ref;
+	}
+	void FileNodeChildren::insert(std::vector<std::unique_ptr<FileNode>> nodes)
+	{
+		if (nodes.empty())
+		{
+			return;
+		}
+
+		FileNode::RefVector replacedNodes;
+		if (ExclusiveSRWLocker lock(GetWriterLock()); true)
+		{
+			// Batches are mostly added while the tree is built, so a new version is made unless they fit into the current table
+			Storage* storage = GetStorage();
+			std::unique_ptr<Storage> newStorage;
+			if (!storage || !storage->IsTable() || storage->Used.load(std::memory_order_relaxed) + nodes.size() > storage->GetUsedLimit())
+			{
+				TItems items = storage ? storage->GetItems() : TItems();
+				const size_t count = items.size();
+				items.reserve(count + nodes.size());
+
+				if (count + nodes.size() > SortedModeLimit)
+				{
+					newStorage = std::make_unique<Storage>();
+					newStorage->MakeTable(count + nodes.size());
+					for (const Item& item: items)
+					{
+						FileNode* otherNode = nullptr;
+						newStorage->InsertTable(*item.Node, true, otherNode);
+					}
+				}
+				else
+				{
+					newStorage = Rebuild(std::move(items));
+				}
+				storage = newStorage.get();
+			}
+
+			for (auto& node: nodes)
+			{
+				FileNode* replacedNode = nullptr;
+				if (storage->IsTable())
+				{
+					storage->InsertTable(*node, true, replacedNode);
+				}
+				else
+				{
+					replacedNode = storage->InsertSorted(*node);
+				}
+
+				if (replacedNode)
+				{
+					replacedNodes.push_back(replacedNode);
+				}
+			}
+
+			if (newStorage)
+			{
+				Publish(std::move(newStorage));
+			}
+
+			// Nodes are owned by the container from now on
+			for (auto& node: nodes)
+			{
+				node.release();
+			}
+		}
+
+		for (FileNode* node: replacedNodes)
+		{
+			EpochReclaimer::Get().Retire(node, DeleteNode);
+		}
+	}
+	FileNode& FileNodeChildren::insert_if_absent(std::unique_ptr<FileNode> node, bool& isInserted)
+	{
+		// New node was never visible to anyone, so it's destroyed right away if it's not inserted
+		if (FileNode* existingNode = DoInsert(*node, false))
+		{
+			isInserted = false;
+			return *existingNode;
+		}
+
+		isInserted = true;
+		return *node.release();
+	}
+
+	std::unique_ptr<FileNode> FileNodeChildren::extract(const FileNode& node) noexcept
+	{
+		bool isRemoved = false;
+		if (SharedSRWLocker lock(GetWriterLock()); true)
+		{
+			if (Storage* storage = GetStorage(); storage && storage->IsTable())
+			{
+				isRemoved = storage->RemoveTable(node);
+			}
+		}
+
+		if (!isRemoved)
+		{
+			ExclusiveSRWLocker lock(GetWriterLock());
+			if (Storage* storage = GetStorage(); storage && storage->IsTable())
+			{
+				isRemoved = storage->RemoveTable(node);
+			}
+			else if (storage)
+			{
+				const size_t position = storage->FindPosition(node.GetNameLC(), node.GetNameHash());
+				if (position != npos && storage->Items[position].Node == &node)
+				{
+					auto newStorage = std::make_unique<Storage>();
+					newStorage->Items = storage->Items;
+					newStorage->RemoveAt(position);
+					Publish(std::move(newStorage));
+
+					return std::unique_ptr<FileNode>(const_cast<FileNode*>(&node));
+				}
+			}
+		}
+
+		if (isRemoved)
+		{
+			ShrinkIfNeeded();
+			return std::unique_ptr<FileNode>(const_cast<FileNode*>(&node));
+		}
+		return nullptr;
+	}
+	bool FileNodeChildren::erase(const FileNode& node) noexcept
+	{
+		// Readers may still be looking at the node, so it's destroyed after they're done
+		if (std::unique_ptr<FileNode> extractedNode = extract(node))
+		{
+			EpochReclaimer::Get().Retire(extractedNode.release(), DeleteNode);
+			return true;
+		}
+		return false;
+	}
+	void FileNodeChildren::clear() noexcept
+	{
+		Storage* oldStorage = nullptr;
+		if (ExclusiveSRWLocker lock(GetWriterLock()); true)
+		{
+			oldStorage = m_Storage.exchange(nullptr, std::memory_order_acq_rel);
+		}
+
+		if (oldStorage)
+		{
+			oldStorage->ForEach([](FileNode& node)
+			{
+				EpochReclaimer::Get().Retire(&node, DeleteNode);
+				return true;
+			});
+			EpochReclaimer::Get().Retire(oldStorage);
+		}
+	}
+}
@@ -0,0 +1,182 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Utility.h"
+#include <atomic>
+
+namespace KxVFS
+{
+	class FileNode;
+}
+
+namespace KxVFS
+{
+	// Child container for 'FileNode'. Small directories are kept as a vector sorted by lower-cased name
+	// and binary searched by it. The vector is copy-on-write: a change is made on a copy
+	// which then replaces the current version.
+	// Big directories switch to an open-addressing (linear probing) table of node pointers which is changed in place,
+	// single inserts and removals only take a shared lock and run concurrently with each other. The table is only
+	// replaced when it runs out of free slots, in this mode children are enumerated in no particular order.
+	// Readers don't lock anything, replaced versions and removed nodes are retired to 'EpochReclaimer'.
+	// Readers must be inside an 'EpochGuard' for as long as they use nodes they got from here.
+	class FileNodeChildren final
+	{
+		public:
+			struct Item
+			{
+				size_t Hash = 0;
+				FileNode* Node = nullptr;
+			};
+			using TItems = std::vector<Item>;
+
+		private:
+			static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+			// Switch to table mode above this size and back to sorted mode below half of it
+			static constexpr size_t SortedModeLimit = 32;
+
+			// Removed node in table mode, probing continues past it
+			static constexpr uintptr_t TombstoneValue = 1;
+
+			enum class InsertResult
+			{
+				Inserted,
+				Replaced,
+				Existing,
+				Full
+			};
+
+			// Sorted items are never changed after they're published, table slots go from null to a node
+			// and from a node to either a node with the same name or a tombstone.
+			struct Storage
+			{
+				TItems Items;
+				std::unique_ptr<std::atomic<FileNode*>[]> Slots;
+				size_t Mask = 0;
+				std::atomic<size_t> Count = 0;
+				std::atomic<size_t> Used = 0;
+
+				static bool IsLive(const FileNode* node) noexcept
+				{
+					return reinterpret_cast<uintptr_t>(node) > TombstoneValue;
+				}
+				static FileNode* GetTombstone() noexcept
+				{
+					return reinterpret_cast<FileNode*>(TombstoneValue);
+				}
+
+				bool IsTable() const noexcept
+				{
+					return Slots != nullptr;
+				}
+				size_t GetCount() const noexcept
+				{
+					return IsTable() ? Count.load(std::memory_order_relaxed) : Items.size();
+				}
+				size_t GetUsedLimit() const noexcept
+				{
+					// Keep load factor, tombstones included, at or below 0.5
+					return (Mask + 1) / 2;
+				}
+
+				FileNode* Find(DynamicStringRefW nameLC, size_t hash) const noexcept;
+				TItems::const_iterator LowerBound(DynamicStringRefW nameLC) const noexcept;
+				size_t FindPosition(DynamicStringRefW nameLC, size_t hash) const noexcept;
+				FileNode* InsertSorted(FileNode& node);
+				void RemoveAt(size_t position);
+
+				void MakeTable(size_t capacity);
+				InsertResult InsertTable(FileNode& node, bool replace, FileNode*& otherNode) noexcept;
+				bool RemoveTable(const FileNode& node) noexcept;
+				TItems GetItems() const;
+
+				template<class TFunc>
+				FileNode* ForEach(TFunc&& func) const
+				{
+					if (IsTable())
+					{
+						for (size_t i = 0; i <= Mask; i++)
+						{
+							FileNode* node = Slots[i].load(std::memory_order_acquire);
+							if (IsLive(node) && !func(*node))
+							{
+								return node;
+							}
+						}
+					}
+					else
+					{
+						for (const Item& item: Items)
+						{
+							if (!func(*item.Node))
+							{
+								return item.Node;
+							}
+						}
+					}
+					return nullptr;
+				}
+			};
+
+		private:
+			std::atomic<Storage*> m_Storage = nullptr;
+
+		private:
+			const Storage* GetStorage() const noexcept
+			{
+				return m_Storage.load(std::memory_order_acquire);
+			}
+			Storage* GetStorage() noexcept
+			{
+				return m_Storage.load(std::memory_order_acquire);
+			}
+			SRWLock& GetWriterLock() const noexcept;
+			void Publish(std::unique_ptr<Storage> storage);
+			std::unique_ptr<Storage> Rebuild(TItems items) const;
+
+			FileNode* DoInsert(FileNode& node, bool replace);
+			void ShrinkIfNeeded();
+
+		public:
+			FileNodeChildren() noexcept;
+			FileNodeChildren(const FileNodeChildren&) = delete;
+			~FileNodeChildren();
+
+		public:
+			bool empty() const noexcept
+			{
+				return size() == 0;
+			}
+			size_t size() const noexcept
+			{
+				const Storage* storage = GetStorage();
+				return storage ? storage->GetCount() : 0;
+			}
+
+			// Calls 'func(node)' for every child until it returns false and returns that node.
+			// Must be called inside an 'EpochGuard', children added or removed meanwhile may or may not be visited.
+			template<class TFunc>
+			FileNode* for_each(TFunc&& func) const
+			{
+				const Storage* storage = GetStorage();
+				return storage ? storage->ForEach(func) : nullptr;
+			}
+
+			// Name must be lower-cased, hash must be computed with 'FileNode::HashFileName'
+			FileNode* find(DynamicStringRefW nameLC, size_t hash) const noexcept;
+			FileNode* find(DynamicStringRefW nameLC) const noexcept;
+
+			// Replaces existing child with the same name, if any
+			FileNode& insert(std::unique_ptr<FileNode> node);
+			void insert(std::vector<std::unique_ptr<FileNode>> nodes);
+
+			// Returns existing child with the same name if there's one and destroys 'node'
+			FileNode& insert_if_absent(std::unique_ptr<FileNode> node, bool& isInserted);
+
+			std::unique_ptr<FileNode> extract(const FileNode& node) noexcept;
+			bool erase(const FileNode& node) noexcept;
+			void clear() noexcept;
+
+		public:
+			FileNodeChildren& operator=(const FileNodeChildren&) = delete;
+	};
+}
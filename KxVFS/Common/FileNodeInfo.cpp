@@ -0,0 +1,63 @@
+#include "stdafx.h"
+#include "KxVFS/Utility.h"
+#include "FileNodeInfo.h"
+
+namespace KxVFS
+{
+	void FileNodeInfo::FromFileItem(const FileItem& item) noexcept
+	{
+		m_Attributes = item.GetAttributes();
+		m_CreationTime = item.GetCreationTime();
+		m_LastAccessTime = item.GetLastAccessTime();
+		m_ModificationTime = item.GetModificationTime();
+		m_FileSize = item.IsFile() ? item.GetFileSize() : 0;
+	}
+	void FileNodeInfo::ToWIN32_FIND_DATA(WIN32_FIND_DATAW& findData, DynamicStringRefW name) const noexcept
+	{
+		findData.dwFileAttributes = m_Attributes.ToInt();
+		findData.ftCreationTime = m_CreationTime;
+		findData.ftLastAccessTime = m_LastAccessTime;
+		findData.ftLastWriteTime = m_ModificationTime;
+		Utility::Int64ToLowHigh(m_FileSize, findData.nFileSizeLow, findData.nFileSizeHigh);
+		findData.dwReserved0 = 0;
+		findData.dwReserved1 = 0;
+
+		const size_t length = std::min(std::size(findData.cFileName) - 1, name.length());
+		Utility::CopyMemory(findData.cFileName, name.data(), length);
+		findData.cFileName[length] = L'\0';
+		findData.cAlternateFileName[0] = L'\0';
+	}
+
+	void FileNodeInfo::ToBY_HANDLE_FILE_INFORMATION(BY_HANDLE_FILE_INFORMATION& fileInfo) const noexcept
+	{
+		fileInfo.dwFileAttributes = m_Attributes.ToInt();
+		fileInfo.ftCreationTime = m_CreationTime;
+		fileInfo.ftLastAccessTime = m_LastAccessTime;
+		fileInfo.ftLastWriteTime = m_ModificationTime;
+
+		if (IsFile())
+		{
+			Utility::Int64ToLowHigh(m_FileSize, fileInfo.nFileSizeLow, fileInfo.nFileSizeHigh);
+		}
+		else
+		{
+			fileInfo.nFileSizeLow = 0;
+			fileInfo.nFileSizeHigh = 0;
+		}
+	}
+	void FileNodeInfo::FromBY_HANDLE_FILE_INFORMATION(const BY_HANDLE_FILE_INFORMATION& fileInfo) noexcept
+	{
+		m_Attributes = FromInt<FileAttributes>(fileInfo.dwFileAttributes);
+		m_CreationTime = fileInfo.ftCreationTime;
+		m_LastAccessTime = fileInfo.ftLastAccessTime;
+		m_ModificationTime = fileInfo.ftLastWriteTime;
+		m_FileSize = IsFile() ? Utility::LowHighToInt64(fileInfo.nFileSizeLow, fileInfo.nFileSizeHigh) : 0;
+	}
+	void FileNodeInfo::FromFILE_BASIC_INFORMATION(const Dokany2::FILE_BASIC_INFORMATION& basicInfo) noexcept
+	{
+		m_Attributes = FromInt<FileAttributes>(basicInfo.FileAttributes);
+		m_CreationTime = FileTimeFromLARGE_INTEGER(basicInfo.CreationTime);
+		m_LastAccessTime = FileTimeFromLARGE_INTEGER(basicInfo.LastAccessTime);
+		m_ModificationTime = FileTimeFromLARGE_INTEGER(basicInfo.LastWriteTime);
+	}
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Misc/IncludeDokan.h"
+#include "KxVFS/Utility.h"
+
+namespace KxVFS
+{
+	// Packed file metadata stored in every 'FileNode' instead of a full 'FileItem'
+	class FileNodeInfo final
+	{
+		private:
+			static FILETIME FileTimeFromLARGE_INTEGER(const LARGE_INTEGER& value) noexcept
+			{
+				return *reinterpret_cast<const FILETIME*>(&value);
+			}
+
+		private:
+			int64_t m_FileSize = 0;
+			FILETIME m_CreationTime = {};
+			FILETIME m_LastAccessTime = {};
+			FILETIME m_ModificationTime = {};
+			FlagSet<FileAttributes> m_Attributes = FileAttributes::Invalid;
+
+		public:
+			FileNodeInfo() noexcept = default;
+			FileNodeInfo(const FileItem& item) noexcept
+			{
+				FromFileItem(item);
+			}
+
+		public:
+			bool IsOK() const noexcept
+			{
+				return m_Attributes != FileAttributes::Invalid;
+			}
+			void MakeNull() noexcept
+			{
+				*this = {};
+			}
+
+			FlagSet<FileAttributes> GetAttributes() const noexcept
+			{
+				return m_Attributes;
+			}
+			void SetAttributes(FlagSet<FileAttributes> attributes) noexcept
+			{
+				m_Attributes = attributes;
+			}
+
+			bool IsReadOnly() const noexcept
+			{
+				return m_Attributes & FileAttributes::ReadOnly;
+			}
+			bool IsDirectory() const noexcept
+			{
+				return m_Attributes & FileAttributes::Directory;
+			}
+			bool IsFile() const noexcept
+			{
+				return !IsDirectory();
+			}
+
+			int64_t GetFileSize() const noexcept
+			{
+				return m_FileSize;
+			}
+			void SetFileSize(int64_t size) noexcept
+			{
+				if (IsFile())
+				{
+					m_FileSize = size;
+				}
+			}
+
+			FILETIME GetCreationTime() const noexcept
+			{
+				return m_CreationTime;
+			}
+			void SetCreationTime(const FILETIME& value) noexcept
+			{
+				m_CreationTime = value;
+			}
+			void SetCreationTime(const LARGE_INTEGER& value) noexcept
+			{
+				m_CreationTime = FileTimeFromLARGE_INTEGER(value);
+			}
+
+			FILETIME GetLastAccessTime() const noexcept
+			{
+				return m_LastAccessTime;
+			}
+			void SetLastAccessTime(const FILETIME& value) noexcept
+			{
+				m_LastAccessTime = value;
+			}
+			void SetLastAccessTime(const LARGE_INTEGER& value) noexcept
+			{
+				m_LastAccessTime = FileTimeFromLARGE_INTEGER(value);
+			}
+
+			FILETIME GetModificationTime() const noexcept
+			{
+				return m_ModificationTime;
+			}
+			void SetModificationTime(const FILETIME& value) noexcept
+			{
+				m_ModificationTime = value;
+			}
+			void SetModificationTime(const LARGE_INTEGER& value) noexcept
+			{
+				m_ModificationTime = FileTimeFromLARGE_INTEGER(value);
+			}
+
+		public:
+			void FromFileItem(const FileItem& item) noexcept;
+			void ToWIN32_FIND_DATA(WIN32_FIND_DATAW& findData, DynamicStringRefW name) const noexcept;
+
+			void ToBY_HANDLE_FILE_INFORMATION(BY_HANDLE_FILE_INFORMATION& fileInfo) const noexcept;
+			void FromBY_HANDLE_FILE_INFORMATION(const BY_HANDLE_FILE_INFORMATION& fileInfo) noexcept;
+			void FromFILE_BASIC_INFORMATION(const Dokany2::FILE_BASIC_INFORMATION& basicInfo) noexcept;
+	};
+}
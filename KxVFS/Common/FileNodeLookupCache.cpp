@@ -0,0 +1,166 @@
+#include "stdafx.h"
+#include "KxVFS/Utility.h"
+#include "FileNodeLookupCache.h"
+
+namespace
+{
+	using namespace KxVFS;
+
+	struct LastDirectory
+	{
+		const FileNodeLookupCache* Owner = nullptr;
+		size_t Generation = 0;
+		DynamicStringW Path;
+		FileNode* Node = nullptr;
+	};
+	thread_local LastDirectory g_LastDirectory;
+
+	bool SplitPath(DynamicStringRefW path, DynamicStringRefW& directory, DynamicStringRefW& name) noexcept
+	{
+		const size_t separatorPos = path.rfind(L'\\');
+		if (separatorPos == DynamicStringRefW::npos)
+		{
+			return false;
+		}
+
+		// Names in quotes are stripped by the tree walk, leave them to it
+		directory = path.substr(0, separatorPos);
+		name = path.substr(separatorPos + 1);
+		return !directory.empty() && !name.empty() && name.front() != L'"' && name.back() != L'"';
+	}
+}
+
+namespace KxVFS
+{
+	bool FileNodeLookupCache::FindMissed(DynamicStringRefW path, size_t hash, size_t generation, FileNode*& parentNode) noexcept
+	{
+		Shard& shard = GetShard(hash);
+		SharedSRWLocker lock(shard.Lock);
+
+		if (!shard.Entries.empty())
+		{
+			const NegativeEntry& entry = shard.Entries[(hash / ShardCount) % shard.Entries.size()];
+			if (entry.Hash == hash && entry.Generation == generation && Utility::Comparator::IsEqualNoCase(entry.Path, path))
+			{
+				parentNode = entry.ParentNode;
+				return true;
+			}
+		}
+		return false;
+	}
+	void FileNodeLookupCache::AddMissed(DynamicStringRefW path, size_t hash, size_t generation, FileNode* parentNode)
+	{
+		Shard& shard = GetShard(hash);
+		ExclusiveSRWLocker lock(shard.Lock);
+
+		// Direct-mapped, a new entry simply replaces whatever was in its slot
+		if (!shard.Entries.empty())
+		{
+			NegativeEntry& entry = shard.Entries[(hash / ShardCount) % shard.Entries.size()];
+			entry.Hash = hash;
+			entry.Generation = generation;
+			entry.Path = path;
+			entry.ParentNode = parentNode;
+		}
+	}
+
+	bool FileNodeLookupCache::FindInLastDirectory(DynamicStringRefW path, size_t generation, FileNode*& node, FileNode*& parentNode) const
+	{
+		const LastDirectory& lastDirectory = g_LastDirectory;
+		if (lastDirectory.Owner != this || lastDirectory.Generation != generation)
+		{
+			return false;
+		}
+
+		DynamicStringRefW directory;
+		DynamicStringRefW name;
+		if (SplitPath(path, directory, name) && Utility::Comparator::IsEqualNoCase(lastDirectory.Path, directory))
+		{
+			const DynamicStringW nameLC = Utility::StringToLower(name);
+			node = lastDirectory.Node->GetChildren().find(nameLC, FileNode::HashFileName(nameLC));
+			parentNode = lastDirectory.Node;
+			return true;
+		}
+		return false;
+	}
+	void FileNodeLookupCache::SetLastDirectory(DynamicStringRefW path, size_t generation, FileNode& directory) const
+	{
+		LastDirectory& lastDirectory = g_LastDirectory;
+		lastDirectory.Owner = this;
+		lastDirectory.Generation = generation;
+		lastDirectory.Path = path;
+		lastDirectory.Node = &directory;
+	}
+
+	FileNode* FileNodeLookupCache::NavigateToAny(FileNode& rootNode, DynamicStringRefW relativePath, FileNode*& parentNode)
+	{
+		if (FileNode::IsRequestToRootNode(relativePath))
+		{
+			return rootNode.NavigateToAny(relativePath, parentNode);
+		}
+
+		EpochGuard guard;
+
+		// Generation is taken before the lookup, so a result found in an older tree is never stored as a current one
+		const size_t generation = m_Generation.load(std::memory_order_acquire);
+		const size_t hash = Utility::Comparator::StringHashNoCase()(relativePath);
+
+		FileNode* node = nullptr;
+		if (FindMissed(relativePath, hash, generation, parentNode))
+		{
+			m_NegativeHits.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		if (FindInLastDirectory(relativePath, generation, node, parentNode))
+		{
+			m_DirectoryHits.fetch_add(1, std::memory_order_relaxed);
+			if (node == nullptr)
+			{
+				AddMissed(relativePath, hash, generation, parentNode);
+			}
+			return node;
+		}
+		m_Misses.fetch_add(1, std::memory_order_relaxed);
+
+		node = rootNode.NavigateToAny(relativePath, parentNode);
+		if (node == nullptr)
+		{
+			AddMissed(relativePath, hash, generation, parentNode);
+		}
+		else if (node->IsDirectory())
+		{
+			SetLastDirectory(relativePath, generation, *node);
+		}
+		else if (DynamicStringRefW directory, name; SplitPath(relativePath, directory, name))
+		{
+			SetLastDirectory(directory, generation, *node->GetParent());
+		}
+		return node;
+	}
+	void FileNodeLookupCache::SetCapacity(size_t capacity)
+	{
+		const size_t shardCapacity = (capacity + ShardCount - 1) / ShardCount;
+		for (Shard& shard: m_Shards)
+		{
+			ExclusiveSRWLocker lock(shard.Lock);
+
+			shard.Entries.clear();
+			shard.Entries.resize(shardCapacity);
+		}
+	}
+
+	FileNodeLookupCache::Statistics FileNodeLookupCache::GetStatistics() const noexcept
+	{
+		Statistics statistics;
+		statistics.NegativeHits = m_NegativeHits.load(std::memory_order_relaxed);
+		statistics.DirectoryHits = m_DirectoryHits.load(std::memory_order_relaxed);
+		statistics.Misses = m_Misses.load(std::memory_order_relaxed);
+		return statistics;
+	}
+	void FileNodeLookupCache::ResetStatistics() noexcept
+	{
+		m_NegativeHits = 0;
+		m_DirectoryHits = 0;
+		m_Misses = 0;
+	}
+}
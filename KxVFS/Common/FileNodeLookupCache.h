@@ -0,0 +1,86 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Utility.h"
+#include "FileNode.h"
+#include <atomic>
+
+namespace KxVFS
+{
+	// Cache of path lookups in a file tree. Remembers recently missed paths in a bounded sharded table, so probes
+	// of non-existent files don't walk the tree each time, and the last resolved directory of each thread,
+	// so a run of opens in the same folder only needs a single child lookup. Both are keyed by a generation
+	// counter, the owner must call 'Invalidate' after adding, removing, renaming or moving any node of the tree.
+	class FileNodeLookupCache final
+	{
+		public:
+			struct Statistics
+			{
+				size_t NegativeHits = 0;
+				size_t DirectoryHits = 0;
+				size_t Misses = 0;
+			};
+
+		private:
+			struct NegativeEntry
+			{
+				size_t Hash = 0;
+				size_t Generation = 0;
+				DynamicStringW Path;
+				FileNode* ParentNode = nullptr;
+			};
+			struct Shard
+			{
+				std::vector<NegativeEntry> Entries;
+				mutable SRWLock Lock;
+			};
+
+		public:
+			static constexpr size_t ShardCount = 16;
+			static constexpr size_t DefaultCapacity = 4096;
+
+		private:
+			std::array<Shard, ShardCount> m_Shards;
+			std::atomic<size_t> m_Generation = 1;
+
+			std::atomic<size_t> m_NegativeHits = 0;
+			std::atomic<size_t> m_DirectoryHits = 0;
+			std::atomic<size_t> m_Misses = 0;
+
+		private:
+			Shard& GetShard(size_t hash) noexcept
+			{
+				return m_Shards[hash % ShardCount];
+			}
+
+			bool FindMissed(DynamicStringRefW path, size_t hash, size_t generation, FileNode*& parentNode) noexcept;
+			void AddMissed(DynamicStringRefW path, size_t hash, size_t generation, FileNode* parentNode);
+
+			bool FindInLastDirectory(DynamicStringRefW path, size_t generation, FileNode*& node, FileNode*& parentNode) const;
+			void SetLastDirectory(DynamicStringRefW path, size_t generation, FileNode& directory) const;
+
+		public:
+			FileNodeLookupCache(size_t capacity = DefaultCapacity)
+			{
+				SetCapacity(capacity);
+			}
+			FileNodeLookupCache(const FileNodeLookupCache&) = delete;
+
+		public:
+			// Same as 'FileNode::NavigateToAny' called on the root node, except that 'parentNode' is only guaranteed
+			// to be set to the parent node when it exists (which is all creating a new item needs).
+			FileNode* NavigateToAny(FileNode& rootNode, DynamicStringRefW relativePath, FileNode*& parentNode);
+			void Invalidate() noexcept
+			{
+				m_Generation.fetch_add(1, std::memory_order_acq_rel);
+			}
+
+			// Total number of remembered missed paths, zero disables this part of the cache
+			void SetCapacity(size_t capacity);
+
+			Statistics GetStatistics() const noexcept;
+			void ResetStatistics() noexcept;
+
+		public:
+			FileNodeLookupCache& operator=(const FileNodeLookupCache&) = delete;
+	};
+}
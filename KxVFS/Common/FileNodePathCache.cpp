@@ -0,0 +1,56 @@
+#include "stdafx.h"
+#include "KxVFS/Utility.h"
+#include "FileNodePathCache.h"
+
+namespace KxVFS
+{
+	void FileNodePathCache::Trim() noexcept
+	{
+		while (m_Entries.size() > m_Capacity)
+		{
+			m_Index.erase(m_Entries.back().Key);
+			m_Entries.pop_back();
+		}
+	}
+
+	void FileNodePathCache::GetPath(const FileNode& node, FlagSet<PathParts> parts, DynamicStringW& buffer)
+	{
+		const EntryKey key = {&node, parts};
+		size_t generation = 0;
+		if (CriticalSectionLocker lock(m_Lock); true)
+		{
+			if (auto it = m_Index.find(key); it != m_Index.end())
+			{
+				// Move to the front of the list as the most recently used
+				m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+				buffer = it->second->Path;
+				return;
+			}
+			generation = m_Generation;
+		}
+
+		node.ConstructPath(parts, buffer);
+		if (CriticalSectionLocker lock(m_Lock); m_Capacity != 0 && generation == m_Generation && m_Index.find(key) == m_Index.end())
+		{
+			// Don't remember the path if the tree has changed while it was being constructed
+			m_Entries.push_front(Entry{key, buffer});
+			m_Index.insert_or_assign(key, m_Entries.begin());
+			Trim();
+		}
+	}
+	void FileNodePathCache::Invalidate() noexcept
+	{
+		CriticalSectionLocker lock(m_Lock);
+
+		m_Entries.clear();
+		m_Index.clear();
+		m_Generation++;
+	}
+	void FileNodePathCache::SetCapacity(size_t capacity) noexcept
+	{
+		CriticalSectionLocker lock(m_Lock);
+
+		m_Capacity = capacity;
+		Trim();
+	}
+}
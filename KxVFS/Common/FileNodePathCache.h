@@ -0,0 +1,82 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Utility.h"
+#include "FileNode.h"
+#include <list>
+
+namespace KxVFS
+{
+	// Small LRU cache of recently constructed node paths. Nodes don't know about the cache, so the owner
+	// must call 'Invalidate' after renaming, moving or removing any node of the tree it's used with.
+	class FileNodePathCache final
+	{
+		private:
+			struct EntryKey
+			{
+				const FileNode* Node = nullptr;
+				FlagSet<PathParts> Parts;
+
+				bool operator==(const EntryKey& other) const noexcept
+				{
+					return Node == other.Node && Parts == other.Parts;
+				}
+			};
+			struct EntryKeyHash
+			{
+				size_t operator()(const EntryKey& key) const noexcept
+				{
+					return std::hash<const FileNode*>()(key.Node) ^ (static_cast<size_t>(key.Parts.ToInt()) << 1);
+				}
+			};
+			struct Entry
+			{
+				EntryKey Key;
+				DynamicStringW Path;
+			};
+			using TEntries = std::list<Entry>;
+
+		public:
+			static constexpr size_t DefaultCapacity = 128;
+
+		private:
+			TEntries m_Entries;
+			std::unordered_map<EntryKey, TEntries::iterator, EntryKeyHash> m_Index;
+			size_t m_Capacity = DefaultCapacity;
+			size_t m_Generation = 0;
+			mutable CriticalSection m_Lock;
+
+		private:
+			void Trim() noexcept;
+
+		public:
+			FileNodePathCache(size_t capacity = DefaultCapacity)
+				:m_Capacity(capacity)
+			{
+			}
+			FileNodePathCache(const FileNodePathCache&) = delete;
+
+		public:
+			// Copies cached path into the buffer or constructs it and remembers the result
+			void GetPath(const FileNode& node, FlagSet<PathParts> parts, DynamicStringW& buffer);
+			DynamicStringW GetPath(const FileNode& node, FlagSet<PathParts> parts)
+			{
+				DynamicStringW path;
+				GetPath(node, parts, path);
+				return path;
+			}
+			void Invalidate() noexcept;
+
+			size_t GetCapacity() const noexcept
+			{
+				return m_Capacity;
+			}
+			void SetCapacity(size_t capacity) noexcept;
+			size_t GetSize() const noexcept
+			{
+				return m_Entries.size();
+			}
+
+		public:
+			FileNodePathCache& operator=(const FileNodePathCache&) = delete;
+	};
+}
@@ -0,0 +1,121 @@
+#include "stdafx.h"
+#include "KxVFS/Utility.h"
+#include "FileNodePathIndex.h"
+
+namespace KxVFS
+{
+	bool FileNodePathIndex::IsNodeAtPath(const FileNode& node, DynamicStringRefW relativePath) noexcept
+	{
+		// Compare names from the node up to the root with path components from the end
+		const FileNode* currentNode = &node;
+		size_t end = relativePath.length();
+		while (end != 0)
+		{
+			const size_t separatorPos = relativePath.rfind(L'\\', end - 1);
+			const size_t start = separatorPos == DynamicStringRefW::npos ? 0 : separatorPos + 1;
+			const DynamicStringRefW name = relativePath.substr(start, end - start);
+			end = separatorPos == DynamicStringRefW::npos ? 0 : separatorPos;
+
+			if (!name.empty())
+			{
+				if (currentNode->IsRootNode() || !Utility::Comparator::IsEqualNoCase(currentNode->GetName(), name))
+				{
+					return false;
+				}
+				currentNode = currentNode->GetParent();
+			}
+		}
+		return currentNode->IsRootNode();
+	}
+	void FileNodePathIndex::DoAddBranch(FileNode& node, size_t hash)
+	{
+		if (auto [it, inserted] = m_Index.emplace(hash, &node); !inserted && it->second != &node)
+		{
+			it->second = nullptr;
+		}
+		node.WalkChildren([this, hash](FileNode& child)
+		{
+			DoAddBranch(child, CombineHash(hash, child.GetNameHash()));
+			return true;
+		});
+	}
+	void FileNodePathIndex::DoRemoveBranch(const FileNode& node, size_t hash) noexcept
+	{
+		// Collision marks are left in place, the index doesn't know how many paths are still sharing the hash
+		if (auto it = m_Index.find(hash); it != m_Index.end() && it->second == &node)
+		{
+			m_Index.erase(it);
+		}
+		node.WalkChildren([this, hash](const FileNode& child)
+		{
+			DoRemoveBranch(child, CombineHash(hash, child.GetNameHash()));
+			return true;
+		});
+	}
+
+	size_t FileNodePathIndex::HashPath(DynamicStringRefW relativePath) noexcept
+	{
+		size_t hash = 0;
+		Utility::String::SplitBySeparator(relativePath, L'\\', [&hash](DynamicStringRefW name)
+		{
+			hash = CombineHash(hash, FileNode::HashFileName(name));
+			return true;
+		});
+		return hash;
+	}
+	size_t FileNodePathIndex::HashNodePath(const FileNode& node) noexcept
+	{
+		if (node.IsRootNode())
+		{
+			return 0;
+		}
+		return CombineHash(HashNodePath(*node.GetParent()), node.GetNameHash());
+	}
+
+	void FileNodePathIndex::AddBranch(FileNode& node)
+	{
+		ExclusiveSRWLocker lock(m_Lock);
+		DoAddBranch(node, HashNodePath(node));
+	}
+	void FileNodePathIndex::RemoveBranch(const FileNode& node) noexcept
+	{
+		ExclusiveSRWLocker lock(m_Lock);
+		DoRemoveBranch(node, HashNodePath(node));
+	}
+
+	void FileNodePathIndex::Build(FileNode& rootNode)
+	{
+		ExclusiveSRWLocker lock(m_Lock);
+		m_Index.clear();
+		rootNode.WalkChildren([this](FileNode& child)
+		{
+			DoAddBranch(child, CombineHash(0, child.GetNameHash()));
+			return true;
+		});
+	}
+	void FileNodePathIndex::Clear() noexcept
+	{
+		ExclusiveSRWLocker lock(m_Lock);
+		m_Index.clear();
+	}
+
+	FileNodePathIndex::Result FileNodePathIndex::Find(DynamicStringRefW relativePath, FileNode*& node) const noexcept
+	{
+		const size_t hash = HashPath(relativePath);
+
+		SharedSRWLocker lock(m_Lock);
+		if (auto it = m_Index.find(hash); it != m_Index.end())
+		{
+			if (it->second == nullptr)
+			{
+				return Result::Unknown;
+			}
+			if (IsNodeAtPath(*it->second, relativePath))
+			{
+				node = it->second;
+				return Result::Found;
+			}
+		}
+		return Result::NotFound;
+	}
+}
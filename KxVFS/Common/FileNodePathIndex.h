@@ -0,0 +1,64 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Utility.h"
+#include "FileNode.h"
+
+namespace KxVFS
+{
+	// Tree-wide map from the hash of a case-folded relative path to its node, lets path lookups skip the per-component walk.
+	// Path hash is combined from name hashes of all its components, so a branch can be indexed starting from any node.
+	// Paths with colliding hashes are marked as such and their lookups are left to the component walk.
+	// Attached to a tree through its arena ('FileNodeArena::SetPathIndex'), nodes keep it in sync when children are added,
+	// removed or renamed. Doesn't need to be attached while a tree is built, it's faster to build the index afterwards.
+	class FileNodePathIndex final
+	{
+		public:
+			enum class Result
+			{
+				Found,
+				NotFound,
+				Unknown
+			};
+
+		private:
+			// Null node means the hash is shared by more than one path
+			std::unordered_map<size_t, FileNode*> m_Index;
+			mutable SRWLock m_Lock;
+
+		private:
+			static bool IsNodeAtPath(const FileNode& node, DynamicStringRefW relativePath) noexcept;
+			void DoAddBranch(FileNode& node, size_t hash);
+			void DoRemoveBranch(const FileNode& node, size_t hash) noexcept;
+
+		public:
+			static size_t CombineHash(size_t parentHash, size_t nameHash) noexcept
+			{
+				return parentHash ^ (nameHash + size_t(0x9e3779b9u) + (parentHash << 6) + (parentHash >> 2));
+			}
+			static size_t HashPath(DynamicStringRefW relativePath) noexcept;
+			static size_t HashNodePath(const FileNode& node) noexcept;
+
+		public:
+			FileNodePathIndex() = default;
+			FileNodePathIndex(const FileNodePathIndex&) = delete;
+
+		public:
+			// Adds or removes the node and all of its descendants
+			void AddBranch(FileNode& node);
+			void RemoveBranch(const FileNode& node) noexcept;
+
+			void Build(FileNode& rootNode);
+			void Clear() noexcept;
+			size_t GetSize() const noexcept
+			{
+				return m_Index.size();
+			}
+
+			// 'NotFound' is only returned when there's definitely no node with this path in the indexed tree.
+			// Path components must not be quoted, see 'FileNode::StripQuotes'.
+			Result Find(DynamicStringRefW relativePath, FileNode*& node) const noexcept;
+
+		public:
+			FileNodePathIndex& operator=(const FileNodePathIndex&) = delete;
+	};
+}
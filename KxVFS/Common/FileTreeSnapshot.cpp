@@ -0,0 +1,421 @@
+#include "stdafx.h"
+#include "KxVFS/Utility.h"
+#include "FileTreeSnapshot.h"
+#include <map>
+
+namespace
+{
+	using namespace KxVFS;
+
+	uint64_t FileTimeToInt(const FILETIME& value) noexcept
+	{
+		return (static_cast<uint64_t>(value.dwHighDateTime) << 32)|value.dwLowDateTime;
+	}
+	FILETIME FileTimeFromInt(uint64_t value) noexcept
+	{
+		FILETIME fileTime = {};
+		fileTime.dwLowDateTime = static_cast<DWORD>(value);
+		fileTime.dwHighDateTime = static_cast<DWORD>(value >> 32);
+		return fileTime;
+	}
+
+	DynamicStringW MakeLayerPath(DynamicStringRefW layerPath, DynamicStringRefW relativePath)
+	{
+		DynamicStringW path = layerPath;
+		if (!relativePath.empty())
+		{
+			path += L'\\';
+			path += relativePath;
+		}
+		return path;
+	}
+
+	template<class T>
+	void AppendRecords(std::vector<uint8_t>& buffer, const std::vector<T>& records)
+	{
+		const uint8_t* data = reinterpret_cast<const uint8_t*>(records.data());
+		buffer.insert(buffer.end(), data, data + records.size() * sizeof(T));
+	}
+}
+
+namespace KxVFS
+{
+	FileTreeSnapshot::StampRecord FileTreeSnapshot::MakeStamp(uint32_t layer, DynamicStringRefW path) noexcept
+	{
+		StampRecord stamp;
+		stamp.Layer = layer;
+		stamp.Attributes = ToInt(FileAttributes::Invalid);
+
+		DynamicStringW fullPath = Utility::GetLongPathPrefix();
+		fullPath += path;
+
+		WIN32_FILE_ATTRIBUTE_DATA attributeData = {};
+		if (::GetFileAttributesExW(fullPath, GetFileExInfoStandard, &attributeData))
+		{
+			stamp.Attributes = attributeData.dwFileAttributes;
+			stamp.ModificationTime = FileTimeToInt(attributeData.ftLastWriteTime);
+		}
+		return stamp;
+	}
+	bool FileTreeSnapshot::Write(DynamicStringRefW filePath, const FileNode& rootNode, const std::vector<DynamicStringW>& layers, const std::vector<uint32_t>& priorities)
+	{
+		std::vector<LayerRecord> layerRecords;
+		std::vector<NodeRecord> nodeRecords;
+		std::vector<StampRecord> stampRecords;
+		std::vector<uint32_t> layerSets;
+		std::vector<wchar_t> names;
+
+		std::unordered_map<DynamicStringRefW, uint32_t> nameIndex;
+		auto AddName = [&names, &nameIndex](DynamicStringRefW name) -> uint32_t
+		{
+			auto [it, inserted] = nameIndex.emplace(name, static_cast<uint32_t>(names.size()));
+			if (inserted)
+			{
+				names.insert(names.end(), name.begin(), name.end());
+			}
+			return it->second;
+		};
+
+		std::map<std::vector<uint32_t>, uint32_t> layerSetIndex;
+		auto AddLayerSet = [&layerSets, &layerSetIndex](InternedLayerSet layerSet) -> uint32_t
+		{
+			if (layerSet.empty())
+			{
+				return InvalidIndex;
+			}
+
+			auto [it, inserted] = layerSetIndex.emplace(std::vector<uint32_t>(layerSet.begin(), layerSet.end()), static_cast<uint32_t>(layerSets.size()));
+			if (inserted)
+			{
+				layerSets.push_back(static_cast<uint32_t>(layerSet.size()));
+				layerSets.insert(layerSets.end(), layerSet.begin(), layerSet.end());
+			}
+			return it->second;
+		};
+
+		std::unordered_map<DynamicStringRefW, uint32_t> layerIndex;
+		for (size_t i = 0; i < layers.size(); i++)
+		{
+			LayerRecord& record = layerRecords.emplace_back();
+			record.NameOffset = AddName(layers[i]);
+			record.NameLength = static_cast<uint32_t>(layers[i].length());
+			record.Priority = priorities[i];
+
+			if (!layers[i].empty())
+			{
+				layerIndex.emplace(layers[i], static_cast<uint32_t>(i));
+			}
+		}
+
+		// Breadth-first order, children of each node are added right after all previously queued nodes
+		std::vector<const FileNode*> nodes = {&rootNode};
+		for (size_t i = 0; i < nodes.size(); i++)
+		{
+			const FileNode& node = *nodes[i];
+			NodeRecord& record = nodeRecords.emplace_back();
+			record.NameOffset = AddName(node.GetName());
+			record.NameLength = static_cast<uint32_t>(node.GetName().length());
+			record.LayerSet = AddLayerSet(node.GetLayers());
+			record.Attributes = node.GetAttributes().ToInt();
+			record.FileSize = node.GetFileSize();
+			record.CreationTime = FileTimeToInt(node.GetCreationTime());
+			record.LastAccessTime = FileTimeToInt(node.GetLastAccessTime());
+			record.ModificationTime = FileTimeToInt(node.GetModificationTime());
+			if (auto it = layerIndex.find(node.GetVirtualDirectory()); it != layerIndex.end())
+			{
+				record.VirtualDirectory = it->second;
+			}
+
+			if (node.IsRootNode() || node.IsDirectory())
+			{
+				const DynamicStringW relativePath = node.GetRelativePath();
+				record.FirstStamp = static_cast<uint32_t>(stampRecords.size());
+				if (node.IsRootNode())
+				{
+					for (const auto& [path, layer]: layerIndex)
+					{
+						stampRecords.push_back(MakeStamp(layer, path));
+					}
+				}
+				else
+				{
+					for (uint32_t layer: node.GetLayers())
+					{
+						stampRecords.push_back(MakeStamp(layer, MakeLayerPath(layers[layer], relativePath)));
+					}
+				}
+				record.StampCount = static_cast<uint32_t>(stampRecords.size()) - record.FirstStamp;
+
+				record.FirstChild = static_cast<uint32_t>(nodes.size());
+				record.ChildCount = static_cast<uint32_t>(node.GetChildrenCount());
+				node.WalkChildren([&nodes](const FileNode& child)
+				{
+					nodes.push_back(&child);
+					return true;
+				});
+			}
+		}
+
+		Header header;
+		header.Signature = Signature;
+		header.Version = Version;
+		header.LayerCount = static_cast<uint32_t>(layerRecords.size());
+		header.NodeCount = static_cast<uint32_t>(nodeRecords.size());
+		header.StampCount = static_cast<uint32_t>(stampRecords.size());
+		header.LayerSetsSize = static_cast<uint32_t>(layerSets.size());
+		header.NamesSize = static_cast<uint32_t>(names.size());
+
+		std::vector<uint8_t> buffer;
+		AppendRecords(buffer, std::vector<Header>{header});
+		AppendRecords(buffer, layerRecords);
+		AppendRecords(buffer, nodeRecords);
+		AppendRecords(buffer, stampRecords);
+		AppendRecords(buffer, layerSets);
+		AppendRecords(buffer, names);
+
+		// Write into a temporary file first, so a failure can't leave a partially written snapshot behind
+		DynamicStringW tempPath = filePath;
+		tempPath += L".tmp";
+
+		FileHandle file(tempPath, AccessRights::GenericWrite, FileShare::None, CreationDisposition::CreateAlways);
+		if (file)
+		{
+			DWORD written = 0;
+			const bool success = file.Write(buffer.data(), static_cast<DWORD>(buffer.size()), written) && written == buffer.size();
+			file.Close();
+
+			if (success && ::MoveFileExW(tempPath, DynamicStringW(filePath), MOVEFILE_REPLACE_EXISTING))
+			{
+				return true;
+			}
+			::DeleteFileW(tempPath);
+		}
+		return false;
+	}
+
+	bool FileTreeSnapshot::GetName(uint32_t offset, uint32_t length, DynamicStringRefW& name) const noexcept
+	{
+		if (static_cast<uint64_t>(offset) + length <= m_Header->NamesSize)
+		{
+			name = DynamicStringRefW(m_Names + offset, length);
+			return true;
+		}
+		return false;
+	}
+	bool FileTreeSnapshot::GetLayerSet(uint32_t offset, std::vector<uint32_t>& layerSet) const
+	{
+		layerSet.clear();
+		if (offset == InvalidIndex)
+		{
+			return true;
+		}
+
+		if (offset < m_Header->LayerSetsSize && static_cast<uint64_t>(offset) + 1 + m_LayerSets[offset] <= m_Header->LayerSetsSize)
+		{
+			layerSet.assign(m_LayerSets + offset + 1, m_LayerSets + offset + 1 + m_LayerSets[offset]);
+			return std::all_of(layerSet.begin(), layerSet.end(), [this](uint32_t layer)
+			{
+				return layer < m_Header->LayerCount;
+			});
+		}
+		return false;
+	}
+	bool FileTreeSnapshot::IsDirectoryChanged(const NodeRecord& record, const FileNode& node) const
+	{
+		if (static_cast<uint64_t>(record.FirstStamp) + record.StampCount > m_Header->StampCount)
+		{
+			return true;
+		}
+
+		const DynamicStringW relativePath = node.GetRelativePath();
+		for (uint32_t i = 0; i < record.StampCount; i++)
+		{
+			const StampRecord& stamp = m_Stamps[record.FirstStamp + i];
+			if (stamp.Layer >= m_Header->LayerCount)
+			{
+				return true;
+			}
+
+			const StampRecord currentStamp = MakeStamp(stamp.Layer, MakeLayerPath(GetLayerPath(stamp.Layer), relativePath));
+			if (currentStamp.Attributes != stamp.Attributes || currentStamp.ModificationTime != stamp.ModificationTime)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool FileTreeSnapshot::Open(DynamicStringRefW filePath)
+	{
+		Close();
+
+		m_File = ::CreateFileW(DynamicStringW(filePath), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		LARGE_INTEGER fileSize = {};
+		if (m_File.IsNull() || !::GetFileSizeEx(m_File, &fileSize) || fileSize.QuadPart < static_cast<int64_t>(sizeof(Header)))
+		{
+			Close();
+			return false;
+		}
+
+		m_Mapping = ::CreateFileMappingW(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_Mapping.IsNull())
+		{
+			Close();
+			return false;
+		}
+		m_View = static_cast<const uint8_t*>(::MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+		m_Size = static_cast<size_t>(fileSize.QuadPart);
+		if (!m_View)
+		{
+			Close();
+			return false;
+		}
+
+		// Check that all sections fit into the file
+		const Header* header = reinterpret_cast<const Header*>(m_View);
+		const uint64_t expectedSize = sizeof(Header) +
+			static_cast<uint64_t>(header->LayerCount) * sizeof(LayerRecord) +
+			static_cast<uint64_t>(header->NodeCount) * sizeof(NodeRecord) +
+			static_cast<uint64_t>(header->StampCount) * sizeof(StampRecord) +
+			static_cast<uint64_t>(header->LayerSetsSize) * sizeof(uint32_t) +
+			static_cast<uint64_t>(header->NamesSize) * sizeof(wchar_t);
+		if (header->Signature != Signature || header->Version != Version || header->NodeCount == 0 || expectedSize != m_Size)
+		{
+			Close();
+			return false;
+		}
+
+		const uint8_t* data = m_View + sizeof(Header);
+		auto NextSection = [&data](auto*& section, size_t count)
+		{
+			section = reinterpret_cast<std::remove_reference_t<decltype(section)>>(data);
+			data += count * sizeof(*section);
+		};
+		NextSection(m_Layers, header->LayerCount);
+		NextSection(m_Nodes, header->NodeCount);
+		NextSection(m_Stamps, header->StampCount);
+		NextSection(m_LayerSets, header->LayerSetsSize);
+		NextSection(m_Names, header->NamesSize);
+		m_Header = header;
+
+		for (uint32_t i = 0; i < header->LayerCount; i++)
+		{
+			DynamicStringRefW name;
+			if (!GetName(m_Layers[i].NameOffset, m_Layers[i].NameLength, name))
+			{
+				Close();
+				return false;
+			}
+		}
+		return true;
+	}
+	void FileTreeSnapshot::Close() noexcept
+	{
+		if (m_View)
+		{
+			::UnmapViewOfFile(m_View);
+		}
+		m_Mapping.Close();
+		m_File.Close();
+
+		m_View = nullptr;
+		m_Size = 0;
+		m_Header = nullptr;
+		m_Layers = nullptr;
+		m_Nodes = nullptr;
+		m_Stamps = nullptr;
+		m_LayerSets = nullptr;
+		m_Names = nullptr;
+	}
+
+	DynamicStringRefW FileTreeSnapshot::GetLayerPath(size_t index) const noexcept
+	{
+		return DynamicStringRefW(m_Names + m_Layers[index].NameOffset, m_Layers[index].NameLength);
+	}
+	bool FileTreeSnapshot::Load(FileNode& rootNode, FileNodeArena& arena, FileNode::RefVector& changedDirectories) const
+	{
+		if (!IsOK())
+		{
+			return false;
+		}
+
+		// Every node except the root belongs to exactly one range of children. Checked for all directories up front, including
+		// those which are built again, otherwise overlapping ranges would silently move a node to another parent.
+		std::vector<bool> isChild(m_Header->NodeCount, false);
+		for (uint32_t i = 0; i < m_Header->NodeCount; i++)
+		{
+			const NodeRecord& record = m_Nodes[i];
+			if (record.ChildCount == 0 || (i != 0 && (record.Attributes & FILE_ATTRIBUTE_DIRECTORY) == 0))
+			{
+				continue;
+			}
+
+			// Children always follow their parent, this also rules out any cycles
+			if (record.FirstChild <= i || static_cast<uint64_t>(record.FirstChild) + record.ChildCount > m_Header->NodeCount)
+			{
+				return false;
+			}
+			for (uint32_t childIndex = record.FirstChild; childIndex < record.FirstChild + record.ChildCount; childIndex++)
+			{
+				if (isChild[childIndex])
+				{
+					return false;
+				}
+				isChild[childIndex] = true;
+			}
+		}
+
+		// Nodes which weren't created (because they belong to a changed directory) stay null
+		std::vector<FileNode*> nodes(m_Header->NodeCount, nullptr);
+		nodes[0] = &rootNode;
+
+		std::vector<uint32_t> layerSet;
+		for (uint32_t i = 0; i < m_Header->NodeCount; i++)
+		{
+			FileNode* node = nodes[i];
+			const NodeRecord& record = m_Nodes[i];
+			if (node == nullptr || (i != 0 && (record.Attributes & FILE_ATTRIBUTE_DIRECTORY) == 0))
+			{
+				continue;
+			}
+
+			// Empty directories are checked as well, something could have been added to them since
+			if (IsDirectoryChanged(record, *node))
+			{
+				changedDirectories.push_back(node);
+				continue;
+			}
+			if (record.ChildCount == 0)
+			{
+				continue;
+			}
+
+			std::vector<std::unique_ptr<FileNode>> children;
+			children.reserve(record.ChildCount);
+			for (uint32_t childIndex = record.FirstChild; childIndex < record.FirstChild + record.ChildCount; childIndex++)
+			{
+				const NodeRecord& childRecord = m_Nodes[childIndex];
+
+				DynamicStringRefW name;
+				if (!GetName(childRecord.NameOffset, childRecord.NameLength, name) || childRecord.VirtualDirectory >= m_Header->LayerCount || !GetLayerSet(childRecord.LayerSet, layerSet))
+				{
+					return false;
+				}
+
+				FileNodeInfo info;
+				info.SetAttributes(FromInt<FileAttributes>(childRecord.Attributes));
+				info.SetFileSize(childRecord.FileSize);
+				info.SetCreationTime(FileTimeFromInt(childRecord.CreationTime));
+				info.SetLastAccessTime(FileTimeFromInt(childRecord.LastAccessTime));
+				info.SetModificationTime(FileTimeFromInt(childRecord.ModificationTime));
+
+				std::unique_ptr<FileNode>& childNode = children.emplace_back(FileNode::Create(&arena, name, info, node));
+				childNode->SetVirtualDirectory(GetLayerPath(childRecord.VirtualDirectory));
+				childNode->SetLayers(layerSet);
+				nodes[childIndex] = childNode.get();
+			}
+			node->AddChildren(std::move(children));
+		}
+		return true;
+	}
+}
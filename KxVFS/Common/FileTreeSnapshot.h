@@ -0,0 +1,118 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Utility.h"
+#include "FileNode.h"
+
+namespace KxVFS
+{
+	// Serialized virtual tree which can be mapped into memory and read in place. Nodes are stored in breadth-first order,
+	// so children of every node occupy a contiguous range following their parent. Every directory also stores modification
+	// times of its counterparts in all layers it comes from, which are used to find out what has changed since the snapshot was written.
+	// File layout: header, layers, nodes, stamps, layer sets (count followed by IDs), names. All references are indices.
+	class FileTreeSnapshot final
+	{
+		public:
+			static constexpr uint32_t Signature = 0x5346564B;
+			static constexpr uint32_t Version = 1;
+			static constexpr uint32_t InvalidIndex = std::numeric_limits<uint32_t>::max();
+
+			struct Header
+			{
+				uint32_t Signature = 0;
+				uint32_t Version = 0;
+				uint32_t LayerCount = 0;
+				uint32_t NodeCount = 0;
+				uint32_t StampCount = 0;
+				uint32_t LayerSetsSize = 0;
+				uint32_t NamesSize = 0;
+				uint32_t Reserved = 0;
+			};
+			struct LayerRecord
+			{
+				uint32_t NameOffset = 0;
+				uint32_t NameLength = 0;
+				uint32_t Priority = 0;
+				uint32_t Reserved = 0;
+			};
+			struct NodeRecord
+			{
+				uint32_t NameOffset = 0;
+				uint32_t NameLength = 0;
+				uint32_t FirstChild = 0;
+				uint32_t ChildCount = 0;
+				uint32_t FirstStamp = 0;
+				uint32_t StampCount = 0;
+				uint32_t LayerSet = InvalidIndex;
+				uint32_t VirtualDirectory = InvalidIndex;
+				uint32_t Attributes = 0;
+				uint32_t Reserved = 0;
+				int64_t FileSize = 0;
+				uint64_t CreationTime = 0;
+				uint64_t LastAccessTime = 0;
+				uint64_t ModificationTime = 0;
+			};
+			struct StampRecord
+			{
+				uint32_t Layer = 0;
+				uint32_t Attributes = 0;
+				uint64_t ModificationTime = 0;
+			};
+
+		public:
+			static StampRecord MakeStamp(uint32_t layer, DynamicStringRefW path) noexcept;
+
+			// Layer paths are indexed by layer IDs used in nodes, empty paths are for removed layers
+			static bool Write(DynamicStringRefW filePath, const FileNode& rootNode, const std::vector<DynamicStringW>& layers, const std::vector<uint32_t>& priorities);
+
+		private:
+			GenericHandle m_File;
+			GenericHandle m_Mapping;
+			const uint8_t* m_View = nullptr;
+			size_t m_Size = 0;
+
+			const Header* m_Header = nullptr;
+			const LayerRecord* m_Layers = nullptr;
+			const NodeRecord* m_Nodes = nullptr;
+			const StampRecord* m_Stamps = nullptr;
+			const uint32_t* m_LayerSets = nullptr;
+			const wchar_t* m_Names = nullptr;
+
+		private:
+			bool GetName(uint32_t offset, uint32_t length, DynamicStringRefW& name) const noexcept;
+			bool GetLayerSet(uint32_t offset, std::vector<uint32_t>& layerSet) const;
+			bool IsDirectoryChanged(const NodeRecord& record, const FileNode& node) const;
+
+		public:
+			FileTreeSnapshot() = default;
+			FileTreeSnapshot(const FileTreeSnapshot&) = delete;
+			~FileTreeSnapshot()
+			{
+				Close();
+			}
+
+		public:
+			bool IsOK() const noexcept
+			{
+				return m_Header != nullptr;
+			}
+			bool Open(DynamicStringRefW filePath);
+			void Close() noexcept;
+
+			size_t GetLayerCount() const noexcept
+			{
+				return m_Header ? m_Header->LayerCount : 0;
+			}
+			DynamicStringRefW GetLayerPath(size_t index) const noexcept;
+			uint32_t GetLayerPriority(size_t index) const noexcept
+			{
+				return m_Layers[index].Priority;
+			}
+
+			// Creates nodes under the (empty) root node. Directories which have changed since the snapshot was written
+			// are created without children and returned in 'changedDirectories' to be built again, the root node can be one of them.
+			bool Load(FileNode& rootNode, FileNodeArena& arena, FileNode::RefVector& changedDirectories) const;
+
+		public:
+			FileTreeSnapshot& operator=(const FileTreeSnapshot&) = delete;
+	};
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+
+namespace KxVFS
+{
+	class IOManager;
+	class FileContext;
+	class AsyncIOContext;
+}
+
+namespace KxVFS
+{
+	// Submission and completion of overlapped file operations for 'IOManager'. Backend is told when a file context
+	// is taken from the pool and when it's returned there. Every submitted operation must eventually be passed
+	// to 'IOManager::OnAsyncIOCompleted', on any thread.
+	class KxVFS_API IAsyncIOBackend
+	{
+		public:
+			virtual ~IAsyncIOBackend() = default;
+
+		public:
+			virtual bool Init(IOManager& ioManager) = 0;
+
+			// Must complete all submitted operations before returning
+			virtual void Cleanup() noexcept = 0;
+
+			virtual bool OnOpenFile(FileContext& fileContext) = 0;
+			virtual void OnCloseFile(FileContext& fileContext) noexcept = 0;
+
+			// Returns false and sets last error if the operation has failed right away, it's not completed then
+			virtual bool Submit(AsyncIOContext& asyncContext) noexcept = 0;
+	};
+}
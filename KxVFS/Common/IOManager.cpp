@@ -5,6 +5,7 @@
 #include "KxVFS/Utility.h"
 #include "IOManager.h"
 #include "FileContextManager.h"
+#include "ThreadpoolIOBackend.h"
 
 namespace KxVFS
 {
@@ -12,142 +13,241 @@ namespace KxVFS
 	{
 		if (!m_IsInitialized)
 		{
-			if (!InitializePendingAsyncIO())
+			if (!m_Backend)
+			{
+				m_Backend = std::make_unique<ThreadpoolIOBackend>();
+			}
+			if (!m_Backend->Init(*this))
 			{
 				return false;
 			}
-			m_AsyncContextPool.reserve(128);
+			m_AsyncContextPool.Reserve(m_AsyncContextPoolInitialSize, []()
+			{
+				return new(std::nothrow) AsyncIOContext();
+			});
 
 			m_IsInitialized = true;
 			return true;
 		}
 		return false;
 	}
-	bool IOManager::InitializePendingAsyncIO() noexcept
+	void IOManager::CleanupAsyncIO() noexcept
 	{
-		m_ThreadPool = Dokany2::DokanGetThreadPool();
-		if (!m_ThreadPool)
+		if (m_IsInitialized)
 		{
-			return false;
-		}
+			m_Backend->Cleanup();
+			m_AsyncContextPool.Clear();
 
-		m_ThreadPoolCleanupGroup = ::CreateThreadpoolCleanupGroup();
-		if (!m_ThreadPoolCleanupGroup)
-		{
-			return false;
+			m_IsInitialized = false;
 		}
-
-		::InitializeThreadpoolEnvironment(&m_ThreadPoolEnvironment);
-		::SetThreadpoolCallbackPool(&m_ThreadPoolEnvironment, m_ThreadPool);
-		::SetThreadpoolCallbackCleanupGroup(&m_ThreadPoolEnvironment, m_ThreadPoolCleanupGroup, nullptr);
-		return true;
 	}
-	
-	void IOManager::CleanupPendingAsyncIO() noexcept
+
+	bool IOManager::ReadFromCache(FileContext& fileContext, EvtReadFile& eventInfo) const noexcept
 	{
-		if (CriticalSectionLocker lock(m_ThreadPoolCS); m_ThreadPoolCleanupGroup)
+		const BlockCache::FileKey& cacheKey = fileContext.GetCacheKey();
+		if (cacheKey.IsValid() && m_BlockCache.IsEnabled() && eventInfo.Offset < cacheKey.Size)
 		{
-			::CloseThreadpoolCleanupGroupMembers(m_ThreadPoolCleanupGroup, FALSE, nullptr);
-			::CloseThreadpoolCleanupGroup(m_ThreadPoolCleanupGroup);
-			m_ThreadPoolCleanupGroup = nullptr;
-
-			::DestroyThreadpoolEnvironment(&m_ThreadPoolEnvironment);
+			// Read past the end of the file is served up to the end, same as from the disk
+			const DWORD size = static_cast<DWORD>(std::min<int64_t>(eventInfo.NumberOfBytesToRead, cacheKey.Size - eventInfo.Offset));
+			if (m_BlockCache.Read(cacheKey, eventInfo.Offset, eventInfo.Buffer, size))
+			{
+				eventInfo.NumberOfBytesRead = size;
+				m_FileSystem.OnFileRead(eventInfo, fileContext);
+				return true;
+			}
 		}
+		return false;
 	}
-	void IOManager::CleanupAsyncIO() noexcept
+	void IOManager::AddToCache(const FileContext& fileContext, int64_t offset, const void* buffer, size_t size, uint64_t generation) const noexcept
 	{
-		if (m_IsInitialized)
+		const BlockCache::FileKey& cacheKey = fileContext.GetCacheKey();
+		if (cacheKey.IsValid() && m_BlockCache.IsEnabled())
 		{
-			CleanupPendingAsyncIO();
-			if (CriticalSectionLocker lock(m_AsyncContextPoolCS); true)
+			try
 			{
-				for (AsyncIOContext* asyncContext: m_AsyncContextPool)
-				{
-					DeleteContext(asyncContext);
-				}
-
-				m_AsyncContextPool.clear();
-				m_AsyncContextPool.shrink_to_fit();
-				m_AsyncContextPoolMaxSize = 0;
+				m_BlockCache.Insert(cacheKey, offset, buffer, size, generation);
 			}
+			catch (const std::bad_alloc&)
+			{
+				// Nothing is lost, the data is just read from the disk next time
+			}
+		}
+	}
+	void IOManager::DetachBlockCache(FileContext& fileContext) noexcept
+	{
+		if (const BlockCache::FileKey& cacheKey = fileContext.GetCacheKey(); cacheKey.IsValid())
+		{
+			m_BlockCache.RemoveReader(cacheKey);
+		}
+		fileContext.ResetCacheKey();
+	}
 
-			m_IsInitialized = false;
+	ReadAheadState::Range IOManager::GetReadAheadRange(FileContext& fileContext, const EvtReadFile& eventInfo) const noexcept
+	{
+		const BlockCache::FileKey& cacheKey = fileContext.GetCacheKey();
+		if (m_IsReadAheadEnabled && cacheKey.IsValid() && m_BlockCache.IsEnabled())
+		{
+			return fileContext.GetReadAhead().OnRead(eventInfo.Offset, eventInfo.NumberOfBytesToRead, cacheKey.Size, BlockCache::BlockSize);
 		}
+		return {};
 	}
-	
-	void CALLBACK IOManager::AsyncCallback(PTP_CALLBACK_INSTANCE instance,
-										   PVOID context,
-										   PVOID overlapped,
-										   ULONG resultIO,
-										   ULONG_PTR bytesTransferred,
-										   PTP_IO completionPort
-	)
+	void IOManager::ReadAheadInThreadpool(FileHandle& fileHandle, FileContext& fileContext, const EvtReadFile& eventInfo) const noexcept
 	{
-		FileContext& fileContext = *reinterpret_cast<FileContext*>(context);
-		AsyncIOContext& asyncContext = *reinterpret_cast<AsyncIOContext*>(overlapped);
-		IFileSystem& fileSystemInstance = fileContext.GetFileSystem();
+		// Other handles are only valid for the duration of the request
+		if (&fileHandle != &fileContext.GetHandle())
+		{
+			return;
+		}
 
-		switch (asyncContext.GetOperationType())
+		if (const ReadAheadState::Range range = GetReadAheadRange(fileContext, eventInfo))
 		{
-			case AsyncIOContext::OperationType::Read:
+			// Counted as async IO, so the context isn't closed and reused until the work item is done
+			if (!fileContext.BeginAsyncIO())
 			{
-				EvtReadFile& readFileEvent = *asyncContext.GetOperationContext<EvtReadFile>();
-				readFileEvent.NumberOfBytesRead = static_cast<DWORD>(bytesTransferred);
-				fileSystemInstance.OnFileRead(readFileEvent, fileContext);
-
-				Dokany2::DokanEndDispatchRead(&readFileEvent, Dokany2::DokanNtStatusFromWin32(resultIO));
-				break;
+				fileContext.GetReadAhead().OnCompleted(0);
 			}
-			case AsyncIOContext::OperationType::Write:
+			else if (!::TrySubmitThreadpoolCallback(OnReadAheadWork, &fileContext, nullptr))
 			{
-				EvtWriteFile& writeFileEvent = *asyncContext.GetOperationContext<EvtWriteFile>();
-				writeFileEvent.NumberOfBytesWritten = static_cast<DWORD>(bytesTransferred);
-				fileSystemInstance.OnFileWritten(writeFileEvent, fileContext);
-
-				Dokany2::DokanEndDispatchWrite(&writeFileEvent, Dokany2::DokanNtStatusFromWin32(resultIO));
-				break;
+				fileContext.GetReadAhead().OnCompleted(0);
+				fileContext.EndAsyncIO();
 			}
-			default:
+		}
+	}
+	void IOManager::ReadAheadAsync(FileContext& fileContext, const EvtReadFile& eventInfo) noexcept
+	{
+		if (const ReadAheadState::Range range = GetReadAheadRange(fileContext, eventInfo))
+		{
+			ReadAheadState& readAhead = fileContext.GetReadAhead();
+
+			void* buffer = readAhead.AllocateBuffer();
+			if (!buffer || ReadAsync(fileContext, buffer, range.Size, range.Offset, readAhead, OnReadAheadCompleted) != NtStatus::Pending)
 			{
-				KxVFS_Log(LogLevel::Info, L"Unknown operation type in async IO callback: %1", asyncContext.GetOperationType());
-				break;
+				readAhead.OnCompleted(0);
 			}
-		};
+		}
+	}
 
-		fileSystemInstance.GetIOManager().PushContext(asyncContext);
+	bool IOManager::CanWriteBehind(const FileContext& fileContext, const FileHandle& fileHandle, const EvtWriteFile& eventInfo) const noexcept
+	{
+		// Paging IO has its own rules about the file size and a cleaned up file is written through a different handle.
+		// Cached files must be invalidated when the data is on the disk, so they're written directly.
+		return m_WriteBehindCapacity != 0 && !m_IsAsyncIOEnabled && &fileHandle == &fileContext.GetHandle() && !fileContext.IsCleanedUp() &&
+			!eventInfo.DokanFileInfo->PagingIo && !fileContext.GetWriterKey().IsValid();
 	}
 
-	void IOManager::OnDeleteFileContext(FileContext& fileContext) noexcept
+	void IOManager::OnFileReadAsync(AsyncIOContext& asyncContext, DWORD errorCode, size_t bytesTransferred)
+	{
+		FileContext& fileContext = asyncContext.GetFileContext();
+		EvtReadFile& eventInfo = *asyncContext.GetOperationContext<EvtReadFile>();
+
+		eventInfo.NumberOfBytesRead = static_cast<DWORD>(bytesTransferred);
+		if (errorCode == ERROR_SUCCESS)
+		{
+			fileContext.GetFileSystem().GetIOManager().AddToCache(fileContext, eventInfo.Offset, eventInfo.Buffer, eventInfo.NumberOfBytesRead, asyncContext.m_CacheGeneration);
+		}
+		fileContext.GetFileSystem().OnFileRead(eventInfo, fileContext);
+
+		Dokany2::DokanEndDispatchRead(&eventInfo, Dokany2::DokanNtStatusFromWin32(errorCode));
+	}
+	void IOManager::OnFileWrittenAsync(AsyncIOContext& asyncContext, DWORD errorCode, size_t bytesTransferred)
+	{
+		FileContext& fileContext = asyncContext.GetFileContext();
+		EvtWriteFile& eventInfo = *asyncContext.GetOperationContext<EvtWriteFile>();
+
+		eventInfo.NumberOfBytesWritten = static_cast<DWORD>(bytesTransferred);
+		fileContext.GetFileSystem().OnFileWritten(eventInfo, fileContext);
+
+		Dokany2::DokanEndDispatchWrite(&eventInfo, Dokany2::DokanNtStatusFromWin32(errorCode));
+	}
+	void IOManager::OnReadAheadCompleted(AsyncIOContext& asyncContext, DWORD errorCode, size_t bytesTransferred)
+	{
+		FileContext& fileContext = asyncContext.GetFileContext();
+		ReadAheadState& readAhead = *asyncContext.GetOperationContext<ReadAheadState>();
+
+		const size_t bytesRead = errorCode == ERROR_SUCCESS ? bytesTransferred : 0;
+		if (bytesRead != 0)
+		{
+			fileContext.GetFileSystem().GetIOManager().AddToCache(fileContext, asyncContext.GetOperationOffset(), readAhead.GetBuffer(), bytesRead, asyncContext.m_CacheGeneration);
+		}
+		readAhead.OnCompleted(bytesRead);
+	}
+	void CALLBACK IOManager::OnReadAheadWork(PTP_CALLBACK_INSTANCE instance, void* context)
 	{
-		if (m_IsAsyncIOEnabled && fileContext.IsThreadpoolIOCreated())
+		FileContext& fileContext = *static_cast<FileContext*>(context);
+		ReadAheadState& readAhead = fileContext.GetReadAhead();
+		const ReadAheadState::Range range = readAhead.GetPending();
+
+		// Cleanup closes the handle under the exclusive lock and close waits for this work item while holding it,
+		// so the read is skipped instead of waiting for the lock.
+		DWORD bytesRead = 0;
+		bool isLocked = false;
+		if (auto lock = fileContext.TryLockShared(isLocked); isLocked && !fileContext.IsCleanedUp() && fileContext.GetHandle())
 		{
-			if (CriticalSectionLocker lock(m_ThreadPoolCS); m_ThreadPoolCleanupGroup && fileContext.IsThreadpoolIOCreated())
+			IOManager& ioManager = fileContext.GetFileSystem().GetIOManager();
+
+			void* buffer = readAhead.AllocateBuffer();
+			const uint64_t generation = ioManager.m_BlockCache.GetGeneration();
+			if (buffer && fileContext.GetHandle().ReadAt(range.Offset, buffer, range.Size, bytesRead))
 			{
-				fileContext.CloseThreadpoolIO();
+				ioManager.AddToCache(fileContext, range.Offset, buffer, bytesRead, generation);
 			}
 		}
+		readAhead.OnCompleted(bytesRead);
+		fileContext.EndAsyncIO();
+	}
+	NtStatus IOManager::StartAsyncIO(FileContext& fileContext,
+									 AsyncIOContext::OperationType type,
+									 void* buffer,
+									 DWORD size,
+									 int64_t offset,
+									 void* operationContext,
+									 AsyncIOContext::TCompletion onCompleted
+	) noexcept
+	{
+		AsyncIOContext* asyncContext = PopContext(fileContext);
+		if (!asyncContext)
+		{
+			return NtStatus::MemoryNotAllocated;
+		}
+		asyncContext->SetOperation(operationContext, offset, type, onCompleted, buffer, size);
+		asyncContext->m_CacheGeneration = m_BlockCache.GetGeneration();
+
+		if (!fileContext.BeginAsyncIO())
+		{
+			PushContext(*asyncContext);
+			return NtStatus::FileClosed;
+		}
+		if (!m_Backend->Submit(*asyncContext))
+		{
+			const DWORD errorCode = ::GetLastError();
+			fileContext.EndAsyncIO();
+			PushContext(*asyncContext);
+			return IFileSystem::GetNtStatusByWin32ErrorCode(errorCode);
+		}
+		return NtStatus::Pending;
+	}
+
+	void IOManager::OnDeleteFileContext(FileContext& fileContext) noexcept
+	{
+		DetachBlockCache(fileContext);
+		if (m_IsAsyncIOEnabled && m_Backend)
+		{
+			m_Backend->OnCloseFile(fileContext);
+		}
 	}
 	void IOManager::OnPushFileContext(FileContext& fileContext) noexcept
 	{
-		if (m_IsAsyncIOEnabled && fileContext.IsThreadpoolIOCreated())
+		DetachBlockCache(fileContext);
+		if (m_IsAsyncIOEnabled && m_Backend)
 		{
-			if (CriticalSectionLocker lock(m_ThreadPoolCS); m_ThreadPoolCleanupGroup)
-			{
-				fileContext.CloseThreadpoolIO();
-			}
+			m_Backend->OnCloseFile(fileContext);
 		}
 	}
 	bool IOManager::OnPopFileContext(FileContext& fileContext)
 	{
 		if (m_IsAsyncIOEnabled)
 		{
-			bool success = false;
-			if (CriticalSectionLocker lock(m_ThreadPoolCS); m_ThreadPoolCleanupGroup)
-			{
-				success = fileContext.CreateThreadpoolIO(AsyncCallback, m_ThreadPoolEnvironment);
-			}
-
-			if (!success)
+			if (!m_Backend || !m_Backend->OnOpenFile(fileContext))
 			{
 				m_FileContextManager.PushContext(fileContext);
 				return false;
@@ -157,7 +257,11 @@ namespace KxVFS
 	}
 
 	IOManager::IOManager(IFileSystem& fileSystem) noexcept
-		:m_FileSystem(fileSystem), m_FileContextManager(fileSystem.GetFileContextManager())
+		:m_FileSystem(fileSystem), m_FileContextManager(fileSystem.GetFileContextManager()),
+		m_AsyncContextPool([this](AsyncIOContext* asyncContext)
+		{
+			DeleteContext(asyncContext);
+		})
 	{
 	}
 
@@ -183,21 +287,11 @@ namespace KxVFS
 	}
 	void IOManager::PushContext(AsyncIOContext& asyncContext)
 	{
-		if (CriticalSectionLocker lock(m_AsyncContextPoolCS); true)
-		{
-			m_AsyncContextPool.push_back(&asyncContext);
-			m_AsyncContextPoolMaxSize = std::max(m_AsyncContextPoolMaxSize, m_AsyncContextPool.size());
-		}
+		m_AsyncContextPool.Push(asyncContext);
 	}
 	AsyncIOContext* IOManager::PopContext(FileContext& fileContext) noexcept
 	{
-		AsyncIOContext* asyncContext = nullptr;
-		if (CriticalSectionLocker lock(m_AsyncContextPoolCS); !m_AsyncContextPool.empty())
-		{
-			asyncContext = m_AsyncContextPool.back();
-			m_AsyncContextPool.pop_back();
-		}
-
+		AsyncIOContext* asyncContext = m_AsyncContextPool.Pop();
 		if (!asyncContext)
 		{
 			asyncContext = new(std::nothrow) AsyncIOContext(fileContext);
@@ -212,20 +306,39 @@ namespace KxVFS
 		}
 		return asyncContext;
 	}
+	void IOManager::OnAsyncIOCompleted(AsyncIOContext& asyncContext, DWORD errorCode, size_t bytesTransferred)
+	{
+		FileContext& fileContext = asyncContext.GetFileContext();
+		asyncContext.Complete(errorCode, bytesTransferred);
+
+		fileContext.EndAsyncIO();
+		PushContext(asyncContext);
+	}
 
 	NtStatus IOManager::ReadFileSync(FileHandle& fileHandle, EvtReadFile& eventInfo, FileContext* fileContext) const noexcept
 	{
 		KxVFS_Log(LogLevel::Info, L"%1: %2", __FUNCTIONW__, fileHandle.GetPath());
 
-		if (!fileHandle.Seek(eventInfo.Offset, FileSeekMode::Start))
+		if (fileContext)
 		{
-			return IFileSystem::GetNtStatusByWin32LastErrorCode();
+			if (NtStatus status = FlushWriteBuffer(*fileContext); status != NtStatus::Success)
+			{
+				return status;
+			}
 		}
-		if (fileHandle.Read(eventInfo.Buffer, eventInfo.NumberOfBytesToRead, eventInfo.NumberOfBytesRead))
+		if (fileContext && ReadFromCache(*fileContext, eventInfo))
+		{
+			ReadAheadInThreadpool(fileHandle, *fileContext, eventInfo);
+			return NtStatus::Success;
+		}
+		const uint64_t generation = m_BlockCache.GetGeneration();
+		if (fileHandle.ReadAt(eventInfo.Offset, eventInfo.Buffer, eventInfo.NumberOfBytesToRead, eventInfo.NumberOfBytesRead))
 		{
 			if (fileContext)
 			{
+				AddToCache(*fileContext, eventInfo.Offset, eventInfo.Buffer, eventInfo.NumberOfBytesRead, generation);
 				m_FileSystem.OnFileRead(eventInfo, *fileContext);
+				ReadAheadInThreadpool(fileHandle, *fileContext, eventInfo);
 			}
 			return NtStatus::Success;
 		}
@@ -235,24 +348,42 @@ namespace KxVFS
 	{
 		KxVFS_Log(LogLevel::Info, L"%1: %2", __FUNCTIONW__, fileHandle.GetPath());
 
-		if (eventInfo.DokanFileInfo->WriteToEndOfFile)
+		if (fileContext && CanWriteBehind(*fileContext, fileHandle, eventInfo))
 		{
-			if (!fileHandle.Seek(0, FileSeekMode::End))
+			bool isBuffered = false;
+			const int64_t offset = eventInfo.DokanFileInfo->WriteToEndOfFile ? -1 : eventInfo.Offset;
+			if (!fileContext->GetWriteBuffer().Write(fileHandle, offset, eventInfo.Buffer, eventInfo.NumberOfBytesToWrite, m_WriteBehindCapacity, m_WriteBehindDelay, isBuffered))
 			{
 				return IFileSystem::GetNtStatusByWin32LastErrorCode();
 			}
+			if (isBuffered)
+			{
+				eventInfo.NumberOfBytesWritten = eventInfo.NumberOfBytesToWrite;
+				m_FileSystem.OnFileWritten(eventInfo, *fileContext);
+				return NtStatus::Success;
+			}
 		}
-		else
+		else if (fileContext)
 		{
-			int64_t fileSize = 0;
-			if (!fileHandle.GetFileSize(fileSize))
+			if (NtStatus status = FlushWriteBuffer(*fileContext); status != NtStatus::Success)
 			{
-				return IFileSystem::GetNtStatusByWin32LastErrorCode();
+				return status;
 			}
+		}
+
+		int64_t offset = FileHandle::EndOfFile;
+		if (!eventInfo.DokanFileInfo->WriteToEndOfFile)
+		{
+			offset = eventInfo.Offset;
 
 			// Paging IO can not write after allocated file size
 			if (eventInfo.DokanFileInfo->PagingIo)
 			{
+				int64_t fileSize = 0;
+				if (!fileHandle.GetFileSize(fileSize))
+				{
+					return IFileSystem::GetNtStatusByWin32LastErrorCode();
+				}
 				if (eventInfo.Offset >= fileSize)
 				{
 					eventInfo.NumberOfBytesWritten = 0;
@@ -275,22 +406,14 @@ namespace KxVFS
 				}
 			}
 
-			if (eventInfo.Offset > fileSize)
-			{
-				// In the mirror sample helperZeroFileData is not necessary. NTFS will zero a hole.
-				// But if user's file system is different from NTFS (or other Windows
-				// file systems) then  users will have to zero the hole themselves.
-
-				// If only Dokany devs can explain more clearly what they are talking about
-			}
+			// Writing past the end of the file: in the mirror sample helperZeroFileData is not necessary. NTFS will zero a hole.
+			// But if user's file system is different from NTFS (or other Windows
+			// file systems) then  users will have to zero the hole themselves.
 
-			if (!fileHandle.Seek(eventInfo.Offset, FileSeekMode::Start))
-			{
-				return IFileSystem::GetNtStatusByWin32LastErrorCode();
-			}
+			// If only Dokany devs can explain more clearly what they are talking about
 		}
 
-		if (fileHandle.Write(eventInfo.Buffer, eventInfo.NumberOfBytesToWrite, eventInfo.NumberOfBytesWritten))
+		if (fileHandle.WriteAt(offset, eventInfo.Buffer, eventInfo.NumberOfBytesToWrite, eventInfo.NumberOfBytesWritten))
 		{
 			if (fileContext)
 			{
@@ -301,28 +424,70 @@ namespace KxVFS
 		return IFileSystem::GetNtStatusByWin32LastErrorCode();
 	}
 
-	NtStatus IOManager::ReadFileAsync(FileContext& fileContext, EvtReadFile& eventInfo) noexcept
+	void IOManager::AttachBlockCache(FileContext& fileContext, bool isWritten) noexcept
 	{
-		KxVFS_Log(LogLevel::Info, L"%1: %2", __FUNCTIONW__, fileContext.GetHandle().GetPath());
+		const BlockCache::FileKey key = BlockCache::GetFileKey(fileContext.GetHandle());
+		if (key.IsValid())
+		{
+			if (isWritten)
+			{
+				fileContext.SetWriterKey(key);
+				return;
+			}
 
-		AsyncIOContext* asyncContext = PopContext(fileContext);
-		if (!asyncContext)
+			try
+			{
+				m_BlockCache.AddReader(key);
+				fileContext.SetCacheKey(key);
+			}
+			catch (const std::bad_alloc&)
+			{
+				// Read from the disk then
+			}
+		}
+	}
+	void IOManager::InvalidateBlockCache(FileContext& fileContext) noexcept
+	{
+		if (const BlockCache::FileKey& key = fileContext.GetWriterKey(); key.IsValid())
 		{
-			return NtStatus::MemoryNotAllocated;
+			m_BlockCache.Invalidate(key);
 		}
-		asyncContext->SetOperationContext(eventInfo, eventInfo.Offset, AsyncIOContext::OperationType::Read);
+	}
 
-		fileContext.StartThreadpoolIO();
-		if (!fileContext.GetHandle().Read(eventInfo.Buffer, eventInfo.NumberOfBytesToRead, eventInfo.NumberOfBytesRead, &asyncContext->GetOverlapped()))
+	NtStatus IOManager::FlushWriteBuffer(FileContext& fileContext) const noexcept
+	{
+		WriteBehindBuffer& writeBuffer = fileContext.GetWriteBuffer();
+		if (writeBuffer.IsDirty() && !writeBuffer.Flush(fileContext.GetHandle()))
 		{
 			const DWORD errorCode = ::GetLastError();
-			if (errorCode != ERROR_IO_PENDING)
-			{
-				fileContext.CancelThreadpoolIO();
-				return IFileSystem::GetNtStatusByWin32ErrorCode(errorCode);
-			}
+			KxVFS_Log(LogLevel::Error, L"Couldn't write buffered data to '%1' (%2)", fileContext.GetHandle().GetPath(), errorCode);
+			return IFileSystem::GetNtStatusByWin32ErrorCode(errorCode);
 		}
-		return NtStatus::Pending;
+		return NtStatus::Success;
+	}
+	NtStatus IOManager::CloseWriteBuffer(FileContext& fileContext) const noexcept
+	{
+		const NtStatus status = FlushWriteBuffer(fileContext);
+		if (status != NtStatus::Success)
+		{
+			KxVFS_Log(LogLevel::Error, L"Buffered data of '%1' is discarded", fileContext.GetHandle().GetPath());
+		}
+		fileContext.GetWriteBuffer().Reset();
+		return status;
+	}
+
+	NtStatus IOManager::ReadFileAsync(FileContext& fileContext, EvtReadFile& eventInfo) noexcept
+	{
+		KxVFS_Log(LogLevel::Info, L"%1: %2", __FUNCTIONW__, fileContext.GetHandle().GetPath());
+
+		// Read-ahead goes first, the request itself may complete and the file may be closed before 'ReadAsync' returns.
+		// Cached blocks are copied right away, there's nothing to wait for.
+		ReadAheadAsync(fileContext, eventInfo);
+		if (ReadFromCache(fileContext, eventInfo))
+		{
+			return NtStatus::Success;
+		}
+		return ReadAsync(fileContext, eventInfo.Buffer, eventInfo.NumberOfBytesToRead, eventInfo.Offset, eventInfo, OnFileReadAsync);
 	}
 	NtStatus IOManager::WriteFileAsync(FileContext& fileContext, EvtWriteFile& eventInfo) noexcept
 	{
@@ -359,23 +524,6 @@ namespace KxVFS
 			}
 		}
 
-		AsyncIOContext* asyncContext = PopContext(fileContext);
-		if (!asyncContext)
-		{
-			return NtStatus::MemoryNotAllocated;
-		}
-		asyncContext->SetOperationContext(eventInfo, eventInfo.Offset, AsyncIOContext::OperationType::Write);
-
-		fileContext.StartThreadpoolIO();
-		if (!fileHandle.Write(eventInfo.Buffer, eventInfo.NumberOfBytesToWrite, eventInfo.NumberOfBytesWritten, &asyncContext->GetOverlapped()))
-		{
-			const DWORD errorCode = ::GetLastError();
-			if (errorCode != ERROR_IO_PENDING)
-			{
-				fileContext.CancelThreadpoolIO();
-				return IFileSystem::GetNtStatusByWin32ErrorCode(errorCode);
-			}
-		}
-		return NtStatus::Pending;
+		return WriteAsync(fileContext, eventInfo.Buffer, eventInfo.NumberOfBytesToWrite, eventInfo.Offset, eventInfo, OnFileWrittenAsync);
 	}
 }
@@ -1,6 +1,9 @@
 #pragma once
 #include "KxVFS/Common.hpp"
 #include "KxVFS/Common/AsyncIOContext.h"
+#include "KxVFS/Common/IAsyncIOBackend.h"
+#include "KxVFS/Common/BlockCache.h"
+#include <chrono>
 
 namespace KxVFS
 {
@@ -18,32 +21,46 @@ namespace KxVFS
 			IFileSystem& m_FileSystem;
 			FileContextManager& m_FileContextManager;
 			bool m_IsAsyncIOEnabled = false;
+			bool m_IsReadAheadEnabled = true;
+			size_t m_WriteBehindCapacity = 0;
+			uint64_t m_WriteBehindDelay = 0;
 			bool m_IsInitialized = false;
 
-			TP_CALLBACK_ENVIRON m_ThreadPoolEnvironment = {0};
-			PTP_CLEANUP_GROUP m_ThreadPoolCleanupGroup = nullptr;
-			PTP_POOL m_ThreadPool = nullptr;
-			CriticalSection m_ThreadPoolCS;
+			ObjectPool<AsyncIOContext> m_AsyncContextPool;
+			size_t m_AsyncContextPoolInitialSize = 128;
+			mutable BlockCache m_BlockCache;
 
-			std::vector<AsyncIOContext*> m_AsyncContextPool;
-			CriticalSection m_AsyncContextPoolCS;
-			size_t m_AsyncContextPoolMaxSize = 0;
+			// Destroyed before the pool, so a backend can't return contexts into a destroyed one
+			std::unique_ptr<IAsyncIOBackend> m_Backend;
 
 		private:
 			bool InitializeAsyncIO();
-			bool InitializePendingAsyncIO() noexcept;
-
-			void CleanupPendingAsyncIO() noexcept;
 			void CleanupAsyncIO() noexcept;
 
 		private:
-			static void CALLBACK AsyncCallback(PTP_CALLBACK_INSTANCE instance,
-											   PVOID context,
-											   PVOID overlapped,
-											   ULONG resultIO,
-											   ULONG_PTR bytesTransferred,
-											   PTP_IO completionPort
-			);
+			static void OnFileReadAsync(AsyncIOContext& asyncContext, DWORD errorCode, size_t bytesTransferred);
+			static void OnFileWrittenAsync(AsyncIOContext& asyncContext, DWORD errorCode, size_t bytesTransferred);
+			static void OnReadAheadCompleted(AsyncIOContext& asyncContext, DWORD errorCode, size_t bytesTransferred);
+			static void CALLBACK OnReadAheadWork(PTP_CALLBACK_INSTANCE instance, void* context);
+
+			bool ReadFromCache(FileContext& fileContext, EvtReadFile& eventInfo) const noexcept;
+			void AddToCache(const FileContext& fileContext, int64_t offset, const void* buffer, size_t size, uint64_t generation) const noexcept;
+			void DetachBlockCache(FileContext& fileContext) noexcept;
+
+			ReadAheadState::Range GetReadAheadRange(FileContext& fileContext, const EvtReadFile& eventInfo) const noexcept;
+			void ReadAheadInThreadpool(FileHandle& fileHandle, FileContext& fileContext, const EvtReadFile& eventInfo) const noexcept;
+			void ReadAheadAsync(FileContext& fileContext, const EvtReadFile& eventInfo) noexcept;
+
+			bool CanWriteBehind(const FileContext& fileContext, const FileHandle& fileHandle, const EvtWriteFile& eventInfo) const noexcept;
+
+			NtStatus StartAsyncIO(FileContext& fileContext,
+								  AsyncIOContext::OperationType type,
+								  void* buffer,
+								  DWORD size,
+								  int64_t offset,
+								  void* operationContext,
+								  AsyncIOContext::TCompletion onCompleted
+			) noexcept;
 
 			void OnDeleteFileContext(FileContext& fileContext) noexcept;
 			void OnPushFileContext(FileContext& fileContext) noexcept;
@@ -74,17 +91,100 @@ namespace KxVFS
 			{
 				m_IsAsyncIOEnabled = enabled;
 			}
+
+			// Takes effect on the next 'Init', 'ThreadpoolIOBackend' is used if there's none
+			void SetBackend(std::unique_ptr<IAsyncIOBackend> backend) noexcept
+			{
+				m_Backend = std::move(backend);
+			}
+			IAsyncIOBackend* GetBackend() const noexcept
+			{
+				return m_Backend.get();
+			}
+
+			// Number of contexts created at 'Init' and number of unused contexts above which they're destroyed
+			void SetPoolSize(size_t initialSize, size_t highWaterMark) noexcept
+			{
+				m_AsyncContextPoolInitialSize = initialSize;
+				m_AsyncContextPool.SetHighWaterMark(highWaterMark);
+			}
+			BasicObjectPool::Statistics GetPoolStatistics() const noexcept
+			{
+				return m_AsyncContextPool.GetStatistics();
+			}
+
+			// Sequential reads are read ahead into the block cache, so it works only for files which can be cached.
+			// It's never done on the thread serving the request, synchronous IO reads ahead in a thread pool work item.
+			// File contexts are locked then even if requests are dispatched by a single thread.
+			bool IsReadAheadEnabled() const noexcept
+			{
+				return m_IsReadAheadEnabled;
+			}
+			void EnableReadAhead(bool enabled = true) noexcept
+			{
+				m_IsReadAheadEnabled = enabled;
+			}
+
+			// Buffers writes smaller than 'capacity' per file and writes them out when the buffer is full or the oldest one is older than 'maxDelay'.
+			// Only used for synchronous IO, zero capacity disables it. Anything else done to the file must call 'FlushWriteBuffer' first.
+			bool IsWriteBehindEnabled() const noexcept
+			{
+				return m_WriteBehindCapacity != 0;
+			}
+			void SetWriteBehind(size_t capacity, std::chrono::milliseconds maxDelay) noexcept
+			{
+				m_WriteBehindCapacity = capacity;
+				m_WriteBehindDelay = static_cast<uint64_t>(maxDelay.count());
+			}
+
+			// Used for files which have a cache key, disabled until it's given a capacity
+			BlockCache& GetBlockCache() noexcept
+			{
+				return m_BlockCache;
+			}
+			const BlockCache& GetBlockCache() const noexcept
+			{
+				return m_BlockCache;
+			}
+
+			// Files opened for reading are read through the block cache, files opened for writing drop their cached blocks
+			// on 'InvalidateBlockCache' which the file system must call after each change of the file.
+			void AttachBlockCache(FileContext& fileContext, bool isWritten) noexcept;
+			void InvalidateBlockCache(FileContext& fileContext) noexcept;
 	
 		public:
 			void DeleteContext(AsyncIOContext* asyncContext) noexcept;
 			void PushContext(AsyncIOContext& asyncContext);
 			AsyncIOContext* PopContext(FileContext& fileContext) noexcept;
 
+			// Called by the backend when a submitted operation is done
+			void OnAsyncIOCompleted(AsyncIOContext& asyncContext, DWORD errorCode, size_t bytesTransferred);
+
 		public:
 			NtStatus ReadFileSync(FileHandle& fileHandle, EvtReadFile& eventInfo, FileContext* fileContext = nullptr) const noexcept;
 			NtStatus WriteFileSync(FileHandle& fileHandle, EvtWriteFile& eventInfo, FileContext* fileContext = nullptr) const noexcept;
 
 			NtStatus ReadFileAsync(FileContext& fileContext, EvtReadFile& eventInfo) noexcept;
+			NtStatus FlushWriteBuffer(FileContext& fileContext) const noexcept;
+
+			// Must be called before the file's handle is closed. Flushes the buffer and then discards it along with anything
+			// that couldn't be written, so the timer never writes through a closed handle. Returns the flush result.
+			NtStatus CloseWriteBuffer(FileContext& fileContext) const noexcept;
 			NtStatus WriteFileAsync(FileContext& fileContext, EvtWriteFile& eventInfo) noexcept;
+
+			// Overlapped read or write on the file's handle which continues in 'onCompleted' on the thread pool instead of blocking.
+			// Returns 'NtStatus::Pending' if the operation is started, otherwise 'onCompleted' is never called and the error is returned.
+			// Completion can start the next operation on the same file, the file stays open until the last one in the chain is done.
+			template<class T>
+			NtStatus ReadAsync(FileContext& fileContext, void* buffer, DWORD size, int64_t offset, T& operationContext, AsyncIOContext::TCompletion onCompleted) noexcept
+			{
+				return StartAsyncIO(fileContext, AsyncIOContext::OperationType::Read, buffer, size, offset, &operationContext, onCompleted);
+			}
+
+			template<class T>
+			NtStatus WriteAsync(FileContext& fileContext, const void* buffer, DWORD size, int64_t offset, T& operationContext, AsyncIOContext::TCompletion onCompleted) noexcept
+			{
+				return StartAsyncIO(fileContext, AsyncIOContext::OperationType::Write, const_cast<void*>(buffer), size, offset, &operationContext, onCompleted);
+			}
 	};
 }
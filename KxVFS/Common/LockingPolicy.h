@@ -0,0 +1,19 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+
+namespace KxVFS
+{
+	// Which locks a mounted file system instance takes, chosen from its flags when it's mounted.
+	// Compile-time 'Setup::DisableLocks' still removes all locks regardless of the policy.
+	enum class LockingPolicy: uint32_t
+	{
+		// Everything shared between request threads is locked
+		Full = 0,
+
+		// Virtual tree isn't changed while mounted, so tree nodes aren't locked. File contexts still are.
+		ImmutableTree,
+
+		// Requests are dispatched by a single thread and nothing runs on thread pool threads (async IO, read-ahead, write-behind), nothing is locked
+		SingleThreaded
+	};
+}
@@ -0,0 +1,129 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Utility.h"
+
+namespace KxVFS
+{
+	// Access pattern of a single open file. Reads which continue where the previous ones ended are treated as a sequential stream
+	// and for it the data ahead of the reader is requested in growing windows, one window at a time. Next window is started once
+	// the reader gets into the second half of the already requested data, so it's usually ready before it's needed.
+	// Any read elsewhere resets the window, so random access doesn't cause any extra reads.
+	class KxVFS_API ReadAheadState final
+	{
+		public:
+			static constexpr int64_t InitialWindow = 128 * 1024;
+			static constexpr int64_t MaxWindow = 4 * 1024 * 1024;
+
+			struct Range
+			{
+				int64_t Offset = 0;
+				DWORD Size = 0;
+
+				explicit operator bool() const noexcept
+				{
+					return Size != 0;
+				}
+			};
+
+		private:
+			SRWLock m_Lock;
+			int64_t m_NextOffset = 0;
+			int64_t m_ReadAheadEnd = 0;
+			int64_t m_Window = 0;
+			Range m_Pending;
+			std::vector<uint8_t> m_Buffer;
+
+		public:
+			ReadAheadState() noexcept = default;
+			ReadAheadState(const ReadAheadState&) = delete;
+
+		public:
+			// Records a read and returns the range to read ahead, if there's any. Range is aligned to 'alignment' and limited by 'fileSize',
+			// the caller must read it into 'AllocateBuffer' and then call 'OnCompleted'. No other range is returned until then.
+			Range OnRead(int64_t offset, DWORD size, int64_t fileSize, int64_t alignment) noexcept
+			{
+				ExclusiveSRWLocker lock(m_Lock);
+
+				// Concurrent reads of the same stream can come slightly out of order
+				const bool isSequential = offset == m_NextOffset || (m_Window != 0 && offset > m_NextOffset - m_Window && offset < m_ReadAheadEnd);
+				if (!isSequential)
+				{
+					m_NextOffset = offset + size;
+					m_ReadAheadEnd = 0;
+					m_Window = 0;
+					return {};
+				}
+
+				m_NextOffset = std::max(m_NextOffset, offset + static_cast<int64_t>(size));
+				if (m_Window == 0)
+				{
+					m_Window = InitialWindow;
+				}
+				if (m_Pending || m_ReadAheadEnd - m_NextOffset > m_Window / 2)
+				{
+					return {};
+				}
+
+				const int64_t start = std::max(m_ReadAheadEnd, m_NextOffset) / alignment * alignment;
+				const int64_t end = std::min(start + m_Window, fileSize);
+				if (end <= start)
+				{
+					return {};
+				}
+
+				m_ReadAheadEnd = end;
+				m_Window = std::min(m_Window * 2, MaxWindow);
+				m_Pending = {start, static_cast<DWORD>(end - start)};
+				return m_Pending;
+			}
+
+			// Buffer for the pending range, null if it can't be allocated
+			void* AllocateBuffer() noexcept
+			{
+				try
+				{
+					m_Buffer.resize(m_Pending.Size);
+					return m_Buffer.data();
+				}
+				catch (const std::bad_alloc&)
+				{
+					return nullptr;
+				}
+			}
+			Range GetPending() noexcept
+			{
+				SharedSRWLocker lock(m_Lock);
+				return m_Pending;
+			}
+			const void* GetBuffer() const noexcept
+			{
+				return m_Buffer.data();
+			}
+
+			void OnCompleted(size_t bytesRead) noexcept
+			{
+				ExclusiveSRWLocker lock(m_Lock);
+
+				// Failed or short read starts the stream over instead of leaving a hole
+				if (bytesRead < m_Pending.Size)
+				{
+					m_ReadAheadEnd = 0;
+					m_Window = 0;
+				}
+				m_Pending = {};
+			}
+
+			// Only valid when nothing else uses the file, releases the buffer
+			void Reset() noexcept
+			{
+				m_NextOffset = 0;
+				m_ReadAheadEnd = 0;
+				m_Window = 0;
+				m_Pending = {};
+				m_Buffer = {};
+			}
+
+		public:
+			ReadAheadState& operator=(const ReadAheadState&) = delete;
+	};
+}
@@ -0,0 +1,93 @@
+#include "stdafx.h"
+#include "KxVFS/Misc/IncludeWindows.h"
+#include "KxVFS/IFileSystem.h"
+#include "KxVFS/Utility.h"
+#include "ThreadpoolIOBackend.h"
+#include "AsyncIOContext.h"
+#include "IOManager.h"
+
+namespace KxVFS
+{
+	void CALLBACK ThreadpoolIOBackend::AsyncCallback(PTP_CALLBACK_INSTANCE instance,
+													 PVOID context,
+													 PVOID overlapped,
+													 ULONG resultIO,
+													 ULONG_PTR bytesTransferred,
+													 PTP_IO completionPort
+	)
+	{
+		FileContext& fileContext = *reinterpret_cast<FileContext*>(context);
+		AsyncIOContext& asyncContext = *reinterpret_cast<AsyncIOContext*>(overlapped);
+
+		fileContext.GetFileSystem().GetIOManager().OnAsyncIOCompleted(asyncContext, resultIO, bytesTransferred);
+	}
+
+	bool ThreadpoolIOBackend::Init(IOManager& ioManager)
+	{
+		m_ThreadPool = Dokany2::DokanGetThreadPool();
+		if (!m_ThreadPool)
+		{
+			return false;
+		}
+
+		m_ThreadPoolCleanupGroup = ::CreateThreadpoolCleanupGroup();
+		if (!m_ThreadPoolCleanupGroup)
+		{
+			return false;
+		}
+
+		::InitializeThreadpoolEnvironment(&m_ThreadPoolEnvironment);
+		::SetThreadpoolCallbackPool(&m_ThreadPoolEnvironment, m_ThreadPool);
+		::SetThreadpoolCallbackCleanupGroup(&m_ThreadPoolEnvironment, m_ThreadPoolCleanupGroup, nullptr);
+		return true;
+	}
+	void ThreadpoolIOBackend::Cleanup() noexcept
+	{
+		if (CriticalSectionLocker lock(m_ThreadPoolCS); m_ThreadPoolCleanupGroup)
+		{
+			::CloseThreadpoolCleanupGroupMembers(m_ThreadPoolCleanupGroup, FALSE, nullptr);
+			::CloseThreadpoolCleanupGroup(m_ThreadPoolCleanupGroup);
+			m_ThreadPoolCleanupGroup = nullptr;
+
+			::DestroyThreadpoolEnvironment(&m_ThreadPoolEnvironment);
+		}
+	}
+
+	bool ThreadpoolIOBackend::OnOpenFile(FileContext& fileContext)
+	{
+		if (CriticalSectionLocker lock(m_ThreadPoolCS); m_ThreadPoolCleanupGroup)
+		{
+			return fileContext.CreateThreadpoolIO(AsyncCallback, m_ThreadPoolEnvironment);
+		}
+		return false;
+	}
+	void ThreadpoolIOBackend::OnCloseFile(FileContext& fileContext) noexcept
+	{
+		// 'PTP_IO' objects are closed along with the cleanup group otherwise
+		if (fileContext.IsThreadpoolIOCreated())
+		{
+			if (CriticalSectionLocker lock(m_ThreadPoolCS); m_ThreadPoolCleanupGroup && fileContext.IsThreadpoolIOCreated())
+			{
+				fileContext.CloseThreadpoolIO();
+			}
+		}
+	}
+
+	bool ThreadpoolIOBackend::Submit(AsyncIOContext& asyncContext) noexcept
+	{
+		PTP_IO threadpoolIO = asyncContext.GetFileContext().GetThreadpoolIO();
+
+		::StartThreadpoolIo(threadpoolIO);
+		if (!asyncContext.Issue())
+		{
+			const DWORD errorCode = ::GetLastError();
+			if (errorCode != ERROR_IO_PENDING)
+			{
+				::CancelThreadpoolIo(threadpoolIO);
+				::SetLastError(errorCode);
+				return false;
+			}
+		}
+		return true;
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Utility.h"
+#include "IAsyncIOBackend.h"
+
+namespace KxVFS
+{
+	// Default backend, completions are delivered to Dokany's thread pool through 'PTP_IO' objects bound to the file handles
+	class KxVFS_API ThreadpoolIOBackend final: public IAsyncIOBackend
+	{
+		private:
+			TP_CALLBACK_ENVIRON m_ThreadPoolEnvironment = {0};
+			PTP_CLEANUP_GROUP m_ThreadPoolCleanupGroup = nullptr;
+			PTP_POOL m_ThreadPool = nullptr;
+			CriticalSection m_ThreadPoolCS;
+
+		private:
+			static void CALLBACK AsyncCallback(PTP_CALLBACK_INSTANCE instance,
+											   PVOID context,
+											   PVOID overlapped,
+											   ULONG resultIO,
+											   ULONG_PTR bytesTransferred,
+											   PTP_IO completionPort
+			);
+
+		public:
+			ThreadpoolIOBackend() = default;
+			ThreadpoolIOBackend(const ThreadpoolIOBackend&) = delete;
+
+		public:
+			bool Init(IOManager& ioManager) override;
+			void Cleanup() noexcept override;
+
+			bool OnOpenFile(FileContext& fileContext) override;
+			void OnCloseFile(FileContext& fileContext) noexcept override;
+
+			bool Submit(AsyncIOContext& asyncContext) noexcept override;
+
+		public:
+			ThreadpoolIOBackend& operator=(const ThreadpoolIOBackend&) = delete;
+	};
+}
@@ -0,0 +1,126 @@
+#include "stdafx.h"
+#include "KxVFS/Misc/IncludeWindows.h"
+#include "KxVFS/Logger/ILogger.h"
+#include "KxVFS/IFileSystem.h"
+#include "KxVFS/Utility.h"
+#include "WorkerIOBackend.h"
+#include "AsyncIOContext.h"
+#include "IOManager.h"
+
+namespace KxVFS
+{
+	size_t WorkerIOBackend::TakeBatch(AsyncIOContext** batch)
+	{
+		std::unique_lock lock(m_QueueLock);
+		m_QueueCondition.wait(lock, [this]()
+		{
+			return m_IsStopping || !m_Queue.empty();
+		});
+
+		// Queue is drained before workers stop
+		size_t count = 0;
+		while (count < BatchSize && !m_Queue.empty())
+		{
+			batch[count++] = m_Queue.front();
+			m_Queue.pop_front();
+		}
+		return count;
+	}
+	void WorkerIOBackend::ProcessBatch(AsyncIOContext** batch, size_t count, const HANDLE* events) noexcept
+	{
+		DWORD errorCodes[BatchSize] = {};
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!batch[i]->Issue(events[i]))
+			{
+				errorCodes[i] = ::GetLastError();
+				if (errorCodes[i] == ERROR_IO_PENDING)
+				{
+					errorCodes[i] = ERROR_SUCCESS;
+				}
+			}
+		}
+
+		for (size_t i = 0; i < count; i++)
+		{
+			DWORD bytesTransferred = 0;
+			if (errorCodes[i] == ERROR_SUCCESS && !batch[i]->WaitResult(bytesTransferred))
+			{
+				errorCodes[i] = ::GetLastError();
+			}
+			m_IOManager->OnAsyncIOCompleted(*batch[i], errorCodes[i], bytesTransferred);
+		}
+	}
+	void WorkerIOBackend::WorkerThread() noexcept
+	{
+		HANDLE events[BatchSize] = {};
+		for (HANDLE& event: events)
+		{
+			event = ::CreateEventW(nullptr, TRUE, FALSE, nullptr);
+			if (!event)
+			{
+				KxVFS_Log(LogLevel::Fatal, L"%1: Unable to create event: %2", __FUNCTIONW__, ::GetLastError());
+			}
+		}
+
+		AsyncIOContext* batch[BatchSize] = {};
+		while (size_t count = TakeBatch(batch))
+		{
+			ProcessBatch(batch, count, events);
+		}
+
+		for (HANDLE event: events)
+		{
+			if (event)
+			{
+				::CloseHandle(event);
+			}
+		}
+	}
+
+	bool WorkerIOBackend::Init(IOManager& ioManager)
+	{
+		m_IOManager = &ioManager;
+		m_IsStopping = false;
+
+		const size_t threadCount = m_ThreadCount != 0 ? m_ThreadCount : Utility::GetHardwareThreadCount();
+		m_Threads.reserve(threadCount);
+		for (size_t i = 0; i < threadCount; i++)
+		{
+			m_Threads.emplace_back(&WorkerIOBackend::WorkerThread, this);
+		}
+		return true;
+	}
+	void WorkerIOBackend::Cleanup() noexcept
+	{
+		if (auto lock = std::lock_guard(m_QueueLock); true)
+		{
+			m_IsStopping = true;
+		}
+		m_QueueCondition.notify_all();
+
+		for (std::thread& thread: m_Threads)
+		{
+			thread.join();
+		}
+		m_Threads.clear();
+	}
+
+	bool WorkerIOBackend::Submit(AsyncIOContext& asyncContext) noexcept
+	{
+		try
+		{
+			if (auto lock = std::lock_guard(m_QueueLock); true)
+			{
+				m_Queue.push_back(&asyncContext);
+			}
+			m_QueueCondition.notify_one();
+			return true;
+		}
+		catch (const std::bad_alloc&)
+		{
+			::SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+			return false;
+		}
+	}
+}
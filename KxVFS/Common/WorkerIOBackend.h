@@ -0,0 +1,63 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Utility.h"
+#include "IAsyncIOBackend.h"
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+namespace KxVFS
+{
+	// Backend which doesn't depend on Dokany's thread pool. Submitted operations are queued and its own worker threads
+	// take them in batches of up to 'BatchSize'. The whole batch is issued before waiting for any of it, so the device
+	// gets several requests at once, and then completions are reaped in order.
+	class KxVFS_API WorkerIOBackend final: public IAsyncIOBackend
+	{
+		public:
+			static constexpr size_t BatchSize = 32;
+
+		private:
+			IOManager* m_IOManager = nullptr;
+			size_t m_ThreadCount = 0;
+			std::vector<std::thread> m_Threads;
+
+			std::mutex m_QueueLock;
+			std::condition_variable m_QueueCondition;
+			std::deque<AsyncIOContext*> m_Queue;
+			bool m_IsStopping = false;
+
+		private:
+			size_t TakeBatch(AsyncIOContext** batch);
+			void ProcessBatch(AsyncIOContext** batch, size_t count, const HANDLE* events) noexcept;
+			void WorkerThread() noexcept;
+
+		public:
+			// Zero means one thread per hardware thread
+			WorkerIOBackend(size_t threadCount = 0) noexcept
+				:m_ThreadCount(threadCount)
+			{
+			}
+			WorkerIOBackend(const WorkerIOBackend&) = delete;
+			~WorkerIOBackend()
+			{
+				Cleanup();
+			}
+
+		public:
+			bool Init(IOManager& ioManager) override;
+			void Cleanup() noexcept override;
+
+			bool OnOpenFile(FileContext& fileContext) override
+			{
+				return true;
+			}
+			void OnCloseFile(FileContext& fileContext) noexcept override
+			{
+			}
+
+			bool Submit(AsyncIOContext& asyncContext) noexcept override;
+
+		public:
+			WorkerIOBackend& operator=(const WorkerIOBackend&) = delete;
+	};
+}
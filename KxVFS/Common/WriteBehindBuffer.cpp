@@ -0,0 +1,175 @@
+#include "stdafx.h"
+#include "KxVFS/Utility.h"
+#include "WriteBehindBuffer.h"
+
+namespace KxVFS
+{
+	void CALLBACK WriteBehindBuffer::OnTimer(PTP_CALLBACK_INSTANCE instance, void* context, PTP_TIMER timer)
+	{
+		WriteBehindBuffer& buffer = *static_cast<WriteBehindBuffer*>(context);
+		ExclusiveSRWLocker lock(buffer.m_Lock);
+
+		// The buffer may have been written out since the timer was started. If it fails the data is kept for the next write or flush.
+		if (!buffer.m_Data.empty() && buffer.m_FileHandle)
+		{
+			buffer.WriteData(*buffer.m_FileHandle);
+		}
+	}
+	void WriteBehindBuffer::StartTimer(uint64_t delay) noexcept
+	{
+		if (!m_Timer)
+		{
+			m_Timer = ::CreateThreadpoolTimer(OnTimer, this, nullptr);
+		}
+		if (m_Timer)
+		{
+			// Negative due time is relative to now, in 100 nanosecond intervals
+			const int64_t dueTime = -static_cast<int64_t>(delay) * 10000;
+
+			FILETIME fileTime = {};
+			fileTime.dwLowDateTime = static_cast<DWORD>(dueTime);
+			fileTime.dwHighDateTime = static_cast<DWORD>(static_cast<uint64_t>(dueTime) >> 32);
+			::SetThreadpoolTimer(m_Timer, &fileTime, 0, 0);
+		}
+	}
+	void WriteBehindBuffer::CancelTimer() noexcept
+	{
+		// Must not be called with the lock held, the callback takes it
+		if (m_Timer)
+		{
+			::SetThreadpoolTimer(m_Timer, nullptr, 0, 0);
+			::WaitForThreadpoolTimerCallbacks(m_Timer, TRUE);
+		}
+	}
+
+	bool WriteBehindBuffer::WriteData(FileHandle& fileHandle) noexcept
+	{
+		size_t position = 0;
+		while (position < m_Data.size())
+		{
+			DWORD bytesWritten = 0;
+			const DWORD size = static_cast<DWORD>(m_Data.size() - position);
+			if (!fileHandle.WriteAt(m_Offset + static_cast<int64_t>(position), m_Data.data() + position, size, bytesWritten))
+			{
+				// Written part is dropped, so retrying writes only the rest
+				m_Data.erase(m_Data.begin(), m_Data.begin() + position);
+				m_Offset += static_cast<int64_t>(position);
+				return false;
+			}
+			position += bytesWritten;
+		}
+
+		m_Data.clear();
+		m_IsDirty.store(false, std::memory_order_release);
+		return true;
+	}
+
+	bool WriteBehindBuffer::Write(FileHandle& fileHandle, int64_t offset, const void* data, DWORD size, size_t capacity, uint64_t maxDelay, bool& isBuffered) noexcept
+	{
+		ExclusiveSRWLocker lock(m_Lock);
+		isBuffered = false;
+
+		if (!m_Data.empty())
+		{
+			if (offset < 0)
+			{
+				offset = std::max(m_FileSize, GetDataEnd());
+			}
+
+			const int64_t end = std::max(GetDataEnd(), offset + static_cast<int64_t>(size));
+			const bool isMergeable = size < capacity && offset >= m_Offset && offset <= GetDataEnd() && static_cast<size_t>(end - m_Offset) <= capacity;
+			if (!isMergeable && !WriteData(fileHandle))
+			{
+				return false;
+			}
+		}
+		if (size >= capacity)
+		{
+			return true;
+		}
+
+		if (m_Data.empty())
+		{
+			// File size is only needed for appends, but it's cheap to take once per buffered chunk
+			if (!fileHandle.GetFileSize(m_FileSize))
+			{
+				return false;
+			}
+			if (offset < 0)
+			{
+				offset = m_FileSize;
+			}
+			m_Offset = offset;
+			m_FirstWriteTime = ::GetTickCount64();
+			m_FileHandle = std::addressof(fileHandle);
+			StartTimer(maxDelay);
+		}
+
+		try
+		{
+			const size_t position = static_cast<size_t>(offset - m_Offset);
+			if (m_Data.capacity() < capacity)
+			{
+				m_Data.reserve(capacity);
+			}
+			if (m_Data.size() < position + size)
+			{
+				m_Data.resize(position + size);
+			}
+			std::memcpy(m_Data.data() + position, data, size);
+		}
+		catch (const std::bad_alloc&)
+		{
+			// Write it directly then
+			return WriteData(fileHandle);
+		}
+
+		isBuffered = true;
+		m_IsDirty.store(true, std::memory_order_release);
+		::GetSystemTimeAsFileTime(&m_LastWriteTime);
+
+		// Timer may be late or missing if it couldn't be created
+		if (m_Data.size() >= capacity || ::GetTickCount64() - m_FirstWriteTime >= maxDelay)
+		{
+			return WriteData(fileHandle);
+		}
+		return true;
+	}
+	bool WriteBehindBuffer::Flush(FileHandle& fileHandle) noexcept
+	{
+		ExclusiveSRWLocker lock(m_Lock);
+		return WriteData(fileHandle);
+	}
+	void WriteBehindBuffer::ApplyTo(BY_HANDLE_FILE_INFORMATION& fileInfo) noexcept
+	{
+		SharedSRWLocker lock(m_Lock);
+		if (!m_Data.empty())
+		{
+			const int64_t fileSize = std::max<int64_t>(GetDataEnd(), (static_cast<int64_t>(fileInfo.nFileSizeHigh) << 32)|fileInfo.nFileSizeLow);
+			fileInfo.nFileSizeHigh = static_cast<DWORD>(fileSize >> 32);
+			fileInfo.nFileSizeLow = static_cast<DWORD>(fileSize);
+			fileInfo.ftLastWriteTime = m_LastWriteTime;
+		}
+	}
+	void WriteBehindBuffer::Reset() noexcept
+	{
+		CancelTimer();
+
+		m_Data = {};
+		m_IsDirty = false;
+		m_Offset = 0;
+		m_FileSize = 0;
+		m_FirstWriteTime = 0;
+		m_LastWriteTime = {};
+		m_FileHandle = nullptr;
+	}
+
+	WriteBehindBuffer::~WriteBehindBuffer()
+	{
+		if (m_Timer)
+		{
+			CancelTimer();
+			::CloseThreadpoolTimer(m_Timer);
+		}
+	}
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Utility.h"
+
+namespace KxVFS
+{
+	// Write-behind buffer of a single open file. Small writes which continue or overlap the buffered range are merged in memory
+	// and written out as one chunk once the buffer is full, when the oldest buffered write is too old or when the owner asks for it.
+	// Age is checked by a thread pool timer started with the first buffered write, so data doesn't stay buffered if no more writes come.
+	// Buffered range is always contiguous, so a write anywhere else writes the buffer out first.
+	class KxVFS_API WriteBehindBuffer final
+	{
+		private:
+			SRWLock m_Lock;
+			std::vector<uint8_t> m_Data;
+			std::atomic<bool> m_IsDirty = false;
+			PTP_TIMER m_Timer = nullptr;
+			FileHandle* m_FileHandle = nullptr;
+
+			int64_t m_Offset = 0;
+			int64_t m_FileSize = 0;
+			uint64_t m_FirstWriteTime = 0;
+			FILETIME m_LastWriteTime = {};
+
+		private:
+			int64_t GetDataEnd() const noexcept
+			{
+				return m_Offset + static_cast<int64_t>(m_Data.size());
+			}
+			bool WriteData(FileHandle& fileHandle) noexcept;
+
+			static void CALLBACK OnTimer(PTP_CALLBACK_INSTANCE instance, void* context, PTP_TIMER timer);
+			void StartTimer(uint64_t delay) noexcept;
+			void CancelTimer() noexcept;
+
+		public:
+			WriteBehindBuffer() noexcept = default;
+			WriteBehindBuffer(const WriteBehindBuffer&) = delete;
+			~WriteBehindBuffer();
+
+		public:
+			bool IsDirty() const noexcept
+			{
+				return m_IsDirty.load(std::memory_order_acquire);
+			}
+
+			// Buffers 'size' bytes at 'offset', negative offset appends to the end of the file. Writes that don't fit into 'capacity'
+			// aren't buffered and the buffer is written out before returning, so the caller can write them directly.
+			// Buffered data is written out by the timer on its own after 'maxDelay' milliseconds, so the handle must stay open
+			// until the buffer is flushed. Returns false and sets last error if writing out the buffer has failed.
+			bool Write(FileHandle& fileHandle, int64_t offset, const void* data, DWORD size, size_t capacity, uint64_t maxDelay, bool& isBuffered) noexcept;
+
+			// Writes out buffered data, the data is kept if it fails
+			bool Flush(FileHandle& fileHandle) noexcept;
+
+			// Updates size and last write time read from the file to include buffered data
+			void ApplyTo(BY_HANDLE_FILE_INFORMATION& fileInfo) noexcept;
+
+			// Only valid when no writes are in progress, waits for the timer, discards buffered data and releases the buffer.
+			// Called before the handle is closed, so the timer can't write through it afterwards.
+			void Reset() noexcept;
+
+		public:
+			WriteBehindBuffer& operator=(const WriteBehindBuffer&) = delete;
+	};
+}
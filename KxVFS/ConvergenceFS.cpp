@@ -5,6 +5,544 @@
 
 namespace KxVFS
 {
+	uint32_t ConvergenceFS::FindLayer(DynamicStringRefW path) const noexcept
+	{
+		for (size_t i = 0; i < m_Layers.size(); i++)
+		{
+			if (!m_Layers[i].empty() && Utility::Comparator::IsEqualNoCase(m_Layers[i], path))
+			{
+				return static_cast<uint32_t>(i);
+			}
+		}
+		return InvalidLayer;
+	}
+	void ConvergenceFS::UpdateLayerPriorities()
+	{
+		// Write target always wins, then virtual folders in reverse order. Lower value means higher priority.
+		m_LayerPriorities.assign(m_Layers.size(), InvalidLayer);
+		m_LayerPriorities[WriteTargetLayer] = 0;
+
+		uint32_t priority = 1;
+		for (auto it = m_VirtualFolders.rbegin(); it != m_VirtualFolders.rend(); ++it)
+		{
+			const uint32_t layer = FindLayer(*it);
+			if (layer != InvalidLayer && m_LayerPriorities[layer] == InvalidLayer)
+			{
+				m_LayerPriorities[layer] = priority++;
+			}
+		}
+	}
+	uint32_t ConvergenceFS::GetWinningLayer(InternedLayerSet layers, const std::vector<uint32_t>& priorities) const noexcept
+	{
+		uint32_t winner = InvalidLayer;
+		for (uint32_t layer: layers)
+		{
+			if (winner == InvalidLayer || priorities[layer] < priorities[winner])
+			{
+				winner = layer;
+			}
+		}
+		return winner;
+	}
+	DynamicStringW ConvergenceFS::MakeLayerPath(uint32_t layer, const FileNode& node) const
+	{
+		DynamicStringW path = m_Layers[layer];
+		if (const DynamicStringW relativePath = node.GetRelativePath(); !relativePath.empty())
+		{
+			path += L'\\';
+			path += relativePath;
+		}
+		return path;
+	}
+	std::vector<uint32_t> ConvergenceFS::GetDirectoryLayers(const FileNode& node, const std::vector<uint32_t>& layers) const
+	{
+		// Layers of the node which have it as a directory, in priority order
+		std::vector<uint32_t> directoryLayers;
+		for (uint32_t layer: layers)
+		{
+			if (Utility::IsFolderExist(MakeLayerPath(layer, node)))
+			{
+				directoryLayers.push_back(layer);
+			}
+		}
+		std::sort(directoryLayers.begin(), directoryLayers.end(), [this](uint32_t left, uint32_t right)
+		{
+			return m_LayerPriorities[left] < m_LayerPriorities[right];
+		});
+		return directoryLayers;
+	}
+	void ConvergenceFS::ResetLayers()
+	{
+		// Assign layer IDs, write target is always the first one
+		m_Layers.clear();
+		m_Layers.emplace_back(GetWriteTarget());
+		for (const DynamicStringW& path: m_VirtualFolders)
+		{
+			if (FindLayer(path) == InvalidLayer)
+			{
+				m_Layers.emplace_back(path);
+			}
+		}
+		UpdateLayerPriorities();
+	}
+	void ConvergenceFS::InvalidateTreeCaches() noexcept
+	{
+		m_PathCache.Invalidate();
+		m_LookupCache.Invalidate();
+	}
+	void ConvergenceFS::ResetTree()
+	{
+		// Index is detached first, so it isn't updated node by node while the whole tree is destroyed
+		m_NodeArena.SetPathIndex(nullptr);
+		m_PathIndex.Clear();
+
+		m_VirtualTree.MakeNull();
+		InvalidateTreeCaches();
+		m_NodeArena.Reset();
+		m_VirtualTree.UpdateItemInfo(GetMountPoint());
+	}
+	void ConvergenceFS::AttachPathIndex()
+	{
+		// Tree is built without the index attached, it's faster to index it all at once afterwards
+		if (m_PathIndexEnabled)
+		{
+			m_PathIndex.Build(m_VirtualTree);
+			m_NodeArena.SetPathIndex(&m_PathIndex);
+		}
+	}
+
+	std::vector<std::unique_ptr<FileNode>> ConvergenceFS::MergeDirectory(const PendingDirectory& directory, TPendingDirectories& directories)
+	{
+		// Enumerates the directory in every layer that has it and adds entries which aren't already present in the merged tree.
+		// Directories with the same name in lower priority layers are merged into the winning one when it's a directory too.
+		// The directory is empty at this point, its children are returned so the caller can add them all at once.
+		struct ChildLayers
+		{
+			std::unique_ptr<FileNode> Node;
+			std::vector<uint32_t> Layers;
+			std::vector<uint32_t> Directories;
+		};
+		std::vector<ChildLayers> children;
+		std::unordered_map<DynamicStringW, size_t> childIndex;
+
+		FileNode& rootNode = *directory.Node;
+		for (uint32_t layer: directory.Layers)
+		{
+			FileFinder finder(MakeLayerPath(layer, rootNode), L"*");
+			for (FileItem item = finder.FindNext(); item.IsOK(); item = finder.FindNext())
+			{
+				if (item.IsNormalItem())
+				{
+					DynamicStringW nameLC = Utility::StringToLower(item.GetName());
+					if (auto it = childIndex.find(nameLC); it != childIndex.end())
+					{
+						ChildLayers& child = children[it->second];
+						child.Layers.push_back(layer);
+						if (item.IsDirectory())
+						{
+							child.Directories.push_back(layer);
+						}
+					}
+					else
+					{
+						childIndex.emplace(std::move(nameLC), children.size());
+
+						ChildLayers& child = children.emplace_back();
+						child.Node = FileNode::Create(&m_NodeArena, item, &rootNode);
+						child.Node->SetVirtualDirectory(m_Layers[layer]);
+						child.Layers.push_back(layer);
+						if (item.IsDirectory())
+						{
+							child.Directories.push_back(layer);
+						}
+					}
+				}
+			}
+		}
+
+		std::vector<std::unique_ptr<FileNode>> nodes;
+		nodes.reserve(children.size());
+		for (ChildLayers& child: children)
+		{
+			if (child.Node->IsDirectory())
+			{
+				directories.push_back({child.Node.get(), std::move(child.Directories)});
+			}
+
+			std::sort(child.Layers.begin(), child.Layers.end());
+			child.Node->SetLayers(child.Layers);
+			nodes.emplace_back(std::move(child.Node));
+		}
+		return nodes;
+	}
+	void ConvergenceFS::BuildBranch(PendingDirectory directory, bool isDetached)
+	{
+		// Detached branch isn't in the tree yet, so it's indexed only when it's added there
+		TPendingDirectories directories;
+		directories.push_back(std::move(directory));
+		while (!directories.empty())
+		{
+			TPendingDirectories roundDirectories;
+			roundDirectories.reserve(directories.size());
+
+			for (const PendingDirectory& item: directories)
+			{
+				std::vector<std::unique_ptr<FileNode>> nodes = MergeDirectory(item, roundDirectories);
+				if (isDetached)
+				{
+					item.Node->AddDetachedChildren(std::move(nodes));
+				}
+				else
+				{
+					item.Node->AddChildren(std::move(nodes));
+				}
+			}
+			directories = std::move(roundDirectories);
+		}
+	}
+	std::vector<std::unique_ptr<FileNode>> ConvergenceFS::BuildDetachedBranch(PendingDirectory directory)
+	{
+		// Children of the directory with their branches, the directory itself is left as is
+		TPendingDirectories directories;
+		std::vector<std::unique_ptr<FileNode>> nodes = MergeDirectory(directory, directories);
+		for (PendingDirectory& item: directories)
+		{
+			BuildBranch(std::move(item), true);
+		}
+		return nodes;
+	}
+	void ConvergenceFS::BuildRootDirectory()
+	{
+		// Build top level from all layers
+		PendingDirectory rootDirectory = {&m_VirtualTree, {}};
+		rootDirectory.Layers.reserve(m_Layers.size());
+		for (size_t i = 0; i < m_Layers.size(); i++)
+		{
+			if (!m_Layers[i].empty())
+			{
+				rootDirectory.Layers.push_back(static_cast<uint32_t>(i));
+			}
+		}
+		std::sort(rootDirectory.Layers.begin(), rootDirectory.Layers.end(), [this](uint32_t left, uint32_t right)
+		{
+			return m_LayerPriorities[left] < m_LayerPriorities[right];
+		});
+
+		TPendingDirectories topDirectories;
+		m_VirtualTree.AddChildren(MergeDirectory(rootDirectory, topDirectories));
+
+		// Build subdirectories. Branches of different top level directories don't share any nodes so each one
+		// is built on its own thread. The order in which branches are done doesn't affect the result.
+		Utility::ParallelFor(topDirectories.size(), m_TreeBuildThreadCount, [this, &topDirectories](size_t index)
+		{
+			BuildBranch(std::move(topDirectories[index]));
+		});
+	}
+	ConvergenceFS::ResolveResult ConvergenceFS::ResolveNode(FileNode& node)
+	{
+		// Take file info from the highest priority layer of the node. If the winner has changed its type
+		// the branch below it is no longer valid and has to be built again from the remaining layers.
+		std::vector<uint32_t> layers(node.GetLayers().begin(), node.GetLayers().end());
+		std::sort(layers.begin(), layers.end(), [this](uint32_t left, uint32_t right)
+		{
+			return m_LayerPriorities[left] < m_LayerPriorities[right];
+		});
+		if (layers.empty())
+		{
+			return ResolveResult::Missing;
+		}
+
+		const bool wasDirectory = node.IsDirectory();
+		if (!node.UpdateItemInfo(MakeLayerPath(layers.front(), node)))
+		{
+			return ResolveResult::Missing;
+		}
+		node.SetVirtualDirectory(m_Layers[layers.front()]);
+
+		if (node.IsDirectory() == wasDirectory)
+		{
+			return ResolveResult::Updated;
+		}
+
+		node.ClearChildren();
+		if (node.IsDirectory())
+		{
+			BuildBranch({&node, GetDirectoryLayers(node)});
+		}
+		return ResolveResult::Rebuilt;
+	}
+	ConvergenceFS::ResolveResult ConvergenceFS::ResolveNode(FileNode& node, NodeChange& change)
+	{
+		// Same as above for a node of the mounted tree with the new layers in the change. The node is left as is,
+		// everything it needs is put into the change and the branch of a rebuilt node is built detached.
+		change.Node = &node;
+
+		std::vector<uint32_t> layers = change.Layers;
+		std::sort(layers.begin(), layers.end(), [this](uint32_t left, uint32_t right)
+		{
+			return m_LayerPriorities[left] < m_LayerPriorities[right];
+		});
+		if (layers.empty())
+		{
+			return change.Result = ResolveResult::Missing;
+		}
+
+		FileFinder finder(MakeLayerPath(layers.front(), node));
+		change.Item = finder.FindNext();
+		if (!change.Item.IsOK())
+		{
+			return change.Result = ResolveResult::Missing;
+		}
+		change.Winner = layers.front();
+
+		if (change.Item.IsDirectory() == node.IsDirectory())
+		{
+			return change.Result = ResolveResult::Updated;
+		}
+		if (change.Item.IsDirectory())
+		{
+			change.Children = BuildDetachedBranch({&node, GetDirectoryLayers(node, change.Layers)});
+		}
+		return change.Result = ResolveResult::Rebuilt;
+	}
+
+	ConvergenceFS::NodeLocation ConvergenceFS::GetNodeLocation(FileNode& node) const
+	{
+		auto lock = node.LockShared();
+
+		NodeLocation location;
+		location.Node = &node;
+		location.Parent = node.GetParent();
+		location.Path = node.GetFullPathWithNS();
+		return location;
+	}
+	bool ConvergenceFS::IsAtLocation(const NodeLocation& location) const
+	{
+		// Tree changes which follow a disk operation are made in two phases. The disk operation is done without
+		// holding any tree locks and then the tree is updated under a short lock of the affected nodes.
+		// Other requests could've moved, renamed or removed the node in between, in that case the tree
+		// already reflects a newer state and this request must leave the node alone.
+		// Must be called with the node locked and inside an 'EpochGuard'.
+		const FileNode* parent = location.Parent;
+		const FileNode& node = *location.Node;
+
+		return parent && node.GetParent() == parent &&
+			parent->GetChildren().find(node.GetNameLC(), node.GetNameHash()) == &node &&
+			node.GetFullPathWithNS() == location.Path;
+	}
+
+	FileNode& ConvergenceFS::AddCreatedNode(FileNode& parentNode, DynamicStringRefW targetPath, DynamicStringRefW virtualDirectory)
+	{
+		// Node is complete before it's published, so the parent isn't locked and other requests in
+		// the same directory aren't blocked. If the same file was created concurrently, that node is used.
+		auto node = FileNode::Create(&m_NodeArena, targetPath, &parentNode);
+		node->SetVirtualDirectory(virtualDirectory);
+		node->SetLayers({WriteTargetLayer});
+
+		bool isAdded = false;
+		FileNode& addedNode = parentNode.AddChildIfAbsent(std::move(node), isAdded);
+		if (isAdded)
+		{
+			// Paths of existing nodes are unchanged, only lookups are affected
+			m_LookupCache.Invalidate();
+		}
+		return addedNode;
+	}
+	void ConvergenceFS::MoveBranchToWriteTarget(FileNode& directory, uint32_t sourceLayer)
+	{
+		// Only items the moved directory had in its own layer are moved on the disk, items merged from other layers stay where they were
+		FileNode::RefVector movedNodes;
+		FileNode::RefVector otherNodes;
+		directory.WalkChildren([&movedNodes, &otherNodes, sourceLayer](FileNode& node)
+		{
+			(node.GetLayers().contains(sourceLayer) ? movedNodes : otherNodes).push_back(&node);
+			return true;
+		});
+
+		for (FileNode* node: otherNodes)
+		{
+			directory.RemoveChild(*node);
+		}
+		for (FileNode* node: movedNodes)
+		{
+			if (auto lock = node->LockExclusive(); true)
+			{
+				node->SetVirtualDirectory(GetWriteTarget());
+				node->SetLayers({WriteTargetLayer});
+			}
+			if (node->IsDirectory())
+			{
+				MoveBranchToWriteTarget(*node, sourceLayer);
+			}
+		}
+	}
+	void ConvergenceFS::AddLayerTo(FileNode& directory, uint32_t layer, LayerChanges& changes)
+	{
+		// New items are added all at once after existing ones are updated
+		AddedChildren added;
+		added.Directory = &directory;
+
+		FileFinder finder(MakeLayerPath(layer, directory), L"*");
+		for (FileItem item = finder.FindNext(); item.IsOK(); item = finder.FindNext())
+		{
+			if (!item.IsNormalItem())
+			{
+				continue;
+			}
+
+			const DynamicStringW nameLC = Utility::StringToLower(item.GetName());
+			FileNode* existingNode = directory.GetChildren().find(nameLC, FileNode::HashFileName(nameLC));
+			if (!existingNode)
+			{
+				// Branches of new directories are built before they're visible in the tree
+				std::unique_ptr<FileNode>& newNode = added.Nodes.emplace_back(FileNode::Create(&m_NodeArena, item, &directory));
+				newNode->SetVirtualDirectory(m_Layers[layer]);
+				newNode->SetLayers({layer});
+				if (newNode->IsDirectory())
+				{
+					BuildBranch({newNode.get(), {layer}}, true);
+				}
+				continue;
+			}
+
+			NodeChange change;
+			change.Node = existingNode;
+			change.Layers.assign(existingNode->GetLayers().begin(), existingNode->GetLayers().end());
+			change.Layers.insert(std::upper_bound(change.Layers.begin(), change.Layers.end(), layer), layer);
+
+			bool isMerged = item.IsDirectory() && existingNode->IsDirectory();
+			if (const uint32_t winner = GetWinningLayer(existingNode->GetLayers(), m_LayerPriorities); winner != InvalidLayer && m_LayerPriorities[layer] < m_LayerPriorities[winner])
+			{
+				// New layer overrides this item
+				isMerged = ResolveNode(*existingNode, change) == ResolveResult::Updated && existingNode->IsDirectory();
+			}
+			changes.Nodes.push_back(std::move(change));
+
+			if (isMerged)
+			{
+				AddLayerTo(*existingNode, layer, changes);
+			}
+		}
+
+		if (!added.Nodes.empty())
+		{
+			changes.Added.push_back(std::move(added));
+		}
+	}
+	void ConvergenceFS::RemoveLayerFrom(FileNode& directory, uint32_t layer, LayerChanges& changes)
+	{
+		FileNode::RefVector affectedNodes;
+		directory.WalkChildren([&affectedNodes, layer](FileNode& node)
+		{
+			if (node.GetLayers().contains(layer))
+			{
+				affectedNodes.push_back(&node);
+			}
+			return true;
+		});
+
+		for (FileNode* node: affectedNodes)
+		{
+			NodeChange change;
+			change.Node = node;
+			std::copy_if(node->GetLayers().begin(), node->GetLayers().end(), std::back_inserter(change.Layers), [layer](uint32_t value)
+			{
+				return value != layer;
+			});
+
+			if (change.Layers.empty())
+			{
+				// Nothing else provides this item, so the whole branch goes away
+				change.Result = ResolveResult::Missing;
+			}
+			else if (GetWinningLayer(node->GetLayers(), m_LayerPriorities) == layer)
+			{
+				ResolveNode(*node, change);
+			}
+
+			const bool isMerged = change.Result == ResolveResult::Updated && node->IsDirectory();
+			changes.Nodes.push_back(std::move(change));
+
+			if (isMerged)
+			{
+				RemoveLayerFrom(*node, layer, changes);
+			}
+		}
+	}
+	void ConvergenceFS::ReorderLayerIn(FileNode& directory, uint32_t layer, const std::vector<uint32_t>& oldPriorities, LayerChanges& changes)
+	{
+		FileNode::RefVector affectedNodes;
+		directory.WalkChildren([&affectedNodes, layer](FileNode& node)
+		{
+			// If this layer is the only one providing the item, it's the only one providing the entire branch below it
+			const InternedLayerSet layers = node.GetLayers();
+			if (layers.size() > 1 && layers.contains(layer))
+			{
+				affectedNodes.push_back(&node);
+			}
+			return true;
+		});
+
+		for (FileNode* node: affectedNodes)
+		{
+			ResolveResult result = ResolveResult::Updated;
+			if (GetWinningLayer(node->GetLayers(), oldPriorities) != GetWinningLayer(node->GetLayers(), m_LayerPriorities))
+			{
+				NodeChange change;
+				change.Layers.assign(node->GetLayers().begin(), node->GetLayers().end());
+				result = ResolveNode(*node, change);
+				changes.Nodes.push_back(std::move(change));
+			}
+
+			if (result == ResolveResult::Updated && node->IsDirectory())
+			{
+				ReorderLayerIn(*node, layer, oldPriorities, changes);
+			}
+		}
+	}
+	void ConvergenceFS::ApplyLayerChanges(LayerChanges& changes)
+	{
+		// The disk is scanned without any tree locks and then each node is changed under its own lock, so requests are only blocked
+		// for a moment. Other requests can remove nodes in between, the caller's 'EpochGuard' keeps them alive until it's done.
+		for (NodeChange& change: changes.Nodes)
+		{
+			FileNode& node = *change.Node;
+			auto lock = node.LockExclusive();
+
+			if (change.Result == ResolveResult::Missing)
+			{
+				// Only if it's still there, not some other node created with the same name since
+				if (FileNode* parent = node.GetParent(); parent && parent->GetChildren().find(node.GetNameLC(), node.GetNameHash()) == &node)
+				{
+					parent->RemoveChild(node);
+				}
+				continue;
+			}
+
+			node.SetLayers(change.Layers);
+			if (change.Winner != InvalidLayer)
+			{
+				node.AssignItemInfo(change.Item);
+				node.SetVirtualDirectory(m_Layers[change.Winner]);
+			}
+			if (change.Result == ResolveResult::Rebuilt)
+			{
+				node.ClearChildren();
+				node.AddChildren(std::move(change.Children));
+			}
+		}
+
+		// Items created meanwhile are kept, they're in the write target which wins anyway
+		for (AddedChildren& added: changes.Added)
+		{
+			for (std::unique_ptr<FileNode>& node: added.Nodes)
+			{
+				bool isAdded = false;
+				added.Directory->AddChildIfAbsent(std::move(node), isAdded);
+			}
+		}
+	}
+
 	DynamicStringW ConvergenceFS::MakeFilePath(DynamicStringRefW baseDirectory, DynamicStringRefW requestedPath, bool addNamespace) const
 	{
 		DynamicStringW outPath = addNamespace ? Utility::GetLongPathPrefix() : NullDynamicStringW;
@@ -18,7 +556,10 @@ namespace KxVFS
 		if (node && !node->IsRootNode())
 		{
 			// File found in index
-			return {addNamespace ? node->GetFullPathWithNS() : node->GetFullPath(), node->GetVirtualDirectory()};
+			FlagSet<PathParts> parts = PathParts::BaseDirectory|PathParts::RelativePath|PathParts::Name;
+			parts.Add(PathParts::Namespace, addNamespace);
+
+			return {m_PathCache.GetPath(*node, parts), node->GetVirtualDirectory()};
 		}
 		else
 		{
@@ -28,33 +569,34 @@ namespace KxVFS
 	}
 	DynamicStringW ConvergenceFS::DispatchLocationRequest(DynamicStringRefW requestedPath)
 	{
+		EpochGuard guard;
 		return std::get<0>(GetTargetPath(m_VirtualTree.NavigateToAny(requestedPath), requestedPath, true));
 	}
 
-	bool ConvergenceFS::ProcessDeleteOnClose(Dokany2::DOKAN_FILE_INFO& fileInfo, FileNode& fileNode) const
+	bool ConvergenceFS::ProcessDeleteOnClose(Dokany2::DOKAN_FILE_INFO& fileInfo, FileNode& fileNode)
 	{
 		if (fileInfo.DeleteOnClose)
 		{
+			EpochGuard guard;
+			const NodeLocation location = GetNodeLocation(fileNode);
+
 			// Should already be deleted by 'CloseHandle' if opened with 'FILE_FLAG_DELETE_ON_CLOSE'
-			if (auto parentLock = fileNode.GetParent()->LockExclusive(); true)
+			bool success = false;
+			if (fileNode.IsDirectory())
 			{
-				bool success = false;
-				DynamicStringW fullPath = fileNode.GetFullPathWithNS();
-				if (fileNode.IsDirectory())
-				{
-					success = ::RemoveDirectoryW(fullPath);
-				}
-				else
-				{
-					success = ::DeleteFileW(fullPath);
-				}
+				success = ::RemoveDirectoryW(location.Path);
+			}
+			else
+			{
+				success = ::DeleteFileW(location.Path);
+			}
 
-				if (success)
-				{
-					fileNode.RemoveThisChild();
-				}
-				return success;
+			if (auto lock = fileNode.LockExclusive(); success && IsAtLocation(location))
+			{
+				location.Parent->RemoveChild(fileNode);
+				InvalidateTreeCaches();
 			}
+			return success;
 		}
 		return false;
 	}
@@ -67,7 +609,7 @@ namespace KxVFS
 namespace KxVFS
 {
 	ConvergenceFS::ConvergenceFS(FileSystemService& service, DynamicStringRefW mountPoint, DynamicStringRefW writeTarget, FSFlags flags)
-		:MirrorFS(service, mountPoint, writeTarget, flags)
+		:MirrorFS(service, mountPoint, writeTarget, flags), m_VirtualTree(&m_NodeArena)
 	{
 	}
 
@@ -78,122 +620,308 @@ namespace KxVFS
 			// Make sure write target exist
 			Utility::CreateDirectoryTree(GetWriteTarget());
 
-			// Build virtual tree if it wasn't built before
-			if (!m_VirtualTree.HasChildren())
+			// Build virtual tree if it wasn't built before, the snapshot is tried first
+			if (!m_VirtualTree.HasChildren() && (m_SnapshotPath.empty() || !LoadFileTree(m_SnapshotPath)))
 			{
 				BuildFileTree();
 			}
 
-			// Mount now
-			return MirrorFS::Mount();
+			// Root and top-level directories are locked by nearly every request
+			m_VirtualTree.EnableReaderBias();
+			m_VirtualTree.WalkChildren([](FileNode& node)
+			{
+				if (node.IsDirectory())
+				{
+					node.EnableReaderBias();
+				}
+				return true;
+			});
+
+			// Mount now, tree locks are elided for the whole mount if the policy allows it
+			m_NodeArena.SetLockingPolicy(GetLockingPolicy());
+			FSError error = MirrorFS::Mount();
+			if (error.IsFail())
+			{
+				m_NodeArena.SetLockingPolicy(LockingPolicy::Full);
+			}
+			return error;
 		}
 		return FSErrorCode::CanNotMount;
 	}
 	bool ConvergenceFS::UnMount()
 	{
-		m_VirtualTree.MakeNull();
-		return MirrorFS::UnMount();
+		// Anything can change on the disk until the next mount, so the tree isn't kept. With a snapshot
+		// it's saved instead and the next mount loads it again, building only what has changed since.
+		const bool result = MirrorFS::UnMount();
+		m_NodeArena.SetLockingPolicy(LockingPolicy::Full);
+		if (result)
+		{
+			if (!m_SnapshotPath.empty() && m_VirtualTree.HasChildren())
+			{
+				SaveFileTree(m_SnapshotPath);
+			}
+
+			ResetTree();
+			m_Layers.clear();
+			m_LayerPriorities.clear();
+		}
+		return result;
+	}
+	bool ConvergenceFS::CanUpdateTree() const noexcept
+	{
+		if (IsMounted() && m_NodeArena.GetLockingPolicy() != LockingPolicy::Full)
+		{
+			KxVFS_Log(LogLevel::Info, L"%1: virtual tree can't be changed while mounted without locking", __FUNCTIONW__);
+			return false;
+		}
+		return true;
 	}
 
 	void ConvergenceFS::AddVirtualFolder(DynamicStringRefW path)
 	{
-		m_VirtualFolders.emplace_back(Utility::NormalizeFilePath(path));
+		const DynamicStringRefW folderPath = Utility::NormalizeFilePath(path);
+		if (m_Layers.empty())
+		{
+			m_VirtualFolders.emplace_back(folderPath);
+			return;
+		}
+
+		if (FindLayer(folderPath) == InvalidLayer && CanUpdateTree())
+		{
+			m_VirtualFolders.emplace_back(folderPath);
+			m_Layers.emplace_back(folderPath);
+			UpdateLayerPriorities();
+
+			EpochGuard guard;
+			LayerChanges changes;
+			AddLayerTo(m_VirtualTree, static_cast<uint32_t>(m_Layers.size() - 1), changes);
+			ApplyLayerChanges(changes);
+			InvalidateTreeCaches();
+		}
 	}
-	void ConvergenceFS::ClearVirtualFolders()
+	bool ConvergenceFS::RemoveVirtualFolder(DynamicStringRefW path)
 	{
-		m_VirtualFolders.clear();
+		if (!m_Layers.empty() && !CanUpdateTree())
+		{
+			return false;
+		}
+
+		const DynamicStringRefW folderPath = Utility::NormalizeFilePath(path);
+		auto it = std::find_if(m_VirtualFolders.begin(), m_VirtualFolders.end(), [folderPath](const DynamicStringW& value)
+		{
+			return Utility::Comparator::IsEqualNoCase(value, folderPath);
+		});
+		if (it == m_VirtualFolders.end())
+		{
+			return false;
+		}
+		m_VirtualFolders.erase(it);
+
+		const uint32_t layer = m_Layers.empty() ? InvalidLayer : FindLayer(folderPath);
+		if (layer != InvalidLayer && layer != WriteTargetLayer)
+		{
+			EpochGuard guard;
+			LayerChanges changes;
+
+			std::vector<uint32_t> oldPriorities = m_LayerPriorities;
+			UpdateLayerPriorities();
+			if (m_LayerPriorities[layer] == InvalidLayer)
+			{
+				// Restore priorities to find out which nodes this layer currently wins
+				m_LayerPriorities.swap(oldPriorities);
+				RemoveLayerFrom(m_VirtualTree, layer, changes);
+				ApplyLayerChanges(changes);
+
+				m_Layers[layer].clear();
+				UpdateLayerPriorities();
+			}
+			else
+			{
+				// The same folder is still present in another position
+				ReorderLayerIn(m_VirtualTree, layer, oldPriorities, changes);
+				ApplyLayerChanges(changes);
+			}
+			InvalidateTreeCaches();
+		}
+		return true;
 	}
-	size_t ConvergenceFS::BuildFileTree()
+	bool ConvergenceFS::MoveVirtualFolder(DynamicStringRefW path, size_t index)
 	{
-		m_VirtualTree.MakeNull();
-		m_VirtualTree.UpdateItemInfo(GetMountPoint());
+		if (!m_Layers.empty() && !CanUpdateTree())
+		{
+			return false;
+		}
+
+		const DynamicStringRefW folderPath = Utility::NormalizeFilePath(path);
+		auto it = std::find_if(m_VirtualFolders.begin(), m_VirtualFolders.end(), [folderPath](const DynamicStringW& value)
+		{
+			return Utility::Comparator::IsEqualNoCase(value, folderPath);
+		});
+		if (it == m_VirtualFolders.end())
+		{
+			return false;
+		}
 
-		// We are going to push write target path later, so preallocate space for it.
-		// It's need for references validity below.
-		m_VirtualFolders.reserve(m_VirtualFolders.capacity() + 1);
+		DynamicStringW value = std::move(*it);
+		m_VirtualFolders.erase(it);
+		m_VirtualFolders.insert(m_VirtualFolders.begin() + std::min(index, m_VirtualFolders.size()), std::move(value));
 
-		// Create individual virtual trees
-		Utility::Comparator::UnorderedMapNoCase<std::unique_ptr<FileNode>> virtualNodes;
-		for (const DynamicStringW& path: m_VirtualFolders)
+		const uint32_t layer = m_Layers.empty() ? InvalidLayer : FindLayer(folderPath);
+		if (layer != InvalidLayer && layer != WriteTargetLayer)
+		{
+			EpochGuard guard;
+			LayerChanges changes;
+
+			const std::vector<uint32_t> oldPriorities = m_LayerPriorities;
+			UpdateLayerPriorities();
+			ReorderLayerIn(m_VirtualTree, layer, oldPriorities, changes);
+			ApplyLayerChanges(changes);
+			InvalidateTreeCaches();
+		}
+		return true;
+	}
+	void ConvergenceFS::ClearVirtualFolders()
+	{
+		if (m_Layers.empty())
 		{
-			// Paths references here belong to 'm_VirtualFolders' vector
-			auto[it, _] = virtualNodes.emplace(path, std::make_unique<FileNode>(path.get_view()));
-			it->second->UpdateFileTree(path);
+			m_VirtualFolders.clear();
+			return;
 		}
+		if (!CanUpdateTree())
 		{
-			// Base class owns result of 'GetWriteTarget()' so all references are valid
-			auto[it, _] = virtualNodes.insert_or_assign(GetWriteTarget(), std::make_unique<FileNode>(GetWriteTarget()));
-			it->second->UpdateFileTree(GetWriteTarget());
+			return;
 		}
 
-		auto BuildTreeBranch = [this, &virtualNodes](FileNode& rootNode, FileNode::RefVector& directories)
+		while (!m_VirtualFolders.empty())
 		{
-			Utility::Comparator::UnorderedSetNoCase hash;
-			hash.reserve(m_VirtualFolders.size());
-			const DynamicStringW rootPath = rootNode.GetRelativePath();
+			const DynamicStringW path = m_VirtualFolders.back();
+			RemoveVirtualFolder(path);
+		}
+	}
+	size_t ConvergenceFS::BuildFileTree()
+	{
+		if (!CanUpdateTree())
+		{
+			return 0;
+		}
 
-			for (auto it = m_VirtualFolders.rbegin(); it != m_VirtualFolders.rend(); ++it)
-			{
-				auto nodeIt = virtualNodes.find(*it);
-				const DynamicStringW& folderPath = nodeIt->first;
-				FileNode& folderNode = *nodeIt->second;
+		ResetTree();
+		ResetLayers();
+		BuildRootDirectory();
+		AttachPathIndex();
+		if (!m_SnapshotPath.empty())
+		{
+			SaveFileTree(m_SnapshotPath);
+		}
 
-				// If we have root node, look for files in real file tree, otherwise use mod's tree root
-				if (FileNode* searchNode = folderNode.NavigateToFolder(rootPath))
-				{
-					// Most likely not enough, but at least something
-					rootNode.ReserveChildren(searchNode->GetChildrenCount());
+		// Count all nodes count for diagnostic purposes
+		return m_VirtualTree.WalkTreeParallel(size_t(0), [](const FileNode& node, size_t& totalCount)
+		{
+			totalCount += node.GetChildrenCount() + 1;
+			return true;
+		},
+		[](size_t& totalCount, size_t count)
+		{
+			totalCount += count;
+		}, m_TreeBuildThreadCount);
+	}
+	void ConvergenceFS::SetPathIndexEnabled(bool enabled)
+	{
+		if (!CanUpdateTree())
+		{
+			return;
+		}
+		auto lock = m_VirtualTree.LockExclusive();
 
-					for (const auto& [name, node]: searchNode->GetChildren())
-					{
-						auto hashIt = hash.insert(name);
-						if (hashIt.second)
-						{
-							FileNode& newNode = rootNode.AddChild(std::make_unique<FileNode>(node->GetItem(), &rootNode));
-							newNode.CopyBasicAttributes(*node);
+		m_PathIndexEnabled = enabled;
+		m_NodeArena.SetPathIndex(nullptr);
+		m_PathIndex.Clear();
+		if (!m_Layers.empty())
+		{
+			AttachPathIndex();
+		}
+	}
+	bool ConvergenceFS::SaveFileTree(DynamicStringRefW filePath) const
+	{
+		if (m_Layers.empty())
+		{
+			return false;
+		}
 
-							if (newNode.IsDirectory())
-							{
-								directories.push_back(&newNode);
-							}
-						}
-					}
-				}
-			}
-		};
+		auto lock = m_VirtualTree.LockShared();
+		if (!FileTreeSnapshot::Write(filePath, m_VirtualTree, m_Layers, m_LayerPriorities))
+		{
+			KxVFS_Log(LogLevel::Info, L"Unable to write file tree snapshot to \"%1\"", filePath);
+			return false;
+		}
+		return true;
+	}
+	bool ConvergenceFS::LoadFileTree(DynamicStringRefW filePath)
+	{
+		FileTreeSnapshot snapshot;
+		if (!snapshot.Open(filePath))
+		{
+			return false;
+		}
 
-		// Temporarily add write target to build tree with it and remove when we are done.
-		m_VirtualFolders.push_back(GetWriteTarget());
-		Utility::CallAtScopeExit atExit([this]()
+		ResetTree();
+
+		// Layer IDs are taken from the snapshot, it can only be used if it has the same folders in the same order
+		m_Layers.clear();
+		for (size_t i = 0; i < snapshot.GetLayerCount(); i++)
 		{
-			m_VirtualFolders.pop_back();
-		});
+			m_Layers.emplace_back(snapshot.GetLayerPath(i));
+		}
 
-		// Build top level
-		FileNode::RefVector directories;
-		BuildTreeBranch(m_VirtualTree, directories);
+		bool isSameLayers = !m_Layers.empty() && Utility::Comparator::IsEqualNoCase(m_Layers[WriteTargetLayer], GetWriteTarget());
+		if (isSameLayers)
+		{
+			UpdateLayerPriorities();
+			for (size_t i = 0; isSameLayers && i < m_Layers.size(); i++)
+			{
+				isSameLayers = m_LayerPriorities[i] == snapshot.GetLayerPriority(i);
+			}
+			for (const DynamicStringW& path: m_VirtualFolders)
+			{
+				isSameLayers = isSameLayers && FindLayer(path) != InvalidLayer;
+			}
+		}
 
-		// Build subdirectories
-		while (!directories.empty())
+		FileNode::RefVector changedDirectories;
+		if (!isSameLayers || !snapshot.Load(m_VirtualTree, m_NodeArena, changedDirectories))
 		{
-			FileNode::RefVector roundDirectories;
-			roundDirectories.reserve(directories.size());
+			m_VirtualTree.MakeNull();
+			m_NodeArena.Reset();
+			m_Layers.clear();
+			m_LayerPriorities.clear();
+			return false;
+		}
+		snapshot.Close();
 
-			for (FileNode* node: directories)
+		// Build again only what has changed since the snapshot was written. Changed directories never contain each other
+		// because nothing is loaded below a changed directory, and if the root has changed it's the only one.
+		for (FileNode* node: changedDirectories)
+		{
+			if (node == &m_VirtualTree)
 			{
-				BuildTreeBranch(*node, roundDirectories);
+				BuildRootDirectory();
+			}
+			else if (const ResolveResult result = ResolveNode(*node); result == ResolveResult::Missing)
+			{
+				node->RemoveThisChild();
+			}
+			else if (result == ResolveResult::Updated && node->IsDirectory())
+			{
+				BuildBranch({node, GetDirectoryLayers(*node)});
 			}
-			directories = std::move(roundDirectories);
 		}
+		AttachPathIndex();
 
-		// Count all nodes count for diagnostic purposes
-		size_t totalCount = 0;
-		m_VirtualTree.WalkTree([&totalCount](const FileNode& node)
+		if (!changedDirectories.empty())
 		{
-			totalCount += node.GetChildrenCount() + 1;
-			return true;
-		});
-		return totalCount;
+			SaveFileTree(filePath);
+		}
+		return true;
 	}
 }
 
@@ -203,13 +931,13 @@ namespace KxVFS
 	{
 		KxVFS_Log(LogLevel::Info, L"Trying to create/open file or directory: %1", eventInfo.FileName);
 
+		// Lookups don't lock the tree, nodes removed meanwhile are kept alive until the guard is gone.
+		// So it stays for the whole request, both nodes are used until the file is opened or created.
+		EpochGuard guard;
+
 		// Paths and nodes
 		FileNode* parentNode = nullptr;
-		FileNode* targetNode = nullptr;
-		if (auto lock = m_VirtualTree.LockShared(); true)
-		{
-			targetNode = m_VirtualTree.NavigateToAny(eventInfo.FileName, parentNode);
-		}
+		FileNode* targetNode = m_LookupCache.NavigateToAny(m_VirtualTree, eventInfo.FileName, parentNode);
 
 		// Attributes and flags
 		const FlagSet<KernelFileOptions> kernelOptions = FromInt<KernelFileOptions>(eventInfo.CreateOptions);
@@ -341,20 +1069,18 @@ namespace KxVFS
 					return NtStatus::InternalError;
 				}
 
-				auto lock = parentNode->LockExclusive();
-				targetNode = &parentNode->AddChild(std::make_unique<FileNode>(targetPath.get_view(), parentNode), virtualDirectory);
+				targetNode = &AddCreatedNode(*parentNode, targetPath, virtualDirectory);
 			}
 
 			// Need to update FileAttributes with previous when overwriting file
 			if (creationDisposition == CreationDisposition::TruncateExisting)
 			{
-				auto targetLock = targetNode->LockExclusive();
+				// Update file on disk
+				::SetFileAttributesW(targetPath, (requestAttributes|fileAttributes).ToInt());
 
 				// Update virtual tree info
+				auto targetLock = targetNode->LockExclusive();
 				targetNode->SetAttributes(requestAttributes|fileAttributes);
-
-				// Update file on disk
-				::SetFileAttributesW(targetPath, (requestAttributes|fileAttributes).ToInt());
 			}
 
 			FileContextManager& fileContextManager = GetFileContextManager();
@@ -364,6 +1090,22 @@ namespace KxVFS
 				// Save the file context
 				fileContext->AssignFileNode(*targetNode);
 				fileContext->GetEventInfo().Assign(eventInfo);
+
+				// Writes keep track of the file size from here, so the node doesn't need to be refreshed after each one
+				if (isWriteRequest)
+				{
+					if (int64_t fileSize = 0; fileContext->GetHandle().GetFileSize(fileSize))
+					{
+						fileContext->GetMetadata().OnRefreshed(fileSize);
+					}
+				}
+
+				// Files from the write target are changed all the time, so only the other layers are cached.
+				// These can still be written in place, such handles drop the cached blocks after each change.
+				if (GetIOManager().GetBlockCache().IsEnabled() && !IsWriteTargetNode(*targetNode))
+				{
+					GetIOManager().AttachBlockCache(*fileContext, isWriteRequest);
+				}
 				OnFileCreated(eventInfo, *fileContext);
 
 				if (creationDisposition == CreationDisposition::OpenAlways || creationDisposition == CreationDisposition::CreateAlways)
@@ -434,8 +1176,7 @@ namespace KxVFS
 					return NtStatus::InternalError;
 				}
 
-				auto lock = parentNode->LockExclusive();
-				targetNode = &parentNode->AddChild(std::make_unique<FileNode>(targetPath.get_view(), parentNode), virtualDirectory);
+				targetNode = &AddCreatedNode(*parentNode, targetPath, virtualDirectory);
 			}
 			else
 			{
@@ -541,6 +1282,11 @@ namespace KxVFS
 					fileContext->MarkClosed();
 					if (fileContext->GetHandle())
 					{
+						GetIOManager().CloseWriteBuffer(*fileContext);
+						if (fileContext->GetMetadata().IsDirty())
+						{
+							UpdateAttributes(*fileContext);
+						}
 						OnFileClosed(eventInfo, *fileContext);
 						fileContext->CloseHandle();
 
@@ -567,8 +1313,14 @@ namespace KxVFS
 		{
 			if (FileNode* fileNode = fileContext->GetFileNode())
 			{
+				NtStatus status = NtStatus::Success;
 				if (auto contextLock = fileContext->LockExclusive(); true)
 				{
+					status = GetIOManager().CloseWriteBuffer(*fileContext);
+					if (fileContext->GetMetadata().IsDirty())
+					{
+						UpdateAttributes(*fileContext);
+					}
 					fileContext->CloseHandle();
 					fileContext->MarkCleanedUp();
 					OnFileCleanedUp(eventInfo, *fileContext);
@@ -579,7 +1331,7 @@ namespace KxVFS
 						OnFileDeleted(eventInfo, *fileContext);
 					}
 				}
-				return NtStatus::Success;
+				return status;
 			}
 			return NtStatus::FileInvalid;
 		}
@@ -676,15 +1428,16 @@ namespace KxVFS
 		{
 			if (FileNode* sourceNode = fileContext->GetFileNode())
 			{
+				EpochGuard guard;
 				FileNode* targetNodeParent = nullptr;
 				FileNode* targetNode = m_VirtualTree.NavigateToFile(eventInfo.NewFileName, targetNodeParent);
 
 				KxVFS_Log(LogLevel::Info, L"%1: \"%2\" -> \"%3\" (ReplaceIfExists: %4), Target parent: %5",
 						  __FUNCTIONW__,
 						  sourceNode->GetFullPath(),
-						  targetNode ? targetNode->GetFullPath() : L"<null>",
+						  targetNode ? targetNode->GetFullPath() : DynamicStringW(L"<null>"),
 						  (bool)eventInfo.ReplaceIfExists,
-						  targetNodeParent ? targetNodeParent->GetFullPath() : L"<null>");
+						  targetNodeParent ? targetNodeParent->GetFullPath() : DynamicStringW(L"<null>"));
 
 				if (targetNode)
 				{
@@ -693,16 +1446,27 @@ namespace KxVFS
 
 					if (eventInfo.ReplaceIfExists)
 					{
-						auto sourceLock = sourceNode->LockExclusive();
-						auto targetLock = targetNode->LockExclusive();
+						// Can copy the file across volumes, so no tree locks are held while it's moved
+						const NodeLocation source = GetNodeLocation(*sourceNode);
+						const NodeLocation target = GetNodeLocation(*targetNode);
 
-						if (::MoveFileExW(sourceNode->GetFullPathWithNS(), targetNode->GetFullPathWithNS(), MOVEFILE_COPY_ALLOWED|MOVEFILE_REPLACE_EXISTING))
+						if (::MoveFileExW(source.Path, target.Path, MOVEFILE_COPY_ALLOWED|MOVEFILE_REPLACE_EXISTING))
 						{
-							// Move succeeded, move source node's file info into the target
-							targetNode->TakeItem(std::move(*sourceNode));
+							auto sourceLock = sourceNode->LockExclusive();
+							auto targetLock = targetNode->LockExclusive();
+
+							// Move succeeded, copy source node's file info into the target
+							if (IsAtLocation(target))
+							{
+								targetNode->CopyInfo(*sourceNode);
+							}
 
 							// And remove source file from the tree
-							sourceNode->RemoveThisChild();
+							if (IsAtLocation(source))
+							{
+								source.Parent->RemoveChild(*sourceNode);
+							}
+							InvalidateTreeCaches();
 
 							return NtStatus::Success;
 						}
@@ -720,11 +1484,15 @@ namespace KxVFS
 					const DynamicStringW newName = DynamicStringW(eventInfo.NewFileName).after_last(L'\\');
 					KxVFS_Log(LogLevel::Info, L"New file name: \"%1\"", newName);
 
-					if (auto originalLock = sourceNode->LockExclusive(); !newName.empty())
+					if (!newName.empty())
 					{
+						const NodeLocation source = GetNodeLocation(*sourceNode);
+
 						// Set name to temporary item to construct a new path
 						const DynamicStringW newPath = [sourceNode, &newName]()
 						{
+							auto lock = sourceNode->LockShared();
+
 							FileItem item;
 							item.SetName(newName);
 							item.SetSource(sourceNode->GetSource());
@@ -733,14 +1501,19 @@ namespace KxVFS
 						}();
 
 						// Rename file system object
-						KxVFS_Log(LogLevel::Info, L"Renaming: \"%1\" -> \"%2\"", sourceNode->GetFullPathWithNS(), newPath);
+						KxVFS_Log(LogLevel::Info, L"Renaming: \"%1\" -> \"%2\"", source.Path, newPath);
 
 						const NtStatus status = fileContext->GetHandle().SetPath(newPath, eventInfo.ReplaceIfExists);
 						if (status == NtStatus::Success)
 						{
 							// Rename the node if we successfully renamed its file system object
+							auto sourceLock = sourceNode->LockExclusive();
 							auto parentLock = targetNodeParent->LockExclusive();
-							sourceNode->SetName(newName);
+							if (IsAtLocation(source))
+							{
+								sourceNode->SetName(newName);
+							}
+							InvalidateTreeCaches();
 						}
 						return status;
 					}
@@ -750,19 +1523,19 @@ namespace KxVFS
 				{
 					// We don't have target file, nor it's a rename request, so it's a move to a completely new location.
 					// Branch should be already constructed, so move a new node to a supposed target parent.
-					auto sourceLock = sourceNode->LockExclusive();
-					auto parentLock = targetNodeParent->LockExclusive();
+					// No tree locks are held while the file is moved and the directory tree is created.
+					const NodeLocation source = GetNodeLocation(*sourceNode);
 
 					// Get new target path
 					const auto [newTargetPath, virtualDirectory] = GetTargetPath(targetNode, eventInfo.NewFileName, true);
 
 					// Move the file
-					KxVFS_Log(LogLevel::Info, L"Moving file to a new location: \"%1\" -> \"%2\"", sourceNode->GetFullPathWithNS(), newTargetPath);
+					KxVFS_Log(LogLevel::Info, L"Moving file to a new location: \"%1\" -> \"%2\"", source.Path, newTargetPath);
 
 					// Target directory tree might not exist yet. Try to move the file and, if directory doesn't exist, create it and repeat.
 					auto DoMoveFile = [&]()
 					{
-						return ::MoveFileExW(sourceNode->GetFullPathWithNS(), newTargetPath, MOVEFILE_COPY_ALLOWED);
+						return ::MoveFileExW(source.Path, newTargetPath, MOVEFILE_COPY_ALLOWED);
 					};
 
 					bool isMoved = DoMoveFile();
@@ -778,13 +1551,24 @@ namespace KxVFS
 					}
 					if (isMoved)
 					{
-						FileNode& newNode = targetNodeParent->AddChild(std::make_unique<FileNode>(newTargetPath.get_view(), targetNodeParent), virtualDirectory);
+						// The source node itself is moved, so a directory keeps its branch and open files keep their node
+						const DynamicStringW newName = DynamicStringW(eventInfo.NewFileName).after_last(L'\\');
 
-						// Move source node attributes to the new node and remove the source
-						newNode.TakeItem(std::move(*sourceNode));
-						sourceNode->RemoveThisChild();
+						auto sourceLock = sourceNode->LockExclusive();
+						auto parentLock = targetNodeParent->LockExclusive();
+						if (IsAtLocation(source) && sourceNode->MoveTo(*targetNodeParent, newName))
+						{
+							const uint32_t sourceLayer = GetWinningLayer(sourceNode->GetLayers(), m_LayerPriorities);
+							sourceNode->SetVirtualDirectory(virtualDirectory);
+							sourceNode->SetLayers({WriteTargetLayer});
+							if (sourceNode->IsDirectory())
+							{
+								MoveBranchToWriteTarget(*sourceNode, sourceLayer);
+							}
+						}
+						InvalidateTreeCaches();
 
-						KxVFS_Log(LogLevel::Info, L"Successfully moved to: %1", newNode.GetFullPath());
+						KxVFS_Log(LogLevel::Info, L"Successfully moved to: %1", newTargetPath);
 						return NtStatus::Success;
 					}
 					return GetNtStatusByWin32ErrorCode(errorCode);
@@ -801,13 +1585,14 @@ namespace KxVFS
 			// Maybe it's better to cache BY_HANDLE_FILE_INFORMATION in virtual tree and just copy it here?
 			if (fileContext->GetHandle().GetInfo(eventInfo.FileHandleInfo))
 			{
+				fileContext->GetWriteBuffer().ApplyTo(eventInfo.FileHandleInfo);
 				KxVFS_Log(LogLevel::Info, L"Successfully retrieved file info by handle for: %1", eventInfo.FileName);
 				return NtStatus::Success;
 			}
 			else if (FileNode* fileNode = fileContext->GetFileNode())
 			{
 				auto lock = fileNode->LockShared();
-				fileNode->GetItem().ToBY_HANDLE_FILE_INFORMATION(eventInfo.FileHandleInfo);
+				fileNode->ToBY_HANDLE_FILE_INFORMATION(eventInfo.FileHandleInfo);
 
 				KxVFS_Log(LogLevel::Info, L"Successfully retrieved file info by node for: %1", eventInfo.FileName);
 				return NtStatus::Success;
@@ -827,9 +1612,11 @@ namespace KxVFS
 			if (FileNode* fileNode = fileContext->GetFileNode())
 			{
 				auto lock = fileNode->LockShared();
-				fileNode->WalkChildren([&eventInfo](const FileNode& node)
+				WIN32_FIND_DATAW findData = {};
+				fileNode->WalkChildren([&eventInfo, &findData](const FileNode& node)
 				{
-					return OnFileFound(eventInfo, node.GetItem().AsWIN32_FIND_DATA());
+					node.ToWIN32_FIND_DATA(findData);
+					return OnFileFound(eventInfo, findData);
 				});
 				KxVFS_Log(LogLevel::Info, L"Found %1 files", fileNode->GetChildrenCount());
 
@@ -849,13 +1636,15 @@ namespace KxVFS
 				auto lock = fileNode->LockShared();
 
 				size_t foundCount = 0;
+				WIN32_FIND_DATAW findData = {};
 				DynamicStringW pattern = Utility::StringToLower(eventInfo.SearchPattern);
-				fileNode->WalkChildren([&eventInfo, &pattern, &foundCount](const FileNode& node)
+				fileNode->WalkChildren([&eventInfo, &pattern, &foundCount, &findData](const FileNode& node)
 				{
 					const DynamicStringRefW name = node.GetNameLC();
 					if (Dokany2::DokanIsNameInExpression(pattern.data(), name.data(), FALSE))
 					{
-						OnFileFound(eventInfo, node.GetItem().AsWIN32_FIND_DATA());
+						node.ToWIN32_FIND_DATA(findData);
+						OnFileFound(eventInfo, findData);
 						foundCount++;
 					}
 					return true;
@@ -922,12 +1711,96 @@ namespace KxVFS
 		BY_HANDLE_FILE_INFORMATION fileInfo = {};
 		if (FileNode* fileNode = fileContext.GetFileNode(); fileNode && fileContext.GetHandle().GetInfo(fileInfo))
 		{
+			fileContext.GetWriteBuffer().ApplyTo(fileInfo);
 			auto lock = fileNode->LockExclusive();
 
 			KxVFS_Log(LogLevel::Info, L"%1: %2", __FUNCTIONW__, fileNode->GetFullPath());
 			fileNode->FromBY_HANDLE_FILE_INFORMATION(fileInfo);
+			fileContext.GetMetadata().OnRefreshed(Utility::LowHighToInt64(fileInfo.nFileSizeLow, fileInfo.nFileSizeHigh));
 			return true;
 		}
 		return false;
 	}
+	void ConvergenceFS::PublishMetadata(FileContext& fileContext, bool wait)
+	{
+		if (FileNode* fileNode = fileContext.GetFileNode())
+		{
+			MoveableExclusiveSRWLocker lock;
+			if (wait)
+			{
+				lock = fileNode->LockExclusive();
+			}
+			else if (!fileNode->TryLockExclusive(lock))
+			{
+				// Values stay pending, next write or the refresh on cleanup will get them to the node
+				return;
+			}
+
+			int64_t fileSize = -1;
+			FILETIME lastWriteTime = {};
+			if (fileContext.GetMetadata().TakePending(fileSize, lastWriteTime))
+			{
+				if (fileSize >= 0)
+				{
+					fileNode->SetFileSize(fileSize);
+				}
+				fileNode->SetModificationTime(lastWriteTime);
+			}
+		}
+	}
+
+	void ConvergenceFS::OnFileWritten(EvtWriteFile& eventInfo, FileContext& fileContext)
+	{
+		if (eventInfo.NumberOfBytesWritten != 0)
+		{
+			GetIOManager().InvalidateBlockCache(fileContext);
+
+			FileContextMetadata& metadata = fileContext.GetMetadata();
+			if (eventInfo.DokanFileInfo->WriteToEndOfFile)
+			{
+				metadata.OnAppended(eventInfo.NumberOfBytesWritten);
+			}
+			else
+			{
+				metadata.OnWritten(eventInfo.Offset, eventInfo.NumberOfBytesWritten);
+			}
+
+			// Writes never wait for the node, if someone holds it the values are published later
+			PublishMetadata(fileContext, false);
+			m_AvoidedAttributeUpdates.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	void ConvergenceFS::OnFileBuffersFlushed(EvtFlushFileBuffers& eventInfo, FileContext& fileContext)
+	{
+		PublishMetadata(fileContext, true);
+		m_AvoidedAttributeUpdates.fetch_add(1, std::memory_order_relaxed);
+	}
+	void ConvergenceFS::OnAllocationSizeSet(EvtSetAllocationSize& eventInfo, FileContext& fileContext)
+	{
+		GetIOManager().InvalidateBlockCache(fileContext);
+
+		FileContextMetadata& metadata = fileContext.GetMetadata();
+		if (metadata.IsFileSizeKnown())
+		{
+			// File is only truncated if the allocation size is smaller
+			if (eventInfo.Length < metadata.GetFileSize())
+			{
+				metadata.SetFileSize(eventInfo.Length);
+			}
+			PublishMetadata(fileContext, true);
+			m_AvoidedAttributeUpdates.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			UpdateAttributes(fileContext);
+		}
+	}
+	void ConvergenceFS::OnEndOfFileSet(EvtSetEndOfFile& eventInfo, FileContext& fileContext)
+	{
+		GetIOManager().InvalidateBlockCache(fileContext);
+
+		fileContext.GetMetadata().SetFileSize(eventInfo.Length);
+		PublishMetadata(fileContext, true);
+		m_AvoidedAttributeUpdates.fetch_add(1, std::memory_order_relaxed);
+	}
 }
@@ -3,6 +3,11 @@
 #include "KxVFS/DokanyFileSystem.h"
 #include "KxVFS/MirrorFS.h"
 #include "KxVFS/Utility.h"
+#include "KxVFS/Common/FileNodePathCache.h"
+#include "KxVFS/Common/FileTreeSnapshot.h"
+#include "KxVFS/Common/FileNodePathIndex.h"
+#include "KxVFS/Common/FileNodeLookupCache.h"
+#include <list>
 
 namespace KxVFS
 {
@@ -11,16 +16,113 @@ namespace KxVFS
 		private:
 			using TVirtualFoldersVector = std::vector<DynamicStringW>;
 
+			// Merged directory and IDs of the layers which have it as a directory, in priority order
+			struct PendingDirectory
+			{
+				FileNode* Node = nullptr;
+				std::vector<uint32_t> Layers;
+			};
+			using TPendingDirectories = std::vector<PendingDirectory>;
+
+			// Node and its place in the tree before a disk operation, see 'IsAtLocation'
+			struct NodeLocation
+			{
+				FileNode* Node = nullptr;
+				FileNode* Parent = nullptr;
+				DynamicStringW Path;
+			};
+
+			enum class ResolveResult
+			{
+				Updated,
+				Rebuilt,
+				Missing
+			};
+
+			// Changes of the mounted tree caused by a virtual folder change. The tree is scanned without locks first
+			// and then each change is applied under the lock of the node it changes, see 'ApplyLayerChanges'.
+			struct NodeChange
+			{
+				FileNode* Node = nullptr;
+				ResolveResult Result = ResolveResult::Updated;
+				std::vector<uint32_t> Layers;
+
+				// Info from the winning layer if it has to be taken again and the new branch if the node is rebuilt
+				uint32_t Winner = std::numeric_limits<uint32_t>::max();
+				FileItem Item;
+				std::vector<std::unique_ptr<FileNode>> Children;
+			};
+			struct AddedChildren
+			{
+				FileNode* Directory = nullptr;
+				std::vector<std::unique_ptr<FileNode>> Nodes;
+			};
+			struct LayerChanges
+			{
+				std::list<NodeChange> Nodes;
+				std::vector<AddedChildren> Added;
+			};
+
+		public:
+			static constexpr uint32_t WriteTargetLayer = 0;
+			static constexpr uint32_t InvalidLayer = std::numeric_limits<uint32_t>::max();
+
 		private:
 			TVirtualFoldersVector m_VirtualFolders;
+
+			// Layers known to the built tree indexed by their IDs, write target is always the first one.
+			// Paths of removed layers are left empty so IDs stored in the tree nodes remain valid.
+			std::vector<DynamicStringW> m_Layers;
+			std::vector<uint32_t> m_LayerPriorities;
+			FileNodeArena m_NodeArena;
 			mutable FileNode m_VirtualTree;
+			mutable FileNodePathCache m_PathCache;
+			FileNodeLookupCache m_LookupCache;
+			FileNodePathIndex m_PathIndex;
+			bool m_PathIndexEnabled = false;
+			size_t m_TreeBuildThreadCount = 0;
+			DynamicStringW m_SnapshotPath;
+			std::atomic<size_t> m_AvoidedAttributeUpdates = 0;
+
+		private:
+			uint32_t FindLayer(DynamicStringRefW path) const noexcept;
+			void UpdateLayerPriorities();
+			uint32_t GetWinningLayer(InternedLayerSet layers, const std::vector<uint32_t>& priorities) const noexcept;
+			DynamicStringW MakeLayerPath(uint32_t layer, const FileNode& node) const;
+			std::vector<uint32_t> GetDirectoryLayers(const FileNode& node, const std::vector<uint32_t>& layers) const;
+			std::vector<uint32_t> GetDirectoryLayers(const FileNode& node) const
+			{
+				return GetDirectoryLayers(node, std::vector<uint32_t>(node.GetLayers().begin(), node.GetLayers().end()));
+			}
+			void ResetLayers();
+			void InvalidateTreeCaches() noexcept;
+			bool CanUpdateTree() const noexcept;
+			void ResetTree();
+			void AttachPathIndex();
+
+			std::vector<std::unique_ptr<FileNode>> MergeDirectory(const PendingDirectory& directory, TPendingDirectories& directories);
+			void BuildBranch(PendingDirectory directory, bool isDetached = false);
+			std::vector<std::unique_ptr<FileNode>> BuildDetachedBranch(PendingDirectory directory);
+			void BuildRootDirectory();
+			ResolveResult ResolveNode(FileNode& node);
+			ResolveResult ResolveNode(FileNode& node, NodeChange& change);
+
+			NodeLocation GetNodeLocation(FileNode& node) const;
+			bool IsAtLocation(const NodeLocation& location) const;
+
+			FileNode& AddCreatedNode(FileNode& parentNode, DynamicStringRefW targetPath, DynamicStringRefW virtualDirectory);
+			void MoveBranchToWriteTarget(FileNode& directory, uint32_t sourceLayer);
+			void AddLayerTo(FileNode& directory, uint32_t layer, LayerChanges& changes);
+			void RemoveLayerFrom(FileNode& directory, uint32_t layer, LayerChanges& changes);
+			void ReorderLayerIn(FileNode& directory, uint32_t layer, const std::vector<uint32_t>& oldPriorities, LayerChanges& changes);
+			void ApplyLayerChanges(LayerChanges& changes);
 
 		protected:
 			DynamicStringW MakeFilePath(DynamicStringRefW baseDirectory, DynamicStringRefW requestedPath, bool addNamespace = false) const;
 			std::tuple<DynamicStringW, DynamicStringRefW> GetTargetPath(const FileNode* node, DynamicStringRefW requestedPath, bool addNamespace = false) const;
 			DynamicStringW DispatchLocationRequest(DynamicStringRefW requestedPath) override;
 
-			bool ProcessDeleteOnClose(Dokany2::DOKAN_FILE_INFO& fileInfo, FileNode& fileNode) const;
+			bool ProcessDeleteOnClose(Dokany2::DOKAN_FILE_INFO& fileInfo, FileNode& fileNode);
 			bool IsWriteTargetNode(const FileNode& fileNode) const;
 
 			const TVirtualFoldersVector& GetVirtualFolders() const
@@ -52,10 +154,68 @@ namespace KxVFS
 				MirrorFS::SetSource(writeTarget);
 			}
 			
+			// If the tree is already built these update only the paths provided by the affected folder,
+			// otherwise they just change the list of folders used by the next 'BuildFileTree' call.
+			// Built tree can't be changed while mounted with a locking policy other than 'LockingPolicy::Full'.
 			void AddVirtualFolder(DynamicStringRefW path);
+			bool RemoveVirtualFolder(DynamicStringRefW path);
+			bool MoveVirtualFolder(DynamicStringRefW path, size_t index);
 			void ClearVirtualFolders();
 			size_t BuildFileTree();
 
+			// Snapshot of the built tree which is used by 'Mount' instead of scanning all virtual folders when it's still valid.
+			// Empty path disables snapshots, 'BuildFileTree' writes a new snapshot every time it's called if the path is set.
+			DynamicStringRefW GetTreeSnapshotPath() const
+			{
+				return m_SnapshotPath;
+			}
+			void SetTreeSnapshotPath(DynamicStringRefW path)
+			{
+				m_SnapshotPath = path;
+			}
+			bool SaveFileTree(DynamicStringRefW filePath) const;
+			bool LoadFileTree(DynamicStringRefW filePath);
+
+			// Number of threads used to scan and merge virtual folders, zero means one per hardware thread
+			size_t GetTreeBuildThreadCount() const noexcept
+			{
+				return m_TreeBuildThreadCount;
+			}
+			void SetTreeBuildThreadCount(size_t count) noexcept
+			{
+				m_TreeBuildThreadCount = count;
+			}
+
+			// Index of full relative paths used by tree lookups instead of walking path components, takes effect immediately
+			bool IsPathIndexEnabled() const noexcept
+			{
+				return m_PathIndexEnabled;
+			}
+			void SetPathIndexEnabled(bool enabled);
+
+			// Number of remembered paths which weren't found in the tree, zero disables it.
+			// Per-thread cache of the last resolved directory is always used.
+			void SetLookupCacheCapacity(size_t capacity)
+			{
+				m_LookupCache.SetCapacity(capacity);
+			}
+			FileNodeLookupCache::Statistics GetLookupCacheStatistics() const noexcept
+			{
+				return m_LookupCache.GetStatistics();
+			}
+
+			// Zero disables caching of constructed paths
+			void SetPathCacheCapacity(size_t capacity)
+			{
+				m_PathCache.SetCapacity(capacity);
+			}
+
+			// Number of times file node attributes were updated from the file's own writes instead of asking the file system
+			size_t GetAvoidedAttributeUpdates() const noexcept
+			{
+				return m_AvoidedAttributeUpdates.load(std::memory_order_relaxed);
+			}
+
 		protected:
 			NtStatus OnCreateFile(EvtCreateFile& eventInfo) override;
 			NtStatus OnCreateFile(EvtCreateFile& eventInfo, FileNode* targetNode, FileNode* parentNode);
@@ -77,6 +237,7 @@ namespace KxVFS
 
 		protected:
 			bool UpdateAttributes(FileContext& fileContext);
+			void PublishMetadata(FileContext& fileContext, bool wait);
 
 			void OnFileClosed(EvtCloseFile& eventInfo, FileContext& fileContext) override
 			{
@@ -85,26 +246,14 @@ namespace KxVFS
 			{
 			}
 
-			void OnFileWritten(EvtWriteFile& eventInfo, FileContext& fileContext) override
-			{
-				UpdateAttributes(fileContext);
-			}
+			void OnFileWritten(EvtWriteFile& eventInfo, FileContext& fileContext) override;
 			void OnFileRead(EvtReadFile& eventInfo, FileContext& fileContext) override
 			{
 			}
 			
-			void OnFileBuffersFlushed(EvtFlushFileBuffers& eventInfo, FileContext& fileContext) override
-			{
-				UpdateAttributes(fileContext);
-			}
-			void OnAllocationSizeSet(EvtSetAllocationSize& eventInfo, FileContext& fileContext) override
-			{
-				UpdateAttributes(fileContext);
-			}
-			void OnEndOfFileSet(EvtSetEndOfFile& eventInfo, FileContext& fileContext)
-			{
-				UpdateAttributes(fileContext);
-			}
+			void OnFileBuffersFlushed(EvtFlushFileBuffers& eventInfo, FileContext& fileContext) override;
+			void OnAllocationSizeSet(EvtSetAllocationSize& eventInfo, FileContext& fileContext) override;
+			void OnEndOfFileSet(EvtSetEndOfFile& eventInfo, FileContext& fileContext) override;
 			void OnBasicFileInfoSet(EvtSetBasicFileInfo& eventInfo, FileContext& fileContext)
 			{
 				UpdateAttributes(fileContext);
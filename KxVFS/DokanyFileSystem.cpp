@@ -185,6 +185,7 @@ namespace KxVFS
 
 	FSError DokanyFileSystem::Mount()
 	{
+		m_FileContextManager.SetLockingPolicy(GetLockingPolicy());
 		if (!m_FileContextManager.Init())
 		{
 			return FSErrorCode::FileContextManagerInitFailed;
@@ -199,6 +200,19 @@ namespace KxVFS
 	{
 		return DoUnMount();
 	}
+	LockingPolicy DokanyFileSystem::GetLockingPolicy() const noexcept
+	{
+		// Async IO completions, read-ahead and write-behind timers run on thread pool threads even if requests are dispatched by a single thread
+		if ((m_Flags & FSFlags::ForceSingleThreaded) && !m_IOManager.IsAsyncIOEnabled() && !m_IOManager.IsReadAheadEnabled() && !m_IOManager.IsWriteBehindEnabled())
+		{
+			return LockingPolicy::SingleThreaded;
+		}
+		if (m_Flags & FSFlags::WriteProtected)
+		{
+			return LockingPolicy::ImmutableTree;
+		}
+		return LockingPolicy::Full;
+	}
 
 	DynamicStringW DokanyFileSystem::GetVolumeLabel() const
 	{
@@ -5,6 +5,7 @@
 #include "Misc/IncludeDokan.h"
 #include "Common/FSError.h"
 #include "Common/FSFlags.h"
+#include "Common/LockingPolicy.h"
 #include "Common/FileContext.h"
 #include "Common/AsyncIOContext.h"
 #include "Common/FileNode.h"
@@ -111,6 +112,9 @@ namespace KxVFS
 				m_Flags = flags;
 			}
 
+			// Derived from the flags and async IO state, applied when the file system is mounted
+			LockingPolicy GetLockingPolicy() const noexcept;
+
 		private:
 			NtStatus OnMountInternal(EvtMounted& eventInfo);
 			NtStatus OnUnMountInternal(EvtUnMounted& eventInfo);
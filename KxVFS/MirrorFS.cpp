@@ -348,6 +348,7 @@ namespace KxVFS
 				fileContext->MarkClosed();
 				if (fileContext->GetHandle())
 				{
+					GetIOManager().CloseWriteBuffer(*fileContext);
 					fileContext->CloseHandle();
 
 					DynamicStringW targetPath = DispatchLocationRequest(eventInfo.FileName);
@@ -383,8 +384,10 @@ namespace KxVFS
 		*/
 		if (FileContext* fileContext = GetFileContext(eventInfo))
 		{
+			NtStatus status = NtStatus::Success;
 			if (auto lock = fileContext->LockExclusive(); true)
 			{
+				status = GetIOManager().CloseWriteBuffer(*fileContext);
 				fileContext->CloseHandle();
 				fileContext->MarkCleanedUp();
 
@@ -397,7 +400,7 @@ namespace KxVFS
 					fileContext->ResetFileNode();
 				}
 			}
-			return NtStatus::Success;
+			return status;
 		}
 		return NtStatus::FileClosed;
 	}
@@ -600,6 +603,10 @@ namespace KxVFS
 	{
 		if (FileContext* fileContext = GetFileContext(eventInfo))
 		{
+			if (NtStatus status = GetIOManager().FlushWriteBuffer(*fileContext); status != NtStatus::Success)
+			{
+				return status;
+			}
 			if (fileContext->GetHandle().FlushBuffers())
 			{
 				OnFileBuffersFlushed(eventInfo, *fileContext);
@@ -613,12 +620,12 @@ namespace KxVFS
 	{
 		if (FileContext* fileContext = GetFileContext(eventInfo))
 		{
-			FileHandle& handle = fileContext->GetHandle();
-			if (!handle.Seek(eventInfo.Length, FileSeekMode::Start))
+			if (NtStatus status = GetIOManager().FlushWriteBuffer(*fileContext); status != NtStatus::Success)
 			{
-				return GetNtStatusByWin32LastErrorCode();
+				return status;
 			}
-			if (!handle.SetEnd())
+
+			if (!fileContext->GetHandle().SetEndAt(eventInfo.Length))
 			{
 				return GetNtStatusByWin32LastErrorCode();
 			}
@@ -632,20 +639,17 @@ namespace KxVFS
 	{
 		if (FileContext* fileContext = GetFileContext(eventInfo))
 		{
+			if (NtStatus status = GetIOManager().FlushWriteBuffer(*fileContext); status != NtStatus::Success)
+			{
+				return status;
+			}
+
 			FileHandle& handle = fileContext->GetHandle();
 			if (int64_t fileSize = 0; handle.GetFileSize(fileSize))
 			{
-				if (eventInfo.Length < fileSize)
+				if (eventInfo.Length < fileSize && !handle.SetEndAt(eventInfo.Length))
 				{
-					fileSize = eventInfo.Length;
-					if (!handle.Seek(fileSize, FileSeekMode::Start))
-					{
-						return GetNtStatusByWin32LastErrorCode();
-					}
-					if (!handle.SetEnd())
-					{
-						return GetNtStatusByWin32LastErrorCode();
-					}
+					return GetNtStatusByWin32LastErrorCode();
 				}
 			}
 			else
@@ -662,7 +666,11 @@ namespace KxVFS
 	{
 		if (FileContext* fileContext = GetFileContext(eventInfo))
 		{
-			if (!fileContext->GetHandle().GetInfo(eventInfo.FileHandleInfo))
+			if (fileContext->GetHandle().GetInfo(eventInfo.FileHandleInfo))
+			{
+				fileContext->GetWriteBuffer().ApplyTo(eventInfo.FileHandleInfo);
+			}
+			else
 			{
 				DynamicStringW targetPath = DispatchLocationRequest(eventInfo.FileName);
 				KxVFS_Log(LogLevel::Info, L"Couldn't get file info by handle, trying by file name: %1", targetPath);
@@ -700,6 +708,12 @@ namespace KxVFS
 		{
 			if (auto lock = fileContext->LockExclusive(); true)
 			{
+				// Buffered data would overwrite the new last write time when it's written out later
+				if (NtStatus status = GetIOManager().FlushWriteBuffer(*fileContext); status != NtStatus::Success)
+				{
+					return status;
+				}
+
 				const bool sucess = fileContext->GetHandle().SetInfo(FileBasicInfo, *eventInfo.Info);
 				const DWORD errorCode = ::GetLastError();
 
@@ -31,3 +31,7 @@
 #include "Utility/ProcessHandle.h"
 #include "Utility/CriticalSection.h"
 #include "Utility/SRWLock.h"
+#include "Utility/ParallelFor.h"
+#include "Utility/ParallelWalk.h"
+#include "Utility/EpochReclaimer.h"
+#include "Utility/ObjectPool.h"
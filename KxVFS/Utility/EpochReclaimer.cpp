@@ -0,0 +1,181 @@
+#include "stdafx.h"
+#include "EpochReclaimer.h"
+#include <thread>
+
+namespace
+{
+	using namespace KxVFS;
+
+	// Epoch value of a thread which isn't inside any guarded span
+	constexpr uint64_t QuiescentEpoch = 0;
+}
+
+namespace KxVFS
+{
+	class EpochThreadHolder final
+	{
+		public:
+			EpochReclaimer* Reclaimer = nullptr;
+			void* Record = nullptr;
+
+		public:
+			~EpochThreadHolder();
+	};
+	thread_local EpochThreadHolder g_EpochThread;
+}
+
+namespace KxVFS
+{
+	EpochReclaimer& EpochReclaimer::Get()
+	{
+		static EpochReclaimer ms_Instance;
+		return ms_Instance;
+	}
+
+	EpochReclaimer::ThreadRecord& EpochReclaimer::GetThreadRecord()
+	{
+		if (g_EpochThread.Record)
+		{
+			return *static_cast<ThreadRecord*>(g_EpochThread.Record);
+		}
+
+		// First guard on this thread, reuse a record of a finished thread if there's one
+		CriticalSectionLocker lock(m_ThreadsLock);
+		ThreadRecord* record = nullptr;
+		for (const auto& item: m_Threads)
+		{
+			if (!item->IsUsed)
+			{
+				record = item.get();
+				break;
+			}
+		}
+		if (!record)
+		{
+			record = m_Threads.emplace_back(std::make_unique<ThreadRecord>()).get();
+		}
+		record->IsUsed = true;
+
+		g_EpochThread.Reclaimer = this;
+		g_EpochThread.Record = record;
+		return *record;
+	}
+	void EpochReclaimer::ReleaseThreadRecord(ThreadRecord& record) noexcept
+	{
+		CriticalSectionLocker lock(m_ThreadsLock);
+		record.Epoch.store(QuiescentEpoch, std::memory_order_release);
+		record.Depth = 0;
+		record.IsUsed = false;
+	}
+
+	void EpochReclaimer::Enter() noexcept
+	{
+		ThreadRecord& record = GetThreadRecord();
+		if (record.Depth++ == 0)
+		{
+			// The fence orders the announcement before any read of the protected structure
+			record.Epoch.store(m_Epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+		}
+	}
+	void EpochReclaimer::Leave() noexcept
+	{
+		ThreadRecord& record = *static_cast<ThreadRecord*>(g_EpochThread.Record);
+		if (--record.Depth == 0)
+		{
+			record.Epoch.store(QuiescentEpoch, std::memory_order_release);
+		}
+	}
+
+	uint64_t EpochReclaimer::GetMinActiveEpoch() noexcept
+	{
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		uint64_t minEpoch = m_Epoch.load(std::memory_order_seq_cst);
+		CriticalSectionLocker lock(m_ThreadsLock);
+		for (const auto& record: m_Threads)
+		{
+			const uint64_t epoch = record->Epoch.load(std::memory_order_seq_cst);
+			if (epoch != QuiescentEpoch && epoch < minEpoch)
+			{
+				minEpoch = epoch;
+			}
+		}
+		return minEpoch;
+	}
+	void EpochReclaimer::DestroyRetired(uint64_t epoch) noexcept
+	{
+		// Objects retired before the epoch can't be seen by anyone, destroy them outside of the lock
+		std::vector<RetiredObject> objects;
+		if (CriticalSectionLocker lock(m_RetiredLock); true)
+		{
+			auto it = std::partition(m_Retired.begin(), m_Retired.end(), [epoch](const RetiredObject& object)
+			{
+				return object.Epoch >= epoch;
+			});
+			objects.assign(it, m_Retired.end());
+			m_Retired.erase(it, m_Retired.end());
+		}
+
+		for (const RetiredObject& object: objects)
+		{
+			object.Deleter(object.Object);
+		}
+	}
+
+	EpochReclaimer::~EpochReclaimer()
+	{
+		DestroyRetired(std::numeric_limits<uint64_t>::max());
+	}
+
+	void EpochReclaimer::Retire(void* object, TDeleter deleter)
+	{
+		bool shouldReclaim = false;
+		if (CriticalSectionLocker lock(m_RetiredLock); true)
+		{
+			m_Retired.push_back({object, deleter, m_Epoch.load(std::memory_order_seq_cst)});
+			if (++m_RetiredSinceReclaim >= ReclaimThreshold)
+			{
+				m_RetiredSinceReclaim = 0;
+				shouldReclaim = true;
+			}
+		}
+
+		if (shouldReclaim)
+		{
+			TryReclaim();
+		}
+	}
+	void EpochReclaimer::TryReclaim() noexcept
+	{
+		// Advance the epoch if every active reader has caught up with it, so objects retired
+		// in the current epoch become reclaimable once these readers leave.
+		uint64_t epoch = m_Epoch.load(std::memory_order_seq_cst);
+		const uint64_t minEpoch = GetMinActiveEpoch();
+		if (minEpoch == epoch)
+		{
+			m_Epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+		}
+		DestroyRetired(minEpoch);
+	}
+	void EpochReclaimer::Synchronize() noexcept
+	{
+		const uint64_t epoch = m_Epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+		while (GetMinActiveEpoch() < epoch)
+		{
+			std::this_thread::yield();
+		}
+		DestroyRetired(epoch);
+	}
+}
+
+namespace KxVFS
+{
+	EpochThreadHolder::~EpochThreadHolder()
+	{
+		if (Reclaimer && Record)
+		{
+			Reclaimer->ReleaseThreadRecord(*static_cast<EpochReclaimer::ThreadRecord*>(Record));
+		}
+	}
+}
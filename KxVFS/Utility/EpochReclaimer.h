@@ -0,0 +1,108 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "CriticalSection.h"
+#include <atomic>
+
+namespace KxVFS
+{
+	// Epoch-based reclamation for structures read without locks. Readers mark the span where they can hold pointers
+	// into a shared structure with 'EpochGuard', which only writes to the calling thread's own record. Writers unlink
+	// an object and retire it, it's destroyed once every thread that could have seen it has left its guarded span.
+	class EpochReclaimer final
+	{
+		friend class EpochGuard;
+		friend class EpochThreadHolder;
+
+		public:
+			using TDeleter = void(*)(void*);
+
+		private:
+			// Aligned to a cache line so readers of different threads never write to the same one
+			struct alignas(64) ThreadRecord
+			{
+				std::atomic<uint64_t> Epoch = 0;
+				size_t Depth = 0;
+				bool IsUsed = false;
+			};
+			struct RetiredObject
+			{
+				void* Object = nullptr;
+				TDeleter Deleter = nullptr;
+				uint64_t Epoch = 0;
+			};
+
+			// Number of retired objects after which a reclamation attempt is made
+			static constexpr size_t ReclaimThreshold = 128;
+
+		public:
+			static EpochReclaimer& Get();
+
+		private:
+			std::atomic<uint64_t> m_Epoch = 1;
+
+			std::vector<std::unique_ptr<ThreadRecord>> m_Threads;
+			CriticalSection m_ThreadsLock;
+
+			std::vector<RetiredObject> m_Retired;
+			size_t m_RetiredSinceReclaim = 0;
+			CriticalSection m_RetiredLock;
+
+		private:
+			ThreadRecord& GetThreadRecord();
+			void ReleaseThreadRecord(ThreadRecord& record) noexcept;
+
+			void Enter() noexcept;
+			void Leave() noexcept;
+
+			uint64_t GetMinActiveEpoch() noexcept;
+			void DestroyRetired(uint64_t epoch) noexcept;
+
+		public:
+			EpochReclaimer() = default;
+			EpochReclaimer(const EpochReclaimer&) = delete;
+			~EpochReclaimer();
+
+		public:
+			// Object must be unreachable for new readers by the time it's retired
+			void Retire(void* object, TDeleter deleter);
+
+			template<class T>
+			void Retire(T* object)
+			{
+				Retire(object, [](void* ptr)
+				{
+					delete static_cast<T*>(ptr);
+				});
+			}
+
+			// Destroys retired objects no reader can see anymore, never waits
+			void TryReclaim() noexcept;
+
+			// Waits until all readers have left spans they were in and destroys everything retired before the call.
+			// Must not be called from inside an 'EpochGuard'.
+			void Synchronize() noexcept;
+
+		public:
+			EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+	};
+}
+
+namespace KxVFS
+{
+	class EpochGuard final
+	{
+		public:
+			EpochGuard() noexcept
+			{
+				EpochReclaimer::Get().Enter();
+			}
+			EpochGuard(const EpochGuard&) = delete;
+			~EpochGuard() noexcept
+			{
+				EpochReclaimer::Get().Leave();
+			}
+
+		public:
+			EpochGuard& operator=(const EpochGuard&) = delete;
+	};
+}
@@ -104,3 +104,41 @@ namespace KxVFS
 		return ::UnlockFile(m_Handle, offsetLowPart, offsetHighPart, lengthLowPart, lengthHighPart);
 	}
 }
+
+namespace KxVFS
+{
+	bool FileHandle::WaitPositionalIO(OVERLAPPED& overlapped, DWORD& bytesTransferred) noexcept
+	{
+		// Handle is opened for overlapped IO and the operation is still in progress
+		return ::GetLastError() == ERROR_IO_PENDING && ::GetOverlappedResult(m_Handle, &overlapped, &bytesTransferred, TRUE);
+	}
+
+	bool FileHandle::ReadAt(int64_t offset, void* buffer, DWORD bytesToRead, DWORD& bytesRead) noexcept
+	{
+		OVERLAPPED overlapped = {};
+		Utility::Int64ToOverlappedOffset(offset, overlapped);
+
+		bytesRead = 0;
+		if (Read(buffer, bytesToRead, bytesRead, &overlapped) || WaitPositionalIO(overlapped, bytesRead))
+		{
+			return true;
+		}
+
+		// Unlike the regular read, the positional one fails at the end of the file
+		if (::GetLastError() == ERROR_HANDLE_EOF)
+		{
+			bytesRead = 0;
+			::SetLastError(ERROR_SUCCESS);
+			return true;
+		}
+		return false;
+	}
+	bool FileHandle::WriteAt(int64_t offset, const void* buffer, DWORD bytesToWrite, DWORD& bytesWritten) noexcept
+	{
+		OVERLAPPED overlapped = {};
+		Utility::Int64ToOverlappedOffset(offset, overlapped);
+
+		bytesWritten = 0;
+		return Write(buffer, bytesToWrite, bytesWritten, &overlapped) || WaitPositionalIO(overlapped, bytesWritten);
+	}
+}
@@ -21,6 +21,13 @@ namespace KxVFS
 	{
 		friend class TWrapper;
 
+		public:
+			// Offset for 'WriteAt' which appends to the end of the file
+			static constexpr int64_t EndOfFile = -1;
+
+		private:
+			bool WaitPositionalIO(OVERLAPPED& overlapped, DWORD& bytesTransferred) noexcept;
+
 		public:
 			FileHandle(THandle fileHandle = GetInvalidHandle()) noexcept
 				:GenericHandle(fileHandle)
@@ -120,6 +127,20 @@ namespace KxVFS
 				return ::SetEndOfFile(m_Handle);
 			}
 
+			// Read and write at the given offset instead of the file pointer, which isn't used or changed. They're meant for handles
+			// opened for synchronous IO, with an overlapped handle they wait for the operation to complete. Reading at or past
+			// the end of the file succeeds and reads nothing, same as 'Read' does for synchronous handles.
+			bool ReadAt(int64_t offset, void* buffer, DWORD bytesToRead, DWORD& bytesRead) noexcept;
+			bool WriteAt(int64_t offset, const void* buffer, DWORD bytesToWrite, DWORD& bytesWritten) noexcept;
+
+			bool SetEndAt(int64_t offset) noexcept
+			{
+				FILE_END_OF_FILE_INFO endOfFileInfo = {};
+				endOfFileInfo.EndOfFile.QuadPart = offset;
+
+				return SetInfo(FileEndOfFileInfo, endOfFileInfo);
+			}
+
 			bool Lock(int64_t offset, int64_t length) noexcept;
 			bool Unlock(int64_t offset, int64_t length) noexcept;
 	};
@@ -0,0 +1,121 @@
+#include "stdafx.h"
+#include "KxVFS/Utility.h"
+#include "LockStatistics.h"
+
+namespace
+{
+	int64_t QueryCounter() noexcept
+	{
+		LARGE_INTEGER value = {};
+		::QueryPerformanceCounter(&value);
+		return value.QuadPart;
+	}
+	size_t GetBucketIndex(uint64_t microseconds) noexcept
+	{
+		size_t index = 0;
+		while (microseconds != 0 && index + 1 < KxVFS::LockStatistics::BucketCount)
+		{
+			microseconds >>= 1;
+			index++;
+		}
+		return index;
+	}
+}
+
+namespace KxVFS
+{
+	uint64_t LockStatistics::HoldTimes::GetPercentile(double fraction) const noexcept
+	{
+		const size_t rank = static_cast<size_t>(fraction * Count);
+		size_t count = 0;
+		for (size_t i = 0; i < BucketCount; i++)
+		{
+			count += Buckets[i];
+			if (count > rank)
+			{
+				return std::min(uint64_t(1) << i, MaxMicroseconds);
+			}
+		}
+		return MaxMicroseconds;
+	}
+
+	void LockStatistics::Counters::Add(uint64_t microseconds) noexcept
+	{
+		Count.fetch_add(1, std::memory_order_relaxed);
+		TotalMicroseconds.fetch_add(microseconds, std::memory_order_relaxed);
+		Buckets[GetBucketIndex(microseconds)].fetch_add(1, std::memory_order_relaxed);
+
+		uint64_t max = MaxMicroseconds.load(std::memory_order_relaxed);
+		while (microseconds > max && !MaxMicroseconds.compare_exchange_weak(max, microseconds, std::memory_order_relaxed))
+		{
+		}
+	}
+	void LockStatistics::Counters::Reset() noexcept
+	{
+		Count = 0;
+		TotalMicroseconds = 0;
+		MaxMicroseconds = 0;
+		for (auto& bucket: Buckets)
+		{
+			bucket = 0;
+		}
+	}
+	LockStatistics::HoldTimes LockStatistics::Counters::Get() const noexcept
+	{
+		HoldTimes holdTimes;
+		holdTimes.Count = Count.load(std::memory_order_relaxed);
+		holdTimes.TotalMicroseconds = TotalMicroseconds.load(std::memory_order_relaxed);
+		holdTimes.MaxMicroseconds = MaxMicroseconds.load(std::memory_order_relaxed);
+		for (size_t i = 0; i < BucketCount; i++)
+		{
+			holdTimes.Buckets[i] = Buckets[i].load(std::memory_order_relaxed);
+		}
+		return holdTimes;
+	}
+}
+
+namespace KxVFS
+{
+	LockStatistics& LockStatistics::Get() noexcept
+	{
+		static LockStatistics ms_Instance;
+		return ms_Instance;
+	}
+
+	LockStatistics::LockStatistics() noexcept
+	{
+		LARGE_INTEGER frequency = {};
+		if (::QueryPerformanceFrequency(&frequency) && frequency.QuadPart > 0)
+		{
+			m_Frequency = frequency.QuadPart;
+		}
+	}
+
+	LockStatistics::Statistics LockStatistics::GetStatistics() const noexcept
+	{
+		Statistics statistics;
+		statistics.Shared = m_Shared.Get();
+		statistics.Exclusive = m_Exclusive.Get();
+		return statistics;
+	}
+	void LockStatistics::Reset() noexcept
+	{
+		m_Shared.Reset();
+		m_Exclusive.Reset();
+	}
+
+	int64_t LockStatistics::OnAcquired() const noexcept
+	{
+		return IsEnabled() ? QueryCounter() : 0;
+	}
+	void LockStatistics::OnReleased(int64_t acquiredAt, bool isExclusive) noexcept
+	{
+		if (acquiredAt != 0)
+		{
+			const int64_t ticks = std::max<int64_t>(QueryCounter() - acquiredAt, 0);
+			const uint64_t microseconds = static_cast<uint64_t>(ticks) * 1000000 / static_cast<uint64_t>(m_Frequency);
+
+			(isExclusive ? m_Exclusive : m_Shared).Add(microseconds);
+		}
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Misc/IncludeWindows.h"
+#include <atomic>
+
+namespace KxVFS
+{
+	// Hold times of 'SRWLock' lockers, both shared and exclusive. Disabled by default, when enabled each locker
+	// reads the performance counter once when the lock is acquired and once when it's released.
+	// Times are collected into power of two buckets in microseconds: [0, 1), [1, 2), [2, 4) and so on.
+	class KxVFS_API LockStatistics final
+	{
+		public:
+			static constexpr size_t BucketCount = 24;
+
+			struct HoldTimes
+			{
+				size_t Count = 0;
+				uint64_t TotalMicroseconds = 0;
+				uint64_t MaxMicroseconds = 0;
+				size_t Buckets[BucketCount] = {};
+
+				// Upper bound of the bucket the given fraction of the samples falls into, in microseconds
+				uint64_t GetPercentile(double fraction) const noexcept;
+				uint64_t GetAverage() const noexcept
+				{
+					return Count != 0 ? TotalMicroseconds / Count : 0;
+				}
+			};
+			struct Statistics
+			{
+				HoldTimes Shared;
+				HoldTimes Exclusive;
+			};
+
+		private:
+			struct alignas(64) Counters
+			{
+				std::atomic<size_t> Count = 0;
+				std::atomic<uint64_t> TotalMicroseconds = 0;
+				std::atomic<uint64_t> MaxMicroseconds = 0;
+				std::atomic<size_t> Buckets[BucketCount] = {};
+
+				void Add(uint64_t microseconds) noexcept;
+				void Reset() noexcept;
+				HoldTimes Get() const noexcept;
+			};
+
+		public:
+			static LockStatistics& Get() noexcept;
+
+		private:
+			std::atomic<bool> m_Enabled = false;
+			int64_t m_Frequency = 1;
+			Counters m_Shared;
+			Counters m_Exclusive;
+
+		public:
+			LockStatistics() noexcept;
+			LockStatistics(const LockStatistics&) = delete;
+
+		public:
+			bool IsEnabled() const noexcept
+			{
+				return m_Enabled.load(std::memory_order_relaxed);
+			}
+			void SetEnabled(bool enabled) noexcept
+			{
+				m_Enabled.store(enabled, std::memory_order_relaxed);
+			}
+
+			Statistics GetStatistics() const noexcept;
+			void Reset() noexcept;
+
+		public:
+			// Returns zero if collection is disabled
+			int64_t OnAcquired() const noexcept;
+
+			// Does nothing if 'acquiredAt' is zero
+			void OnReleased(int64_t acquiredAt, bool isExclusive) noexcept;
+
+		public:
+			LockStatistics& operator=(const LockStatistics&) = delete;
+	};
+}
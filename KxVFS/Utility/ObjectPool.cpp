@@ -0,0 +1,247 @@
+#include "stdafx.h"
+#include "KxVFS/Utility.h"
+#include "ObjectPool.h"
+#include <thread>
+
+namespace
+{
+	size_t GetThreadIndex() noexcept
+	{
+		static std::atomic<size_t> g_NextIndex = 0;
+		thread_local const size_t index = g_NextIndex.fetch_add(1, std::memory_order_relaxed);
+
+		return index;
+	}
+}
+
+namespace KxVFS
+{
+	class BasicObjectPool::SlotLocker final
+	{
+		private:
+			ThreadSlot& m_Slot;
+
+		public:
+			SlotLocker(ThreadSlot& slot) noexcept
+				:m_Slot(slot)
+			{
+				// Slots are per-thread, so this only spins if there are more threads than slots
+				while (m_Slot.Busy.test_and_set(std::memory_order_acquire))
+				{
+					std::this_thread::yield();
+				}
+			}
+			~SlotLocker() noexcept
+			{
+				m_Slot.Busy.clear(std::memory_order_release);
+			}
+	};
+}
+
+namespace KxVFS
+{
+	BasicObjectPool::ThreadSlot& BasicObjectPool::GetThreadSlot() const noexcept
+	{
+		return m_Slots[GetThreadIndex() & m_SlotMask];
+	}
+	BasicObjectPool::Magazine* BasicObjectPool::PopMagazine(SLIST_HEADER& list) noexcept
+	{
+		// 'Entry' is the first member
+		return reinterpret_cast<Magazine*>(::InterlockedPopEntrySList(&list));
+	}
+	void BasicObjectPool::PushMagazine(SLIST_HEADER& list, Magazine& magazine) noexcept
+	{
+		::InterlockedPushEntrySList(&list, &magazine.Entry);
+	}
+	BasicObjectPool::Magazine* BasicObjectPool::GetEmptyMagazine() noexcept
+	{
+		if (Magazine* magazine = PopMagazine(m_EmptyMagazines))
+		{
+			return magazine;
+		}
+		return new(std::nothrow) Magazine();
+	}
+
+	void BasicObjectPool::PutToDepot(Magazine& magazine) noexcept
+	{
+		if (m_DepotCount.load(std::memory_order_relaxed) + magazine.Count > m_HighWaterMark)
+		{
+			m_Trimmed.fetch_add(magazine.Count, std::memory_order_relaxed);
+			DestroyItems(magazine);
+			PushMagazine(m_EmptyMagazines, magazine);
+		}
+		else
+		{
+			const size_t depotCount = m_DepotCount.fetch_add(magazine.Count, std::memory_order_relaxed) + magazine.Count;
+			PushMagazine(m_FullMagazines, magazine);
+
+			size_t peak = m_PeakPooled.load(std::memory_order_relaxed);
+			while (depotCount > peak && !m_PeakPooled.compare_exchange_weak(peak, depotCount, std::memory_order_relaxed))
+			{
+			}
+		}
+	}
+	void BasicObjectPool::DestroyMagazine(Magazine* magazine) noexcept
+	{
+		if (magazine)
+		{
+			DestroyItems(*magazine);
+			delete magazine;
+		}
+	}
+	void BasicObjectPool::DestroyItems(Magazine& magazine) noexcept
+	{
+		for (size_t i = 0; i < magazine.Count; i++)
+		{
+			DestroyObject(magazine.Items[i]);
+			magazine.Items[i] = nullptr;
+		}
+		magazine.Count = 0;
+	}
+
+	void* BasicObjectPool::PopObject() noexcept
+	{
+		ThreadSlot& slot = GetThreadSlot();
+		SlotLocker lock(slot);
+
+		if (!slot.Loaded || slot.Loaded->IsEmpty())
+		{
+			if (slot.Previous && slot.Previous->IsFull())
+			{
+				std::swap(slot.Loaded, slot.Previous);
+			}
+			else if (Magazine* magazine = PopMagazine(m_FullMagazines))
+			{
+				m_DepotCount.fetch_sub(magazine->Count, std::memory_order_relaxed);
+				if (slot.Previous)
+				{
+					PushMagazine(m_EmptyMagazines, *slot.Previous);
+				}
+				slot.Previous = slot.Loaded;
+				slot.Loaded = magazine;
+			}
+			else
+			{
+				slot.Misses++;
+				return nullptr;
+			}
+		}
+
+		slot.Hits++;
+		return std::exchange(slot.Loaded->Items[--slot.Loaded->Count], nullptr);
+	}
+	void BasicObjectPool::PushObject(void* object) noexcept
+	{
+		ThreadSlot& slot = GetThreadSlot();
+		SlotLocker lock(slot);
+
+		if (!slot.Loaded || slot.Loaded->IsFull())
+		{
+			if (slot.Previous && slot.Previous->IsEmpty())
+			{
+				std::swap(slot.Loaded, slot.Previous);
+			}
+			else if (Magazine* magazine = GetEmptyMagazine())
+			{
+				if (slot.Previous)
+				{
+					PutToDepot(*slot.Previous);
+				}
+				slot.Previous = slot.Loaded;
+				slot.Loaded = magazine;
+			}
+			else
+			{
+				DestroyObject(object);
+				return;
+			}
+		}
+		slot.Loaded->Items[slot.Loaded->Count++] = object;
+	}
+	void BasicObjectPool::AddObjects(void** objects, size_t count) noexcept
+	{
+		if (count != 0)
+		{
+			Magazine* magazine = GetEmptyMagazine();
+			if (!magazine)
+			{
+				for (size_t i = 0; i < count; i++)
+				{
+					DestroyObject(objects[i]);
+				}
+				return;
+			}
+
+			std::copy_n(objects, count, magazine->Items);
+			magazine->Count = count;
+
+			m_DepotCount.fetch_add(count, std::memory_order_relaxed);
+			PushMagazine(m_FullMagazines, *magazine);
+		}
+	}
+
+	BasicObjectPool::BasicObjectPool(size_t highWaterMark)
+		:m_HighWaterMark(highWaterMark)
+	{
+		size_t slotCount = 2;
+		while (slotCount < 2 * std::thread::hardware_concurrency() && slotCount < 256)
+		{
+			slotCount *= 2;
+		}
+		m_Slots = std::make_unique<ThreadSlot[]>(slotCount);
+		m_SlotMask = slotCount - 1;
+
+		::InitializeSListHead(&m_FullMagazines);
+		::InitializeSListHead(&m_EmptyMagazines);
+	}
+
+	BasicObjectPool::Statistics BasicObjectPool::GetStatistics() const noexcept
+	{
+		Statistics statistics;
+		statistics.Trimmed = m_Trimmed.load(std::memory_order_relaxed);
+		statistics.Pooled = m_DepotCount.load(std::memory_order_relaxed);
+		statistics.PeakPooled = m_PeakPooled.load(std::memory_order_relaxed);
+
+		for (size_t i = 0; i <= m_SlotMask; i++)
+		{
+			ThreadSlot& slot = m_Slots[i];
+			SlotLocker lock(slot);
+
+			statistics.Hits += slot.Hits;
+			statistics.Misses += slot.Misses;
+			for (const Magazine* magazine: {slot.Loaded, slot.Previous})
+			{
+				if (magazine)
+				{
+					statistics.Pooled += magazine->Count;
+				}
+			}
+		}
+		statistics.PeakPooled = std::max(statistics.PeakPooled, statistics.Pooled);
+		return statistics;
+	}
+	void BasicObjectPool::Clear() noexcept
+	{
+		for (size_t i = 0; i <= m_SlotMask; i++)
+		{
+			ThreadSlot& slot = m_Slots[i];
+			SlotLocker lock(slot);
+
+			DestroyMagazine(std::exchange(slot.Loaded, nullptr));
+			DestroyMagazine(std::exchange(slot.Previous, nullptr));
+		}
+
+		for (SLIST_HEADER* list: {&m_FullMagazines, &m_EmptyMagazines})
+		{
+			SLIST_ENTRY* entry = ::InterlockedFlushSList(list);
+			while (entry)
+			{
+				Magazine* magazine = reinterpret_cast<Magazine*>(entry);
+				entry = entry->Next;
+
+				DestroyMagazine(magazine);
+			}
+		}
+		m_DepotCount = 0;
+	}
+}
@@ -0,0 +1,174 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "KxVFS/Misc/IncludeWindows.h"
+#include <atomic>
+#include <functional>
+
+namespace KxVFS
+{
+	// Untyped part of 'ObjectPool'. Objects are cached in fixed size magazines. Each thread has a slot with two magazines
+	// and exchanges full or empty ones with the depot, two lock-free lists shared by all threads, so the depot is only
+	// touched once per 'MagazineSize' operations. Full magazines are destroyed instead of being put into the depot
+	// when it already holds more objects than the high-water mark.
+	class KxVFS_API BasicObjectPool
+	{
+		public:
+			static constexpr size_t MagazineSize = 32;
+
+			struct Statistics
+			{
+				size_t Hits = 0;
+				size_t Misses = 0;
+				size_t Trimmed = 0;
+				size_t Pooled = 0;
+				size_t PeakPooled = 0;
+			};
+
+		private:
+			struct alignas(MEMORY_ALLOCATION_ALIGNMENT) Magazine
+			{
+				SLIST_ENTRY Entry = {};
+				size_t Count = 0;
+				void* Items[MagazineSize] = {};
+
+				bool IsEmpty() const noexcept
+				{
+					return Count == 0;
+				}
+				bool IsFull() const noexcept
+				{
+					return Count == MagazineSize;
+				}
+			};
+			struct alignas(64) ThreadSlot
+			{
+				std::atomic_flag Busy = ATOMIC_FLAG_INIT;
+				Magazine* Loaded = nullptr;
+				Magazine* Previous = nullptr;
+
+				size_t Hits = 0;
+				size_t Misses = 0;
+			};
+			class SlotLocker;
+
+		private:
+			SLIST_HEADER m_FullMagazines;
+			SLIST_HEADER m_EmptyMagazines;
+			std::unique_ptr<ThreadSlot[]> m_Slots;
+			size_t m_SlotMask = 0;
+
+			std::atomic<size_t> m_DepotCount = 0;
+			std::atomic<size_t> m_PeakPooled = 0;
+			std::atomic<size_t> m_Trimmed = 0;
+			size_t m_HighWaterMark = 0;
+
+		private:
+			ThreadSlot& GetThreadSlot() const noexcept;
+			Magazine* PopMagazine(SLIST_HEADER& list) noexcept;
+			void PushMagazine(SLIST_HEADER& list, Magazine& magazine) noexcept;
+			Magazine* GetEmptyMagazine() noexcept;
+
+			void PutToDepot(Magazine& magazine) noexcept;
+			void DestroyMagazine(Magazine* magazine) noexcept;
+			void DestroyItems(Magazine& magazine) noexcept;
+
+		protected:
+			virtual void DestroyObject(void* object) noexcept = 0;
+
+			void* PopObject() noexcept;
+			void PushObject(void* object) noexcept;
+			void AddObjects(void** objects, size_t count) noexcept;
+
+		public:
+			BasicObjectPool(size_t highWaterMark);
+			BasicObjectPool(const BasicObjectPool&) = delete;
+			virtual ~BasicObjectPool() = default;
+
+		public:
+			size_t GetHighWaterMark() const noexcept
+			{
+				return m_HighWaterMark;
+			}
+			void SetHighWaterMark(size_t count) noexcept
+			{
+				m_HighWaterMark = count;
+			}
+			Statistics GetStatistics() const noexcept;
+
+			// Destroys all cached objects, must not be called concurrently with other functions
+			void Clear() noexcept;
+
+		public:
+			BasicObjectPool& operator=(const BasicObjectPool&) = delete;
+	};
+}
+
+namespace KxVFS
+{
+	// Cache of unused objects owned by the pool. Object is destroyed with the deleter when the pool gets rid of it.
+	template<class T>
+	class ObjectPool final: public BasicObjectPool
+	{
+		public:
+			using TDeleter = std::function<void(T*)>;
+
+		private:
+			TDeleter m_Deleter;
+
+		protected:
+			void DestroyObject(void* object) noexcept override
+			{
+				std::invoke(m_Deleter, static_cast<T*>(object));
+			}
+
+		public:
+			ObjectPool(TDeleter deleter, size_t highWaterMark = 1024)
+				:BasicObjectPool(highWaterMark), m_Deleter(std::move(deleter))
+			{
+			}
+			~ObjectPool()
+			{
+				Clear();
+			}
+
+		public:
+			// Returns null if there are no cached objects
+			T* Pop() noexcept
+			{
+				return static_cast<T*>(PopObject());
+			}
+			void Push(T& object) noexcept
+			{
+				PushObject(&object);
+			}
+
+			// Creates up to 'count' objects with 'func()' directly into the shared depot, stops at first null
+			template<class TFunc>
+			size_t Reserve(size_t count, TFunc&& func)
+			{
+				size_t created = 0;
+				while (created < count)
+				{
+					void* objects[MagazineSize] = {};
+					size_t batch = 0;
+					for (; batch < MagazineSize && created + batch < count; batch++)
+					{
+						T* object = std::invoke(func);
+						if (!object)
+						{
+							break;
+						}
+						objects[batch] = object;
+					}
+
+					AddObjects(objects, batch);
+					created += batch;
+					if (batch != MagazineSize)
+					{
+						break;
+					}
+				}
+				return created;
+			}
+	};
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include <thread>
+#include <atomic>
+#include <exception>
+
+namespace KxVFS::Utility
+{
+	inline size_t GetHardwareThreadCount() noexcept
+	{
+		return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	}
+
+	// Calls 'func(index)' for every index in [0, count) using up to 'threadCount' threads, zero means one per hardware thread.
+	// Indices are handed out one at a time so uneven items balance out. Calling thread does its share of the work too.
+	// If any call throws, remaining indices are skipped and the first exception is rethrown after all threads are done.
+	template<class TFunc>
+	void ParallelFor(size_t count, size_t threadCount, TFunc&& func)
+	{
+		if (threadCount == 0)
+		{
+			threadCount = GetHardwareThreadCount();
+		}
+		threadCount = std::min(threadCount, count);
+
+		if (threadCount <= 1)
+		{
+			for (size_t i = 0; i < count; i++)
+			{
+				func(i);
+			}
+			return;
+		}
+
+		std::atomic<size_t> nextIndex = 0;
+		std::atomic<bool> isFailed = false;
+		std::exception_ptr exception;
+		auto Worker = [&]()
+		{
+			for (size_t i = nextIndex++; i < count && !isFailed; i = nextIndex++)
+			{
+				try
+				{
+					func(i);
+				}
+				catch (...)
+				{
+					if (!isFailed.exchange(true))
+					{
+						exception = std::current_exception();
+					}
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		threads.reserve(threadCount - 1);
+		for (size_t i = 0; i + 1 < threadCount; i++)
+		{
+			threads.emplace_back(Worker);
+		}
+		Worker();
+
+		for (std::thread& thread: threads)
+		{
+			thread.join();
+		}
+		if (exception)
+		{
+			std::rethrow_exception(exception);
+		}
+	}
+}
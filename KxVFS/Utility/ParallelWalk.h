@@ -0,0 +1,179 @@
+#pragma once
+#include "KxVFS/Common.hpp"
+#include "CriticalSection.h"
+#include "ParallelFor.h"
+#include <deque>
+
+namespace KxVFS::Utility
+{
+	// Walks a tree of items starting from 'roots' using up to 'threadCount' threads, zero means one per hardware thread.
+	// 'func(workerIndex, item, stack)' processes an item, appends its children to 'stack' and returns false to stop the walk.
+	// Every thread walks its own stack depth first. While some threads are idle busy ones move the older half of their stacks,
+	// usually the biggest subtrees, into their shared queues and idle threads steal from there. So locks are only taken to exchange work.
+	// If any call throws, the walk stops and the first exception is rethrown after all threads are done.
+	// Returns false if the walk was stopped.
+	template<class TItem, class TFunc>
+	bool ParallelWalk(std::vector<TItem> roots, size_t threadCount, TFunc&& func)
+	{
+		if (threadCount == 0)
+		{
+			threadCount = GetHardwareThreadCount();
+		}
+
+		if (threadCount <= 1)
+		{
+			std::vector<TItem> stack = std::move(roots);
+			while (!stack.empty())
+			{
+				TItem item = std::move(stack.back());
+				stack.pop_back();
+
+				if (!func(size_t(0), std::move(item), stack))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		struct alignas(64) SharedQueue
+		{
+			CriticalSection Lock;
+			std::deque<TItem> Items;
+			std::atomic<size_t> Size = 0;
+		};
+		auto queues = std::make_unique<SharedQueue[]>(threadCount);
+		for (size_t i = 0; i < roots.size(); i++)
+		{
+			SharedQueue& queue = queues[i % threadCount];
+			queue.Items.push_back(std::move(roots[i]));
+			queue.Size++;
+		}
+
+		std::atomic<size_t> idleCount = 0;
+		std::atomic<bool> isStopped = false;
+		std::atomic<bool> isFailed = false;
+		std::exception_ptr exception;
+
+		auto TryTake = [&queues](size_t index, TItem& item)
+		{
+			SharedQueue& queue = queues[index];
+			CriticalSectionLocker lock(queue.Lock);
+			if (!queue.Items.empty())
+			{
+				// Oldest items are closest to the roots
+				item = std::move(queue.Items.front());
+				queue.Items.pop_front();
+				queue.Size--;
+				return true;
+			}
+			return false;
+		};
+		auto Share = [&queues](size_t index, std::vector<TItem>& stack)
+		{
+			SharedQueue& queue = queues[index];
+			const size_t count = stack.size() / 2;
+
+			CriticalSectionLocker lock(queue.Lock);
+			std::move(stack.begin(), stack.begin() + count, std::back_inserter(queue.Items));
+			queue.Size += count;
+			stack.erase(stack.begin(), stack.begin() + count);
+		};
+		auto Worker = [&](size_t workerIndex)
+		{
+			std::vector<TItem> stack;
+			bool isIdle = false;
+
+			while (!isStopped.load(std::memory_order_relaxed))
+			{
+				if (!stack.empty())
+				{
+					TItem item = std::move(stack.back());
+					stack.pop_back();
+
+					try
+					{
+						if (!func(workerIndex, std::move(item), stack))
+						{
+							isStopped = true;
+							return;
+						}
+					}
+					catch (...)
+					{
+						if (!isFailed.exchange(true))
+						{
+							exception = std::current_exception();
+						}
+						isStopped = true;
+						return;
+					}
+
+					if (stack.size() > 1 && idleCount.load(std::memory_order_relaxed) != 0 && queues[workerIndex].Size.load(std::memory_order_relaxed) == 0)
+					{
+						Share(workerIndex, stack);
+					}
+					continue;
+				}
+
+				// Own queue first, then the others'. Thread stops being idle before it takes anything, so when
+				// all threads are idle at the same time there's no work left anywhere and the walk is done.
+				bool isTaken = false;
+				for (size_t i = 0; i < threadCount && !isTaken; i++)
+				{
+					const size_t index = (workerIndex + i) % threadCount;
+					if (queues[index].Size.load(std::memory_order_acquire) != 0)
+					{
+						if (isIdle)
+						{
+							idleCount--;
+							isIdle = false;
+						}
+
+						TItem item = {};
+						if (TryTake(index, item))
+						{
+							stack.push_back(std::move(item));
+							isTaken = true;
+						}
+					}
+				}
+
+				if (!isTaken)
+				{
+					if (!isIdle)
+					{
+						isIdle = true;
+						if (++idleCount == threadCount)
+						{
+							return;
+						}
+					}
+					else if (idleCount.load() == threadCount)
+					{
+						return;
+					}
+					std::this_thread::yield();
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		threads.reserve(threadCount - 1);
+		for (size_t i = 1; i < threadCount; i++)
+		{
+			threads.emplace_back(Worker, i);
+		}
+		Worker(0);
+
+		for (std::thread& thread: threads)
+		{
+			thread.join();
+		}
+		if (exception)
+		{
+			std::rethrow_exception(exception);
+		}
+		return !isStopped;
+	}
+}
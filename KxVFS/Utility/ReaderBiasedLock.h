@@ -0,0 +1,220 @@
+#pragma once
+#include <atomic>
+#include <thread>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+
+namespace KxVFS
+{
+	// Reader-writer lock on top of 'TLock' (anything with the 'SRWLock' interface) which can be switched to reader-biased mode.
+	// Until then it's 'TLock' plus one pointer load per operation. In biased mode shared owners only increment their own
+	// per-thread slot counter, so readers on different cores don't contend on a single word. Exclusive owner still takes 'TLock',
+	// then blocks new biased readers and waits for existing ones to leave, readers arriving meanwhile wait on 'TLock' in shared mode.
+	// Biased mode costs a few cache lines per lock and makes exclusive acquisition slower, so it's meant for a few hot locks only.
+	// Only depends on 'std::atomic', so the slot protocol can be tested with any portable 'TLock'.
+	template<class TLock>
+	class BasicReaderBiasedLock final
+	{
+		private:
+			struct alignas(64) ReaderSlot
+			{
+				std::atomic<intptr_t> Count = 0;
+			};
+			struct ReaderSlots
+			{
+				std::atomic<bool> WriterActive = false;
+				std::unique_ptr<ReaderSlot[]> Slots;
+				size_t Mask = 0;
+
+				ReaderSlots(size_t count)
+					:Slots(std::make_unique<ReaderSlot[]>(count)), Mask(count - 1)
+				{
+				}
+			};
+
+		private:
+			static size_t GetSlotCount() noexcept
+			{
+				size_t count = 2;
+				while (count < std::thread::hardware_concurrency() && count < 64)
+				{
+					count *= 2;
+				}
+				return count;
+			}
+			static size_t GetThreadSlot() noexcept
+			{
+				static std::atomic<size_t> g_NextSlot = 0;
+				thread_local const size_t slot = g_NextSlot.fetch_add(1, std::memory_order_relaxed);
+
+				return slot;
+			}
+
+		private:
+			TLock m_Lock;
+
+			// Set once under exclusive lock and never reset until destruction, so it's stable while the lock is held in any mode
+			std::atomic<ReaderSlots*> m_Slots = nullptr;
+
+		private:
+			ReaderSlots* GetSlots() const noexcept
+			{
+				return m_Slots.load(std::memory_order_acquire);
+			}
+			std::atomic<intptr_t>& GetReaderCount(ReaderSlots& slots) const noexcept
+			{
+				return slots.Slots[GetThreadSlot() & slots.Mask].Count;
+			}
+
+			bool TryEnterBiased(ReaderSlots& slots) noexcept
+			{
+				std::atomic<intptr_t>& count = GetReaderCount(slots);
+				count.fetch_add(1, std::memory_order_seq_cst);
+				if (!slots.WriterActive.load(std::memory_order_seq_cst))
+				{
+					return true;
+				}
+
+				count.fetch_sub(1, std::memory_order_release);
+				return false;
+			}
+			void EnterFromShared(ReaderSlots& slots) noexcept
+			{
+				// No writer can be active while 'm_Lock' is held shared, next one will wait for this slot to drain
+				GetReaderCount(slots).fetch_add(1, std::memory_order_seq_cst);
+				m_Lock.ReleaseShared();
+			}
+			bool HasBiasedReaders(const ReaderSlots& slots) const noexcept
+			{
+				// Shared owner may be moved to another thread and release through a different slot, so only the sum is meaningful
+				intptr_t total = 0;
+				for (size_t i = 0; i <= slots.Mask; i++)
+				{
+					total += slots.Slots[i].Count.load(std::memory_order_seq_cst);
+				}
+				return total != 0;
+			}
+
+		public:
+			BasicReaderBiasedLock() = default;
+			BasicReaderBiasedLock(const BasicReaderBiasedLock&) = delete;
+			BasicReaderBiasedLock(BasicReaderBiasedLock&&) = delete;
+			~BasicReaderBiasedLock() noexcept
+			{
+				delete m_Slots.load(std::memory_order_relaxed);
+			}
+
+		public:
+			bool IsReaderBiased() const noexcept
+			{
+				return GetSlots() != nullptr;
+			}
+			void EnableReaderBias()
+			{
+				if (!IsReaderBiased())
+				{
+					auto slots = std::make_unique<ReaderSlots>(GetSlotCount());
+
+					m_Lock.AcquireExclusive();
+					if (!m_Slots.load(std::memory_order_relaxed))
+					{
+						m_Slots.store(slots.release(), std::memory_order_release);
+					}
+					m_Lock.ReleaseExclusive();
+				}
+			}
+
+			void AcquireShared() noexcept
+			{
+				ReaderSlots* slots = GetSlots();
+				if (slots && TryEnterBiased(*slots))
+				{
+					return;
+				}
+
+				m_Lock.AcquireShared();
+
+				// Bias could have been enabled while this thread was waiting
+				slots = GetSlots();
+				if (slots)
+				{
+					EnterFromShared(*slots);
+				}
+			}
+			void AcquireExclusive() noexcept
+			{
+				m_Lock.AcquireExclusive();
+				if (ReaderSlots* slots = GetSlots())
+				{
+					slots->WriterActive.store(true, std::memory_order_seq_cst);
+					while (HasBiasedReaders(*slots))
+					{
+						std::this_thread::yield();
+					}
+				}
+			}
+
+			bool TryAcquireShared() noexcept
+			{
+				ReaderSlots* slots = GetSlots();
+				if (slots && TryEnterBiased(*slots))
+				{
+					return true;
+				}
+
+				if (m_Lock.TryAcquireShared())
+				{
+					slots = GetSlots();
+					if (slots)
+					{
+						EnterFromShared(*slots);
+					}
+					return true;
+				}
+				return false;
+			}
+			bool TryAcquireExclusive() noexcept
+			{
+				if (m_Lock.TryAcquireExclusive())
+				{
+					if (ReaderSlots* slots = GetSlots())
+					{
+						slots->WriterActive.store(true, std::memory_order_seq_cst);
+						if (HasBiasedReaders(*slots))
+						{
+							slots->WriterActive.store(false, std::memory_order_release);
+							m_Lock.ReleaseExclusive();
+							return false;
+						}
+					}
+					return true;
+				}
+				return false;
+			}
+
+			void ReleaseShared() noexcept
+			{
+				if (ReaderSlots* slots = GetSlots())
+				{
+					GetReaderCount(*slots).fetch_sub(1, std::memory_order_release);
+				}
+				else
+				{
+					m_Lock.ReleaseShared();
+				}
+			}
+			void ReleaseExclusive() noexcept
+			{
+				if (ReaderSlots* slots = GetSlots())
+				{
+					slots->WriterActive.store(false, std::memory_order_release);
+				}
+				m_Lock.ReleaseExclusive();
+			}
+
+		public:
+			BasicReaderBiasedLock& operator=(const BasicReaderBiasedLock&) = delete;
+			BasicReaderBiasedLock& operator=(BasicReaderBiasedLock&&) = delete;
+	};
+}
@@ -1,19 +1,22 @@
 #pragma once
 #include "KxVFS/Misc/IncludeWindows.h"
+#include "ReaderBiasedLock.h"
+#include "LockStatistics.h"
 #include <utility>
+#include <mutex>
 
 namespace KxVFS
 {
-	class SRWLock final
+	class NativeSRWLock final
 	{
 		private:
 			SRWLOCK m_Lock = SRWLOCK_INIT;
 
 		public:
-			SRWLock() = default;
-			SRWLock(const SRWLock&) = delete;
-			SRWLock(SRWLock&&) = delete;
-			~SRWLock() = default;
+			NativeSRWLock() = default;
+			NativeSRWLock(const NativeSRWLock&) = delete;
+			NativeSRWLock(NativeSRWLock&&) = delete;
+			~NativeSRWLock() = default;
 
 		public:
 			void AcquireShared() noexcept
@@ -63,6 +66,9 @@ namespace KxVFS
 				}
 			}
 	};
+
+	// Plain 'NativeSRWLock' until 'EnableReaderBias' is called, see 'BasicReaderBiasedLock'
+	using SRWLock = BasicReaderBiasedLock<NativeSRWLock>;
 }
 
 namespace KxVFS
@@ -92,8 +98,13 @@ namespace KxVFS
 
 		private:
 			SRWLock* m_Lock = nullptr;
+			int64_t m_AcquiredAt = 0;
 
 		public:
+			BasicSRWLocker() noexcept
+			{
+				static_assert(t_IsMoveable, "only moveable locker can be empty");
+			}
 			BasicSRWLocker(SRWLock& lock) noexcept
 				:m_Lock(&lock)
 			{
@@ -109,6 +120,12 @@ namespace KxVFS
 				{
 					static_assert(false, "invalid locker type");
 				}
+				m_AcquiredAt = LockStatistics::Get().OnAcquired();
+			}
+			BasicSRWLocker(SRWLock& lock, std::adopt_lock_t) noexcept
+				:m_Lock(&lock), m_AcquiredAt(LockStatistics::Get().OnAcquired())
+			{
+				// Lock is already acquired by the caller in the mode of this locker
 			}
 			BasicSRWLocker(BasicSRWLocker&& other) noexcept
 			{
@@ -125,6 +142,7 @@ namespace KxVFS
 					}
 				}
 
+				LockStatistics::Get().OnReleased(m_AcquiredAt, IsExclusive());
 				if constexpr(t_LockerType == SRWLockerType::Shared)
 				{
 					m_Lock->ReleaseShared();
@@ -146,7 +164,9 @@ namespace KxVFS
 				if constexpr(t_IsMoveable)
 				{
 					m_Lock = other.m_Lock;
+					m_AcquiredAt = other.m_AcquiredAt;
 					other.m_Lock = nullptr;
+					other.m_AcquiredAt = 0;
 					return *this;
 				}
 				else
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+
+// Minimal assertion macros so the tests don't need a test framework, every test is a standalone executable
+#define KxVFS_Check(expression)	\
+	do	\
+	{	\
+		if (!(expression))	\
+		{	\
+			std::fprintf(stderr, "%s(%d): check failed: %s\n", __FILE__, __LINE__, #expression);	\
+			std::abort();	\
+		}	\
+	}	\
+	while (false)
+
+#define KxVFS_RunTest(function)	\
+	do	\
+	{	\
+		std::printf("%s\n", #function);	\
+		function();	\
+	}	\
+	while (false)
@@ -0,0 +1,166 @@
+#include "Check.h"
+#include "KxVFS/Common/FileContextState.h"
+#include <vector>
+
+using namespace KxVFS;
+
+namespace
+{
+	void TestInitialState()
+	{
+		FileContextState state;
+
+		bool isClosed = true;
+		bool isCleanedUp = true;
+		state.Get(isClosed, isCleanedUp);
+
+		KxVFS_Check(!isClosed && !isCleanedUp);
+		KxVFS_Check(!state.IsClosed());
+		KxVFS_Check(!state.IsCleanedUp());
+		KxVFS_Check(state.GetAsyncIOCount() == 0);
+	}
+	void TestAsyncIOCount()
+	{
+		FileContextState state;
+
+		KxVFS_Check(state.BeginAsyncIO());
+		KxVFS_Check(state.BeginAsyncIO());
+		KxVFS_Check(state.GetAsyncIOCount() == 2);
+
+		state.EndAsyncIO();
+		KxVFS_Check(state.GetAsyncIOCount() == 1);
+		state.EndAsyncIO();
+		KxVFS_Check(state.GetAsyncIOCount() == 0);
+		KxVFS_Check(!state.IsClosed() && !state.IsCleanedUp());
+	}
+	void TestCleanUp()
+	{
+		// Cleaned up context can still complete pending IO and start new one until it's closed
+		FileContextState state;
+		KxVFS_Check(state.BeginAsyncIO());
+
+		state.MarkCleanedUp();
+		KxVFS_Check(state.IsCleanedUp());
+		KxVFS_Check(!state.IsClosed());
+		KxVFS_Check(state.GetAsyncIOCount() == 1);
+
+		KxVFS_Check(state.BeginAsyncIO());
+		state.EndAsyncIO();
+		state.EndAsyncIO();
+		KxVFS_Check(state.GetAsyncIOCount() == 0);
+		KxVFS_Check(state.IsCleanedUp());
+	}
+	void TestClose()
+	{
+		FileContextState state;
+		state.MarkCleanedUp();
+		state.MarkClosed();
+
+		bool isClosed = false;
+		bool isCleanedUp = false;
+		state.Get(isClosed, isCleanedUp);
+
+		KxVFS_Check(isClosed && isCleanedUp);
+		KxVFS_Check(!state.BeginAsyncIO());
+		KxVFS_Check(state.GetAsyncIOCount() == 0);
+	}
+	void TestReset()
+	{
+		FileContextState state;
+		state.MarkCleanedUp();
+		state.MarkClosed();
+		state.Reset();
+
+		KxVFS_Check(!state.IsClosed() && !state.IsCleanedUp());
+		KxVFS_Check(state.BeginAsyncIO());
+		state.EndAsyncIO();
+	}
+
+	void TestCloseWaitsForAsyncIO()
+	{
+		FileContextState state;
+		KxVFS_Check(state.BeginAsyncIO());
+
+		std::atomic<bool> isClosed = false;
+		std::thread closer([&]()
+		{
+			state.MarkClosed();
+			isClosed = true;
+		});
+
+		// Closed flag is set right away, but closing can't complete while the operation is in flight
+		while (!state.IsClosed())
+		{
+			std::this_thread::yield();
+		}
+		KxVFS_Check(!state.BeginAsyncIO());
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		KxVFS_Check(!isClosed);
+
+		state.EndAsyncIO();
+		closer.join();
+		KxVFS_Check(isClosed);
+		KxVFS_Check(state.GetAsyncIOCount() == 0);
+	}
+	void TestCloseOrdering()
+	{
+		// Once 'MarkClosed' returns no operation may be in flight and none may start
+		constexpr size_t workerCount = 4;
+
+		FileContextState state;
+		std::atomic<size_t> insideCount = 0;
+		std::atomic<size_t> startedCount = 0;
+		std::atomic<size_t> startedAfterClose = 0;
+		std::atomic<bool> isClosed = false;
+
+		std::vector<std::thread> workers;
+		for (size_t i = 0; i < workerCount; i++)
+		{
+			workers.emplace_back([&]()
+			{
+				while (state.BeginAsyncIO())
+				{
+					if (isClosed)
+					{
+						startedAfterClose++;
+					}
+					insideCount++;
+					startedCount++;
+					std::this_thread::yield();
+					insideCount--;
+					state.EndAsyncIO();
+				}
+			});
+		}
+
+		while (startedCount < 1000)
+		{
+			std::this_thread::yield();
+		}
+		state.MarkClosed();
+		isClosed = true;
+		KxVFS_Check(insideCount == 0);
+		KxVFS_Check(state.GetAsyncIOCount() == 0);
+
+		for (std::thread& worker: workers)
+		{
+			worker.join();
+		}
+		KxVFS_Check(insideCount == 0);
+		KxVFS_Check(startedAfterClose == 0);
+		KxVFS_Check(state.GetAsyncIOCount() == 0);
+	}
+}
+
+int main()
+{
+	KxVFS_RunTest(TestInitialState);
+	KxVFS_RunTest(TestAsyncIOCount);
+	KxVFS_RunTest(TestCleanUp);
+	KxVFS_RunTest(TestClose);
+	KxVFS_RunTest(TestReset);
+	KxVFS_RunTest(TestCloseWaitsForAsyncIO);
+	KxVFS_RunTest(TestCloseOrdering);
+	return 0;
+}
@@ -0,0 +1,324 @@
+#include "stdafx.h"
+#include "Check.h"
+#include "KxVFS/Common/FileTreeSnapshot.h"
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+using namespace KxVFS;
+
+namespace
+{
+	enum class LoadResult
+	{
+		OpenFailed,
+		LoadFailed,
+		Loaded,
+	};
+
+	// Two layers: 'A' comes from the first one, 'B' is merged from both
+	class TestTree final
+	{
+		public:
+			std::filesystem::path m_Directory;
+			std::vector<DynamicStringW> m_Layers;
+			std::vector<uint32_t> m_Priorities = {0, 1};
+
+			FileNodeArena m_Arena;
+			FileNode m_Root;
+
+		private:
+			FileNode& AddNode(FileNode& parent, DynamicStringRefW name, bool isDirectory, uint32_t virtualDirectory, const std::vector<uint32_t>& layers)
+			{
+				FileNodeInfo info;
+				info.SetAttributes(isDirectory ? FileAttributes::Directory : FileAttributes::Archive);
+				info.SetFileSize(isDirectory ? 0 : 42);
+
+				FileNode& node = parent.AddChild(FileNode::Create(&m_Arena, name, info, &parent), m_Layers[virtualDirectory]);
+				node.SetLayers(layers);
+				return node;
+			}
+
+		public:
+			TestTree()
+				:m_Directory(std::filesystem::temp_directory_path() / L"KxVFSFileTreeSnapshotTest"), m_Root(&m_Arena)
+			{
+				std::filesystem::remove_all(m_Directory);
+				std::filesystem::create_directories(m_Directory / L"Layer0" / L"A");
+				std::filesystem::create_directories(m_Directory / L"Layer0" / L"B");
+				std::filesystem::create_directories(m_Directory / L"Layer1" / L"B");
+				m_Layers.emplace_back((m_Directory / L"Layer0").c_str());
+				m_Layers.emplace_back((m_Directory / L"Layer1").c_str());
+
+				FileNode& a = AddNode(m_Root, L"A", true, 0, {0});
+				AddNode(a, L"a.txt", false, 0, {0});
+
+				FileNode& b = AddNode(m_Root, L"B", true, 1, {0, 1});
+				AddNode(b, L"b.txt", false, 1, {1});
+				AddNode(b, L"c.txt", false, 0, {0});
+			}
+			~TestTree()
+			{
+				std::error_code error;
+				std::filesystem::remove_all(m_Directory, error);
+			}
+
+		public:
+			std::filesystem::path GetSnapshotPath() const
+			{
+				return m_Directory / L"Snapshot.bin";
+			}
+			std::filesystem::path GetCorruptedPath() const
+			{
+				return m_Directory / L"Corrupted.bin";
+			}
+			bool Write()
+			{
+				return FileTreeSnapshot::Write(GetSnapshotPath().c_str(), m_Root, m_Layers, m_Priorities);
+			}
+	};
+
+	void DumpTree(const FileNode& node, std::vector<std::wstring>& items)
+	{
+		node.WalkChildren([&](const FileNode& child)
+		{
+			std::wstring item(DynamicStringRefW(child.GetRelativePath()));
+			item += L'|';
+			item += std::to_wstring(child.GetAttributes().ToInt());
+			item += L'|';
+			item += std::to_wstring(child.GetFileSize());
+			item += L'|';
+			item += child.GetVirtualDirectory();
+			for (uint32_t layer: child.GetLayers())
+			{
+				item += L'|';
+				item += std::to_wstring(layer);
+			}
+			items.push_back(std::move(item));
+
+			if (child.IsDirectory())
+			{
+				DumpTree(child, items);
+			}
+			return true;
+		});
+	}
+	std::vector<std::wstring> DumpTree(const FileNode& rootNode)
+	{
+		std::vector<std::wstring> items;
+		DumpTree(rootNode, items);
+		return items;
+	}
+	const FileNode* FindChild(const FileNode& node, DynamicStringRefW name)
+	{
+		return node.WalkChildren([&](const FileNode& child)
+		{
+			return child.GetName() != name;
+		});
+	}
+
+	std::vector<uint8_t> ReadFile(const std::filesystem::path& path)
+	{
+		std::ifstream stream(path, std::ios::binary);
+		return std::vector<uint8_t>(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+	}
+	void WriteFile(const std::filesystem::path& path, const std::vector<uint8_t>& data)
+	{
+		std::ofstream stream(path, std::ios::binary|std::ios::trunc);
+		stream.write(reinterpret_cast<const char*>(data.data()), data.size());
+	}
+
+	// In-place access to the records of a serialized snapshot
+	FileTreeSnapshot::Header& GetHeader(std::vector<uint8_t>& data)
+	{
+		return *reinterpret_cast<FileTreeSnapshot::Header*>(data.data());
+	}
+	FileTreeSnapshot::NodeRecord* GetNodes(std::vector<uint8_t>& data)
+	{
+		const size_t offset = sizeof(FileTreeSnapshot::Header) + GetHeader(data).LayerCount * sizeof(FileTreeSnapshot::LayerRecord);
+		return reinterpret_cast<FileTreeSnapshot::NodeRecord*>(data.data() + offset);
+	}
+	FileTreeSnapshot::NodeRecord& GetNode(std::vector<uint8_t>& data, DynamicStringRefW name)
+	{
+		const FileTreeSnapshot::Header& header = GetHeader(data);
+		const size_t namesOffset = sizeof(FileTreeSnapshot::Header) +
+			header.LayerCount * sizeof(FileTreeSnapshot::LayerRecord) +
+			header.NodeCount * sizeof(FileTreeSnapshot::NodeRecord) +
+			header.StampCount * sizeof(FileTreeSnapshot::StampRecord) +
+			header.LayerSetsSize * sizeof(uint32_t);
+		const wchar_t* names = reinterpret_cast<const wchar_t*>(data.data() + namesOffset);
+
+		FileTreeSnapshot::NodeRecord* nodes = GetNodes(data);
+		for (uint32_t i = 0; i < header.NodeCount; i++)
+		{
+			if (DynamicStringRefW(names + nodes[i].NameOffset, nodes[i].NameLength) == name)
+			{
+				return nodes[i];
+			}
+		}
+
+		KxVFS_Check(false);
+		return nodes[0];
+	}
+	uint32_t GetNodeIndex(std::vector<uint8_t>& data, DynamicStringRefW name)
+	{
+		return static_cast<uint32_t>(&GetNode(data, name) - GetNodes(data));
+	}
+
+	LoadResult LoadSnapshot(const std::filesystem::path& path)
+	{
+		FileTreeSnapshot snapshot;
+		if (!snapshot.Open(path.c_str()))
+		{
+			return LoadResult::OpenFailed;
+		}
+
+		FileNodeArena arena;
+		FileNode rootNode(&arena);
+		FileNode::RefVector changedDirectories;
+		return snapshot.Load(rootNode, arena, changedDirectories) ? LoadResult::Loaded : LoadResult::LoadFailed;
+	}
+	template<class TFunctor>
+	LoadResult LoadCorrupted(TestTree& tree, TFunctor&& corrupt)
+	{
+		std::vector<uint8_t> data = ReadFile(tree.GetSnapshotPath());
+		corrupt(data);
+		WriteFile(tree.GetCorruptedPath(), data);
+
+		return LoadSnapshot(tree.GetCorruptedPath());
+	}
+
+	void TestRoundTrip()
+	{
+		TestTree tree;
+		KxVFS_Check(tree.Write());
+
+		FileTreeSnapshot snapshot;
+		KxVFS_Check(snapshot.Open(tree.GetSnapshotPath().c_str()));
+		KxVFS_Check(snapshot.GetLayerCount() == 2);
+		KxVFS_Check(snapshot.GetLayerPath(1) == DynamicStringRefW(tree.m_Layers[1]));
+		KxVFS_Check(snapshot.GetLayerPriority(1) == 1);
+
+		FileNodeArena arena;
+		FileNode rootNode(&arena);
+		FileNode::RefVector changedDirectories;
+		KxVFS_Check(snapshot.Load(rootNode, arena, changedDirectories));
+		KxVFS_Check(changedDirectories.empty());
+
+		const std::vector<std::wstring> items = DumpTree(rootNode);
+		KxVFS_Check(items.size() == 5);
+		KxVFS_Check(items == DumpTree(tree.m_Root));
+	}
+	void TestChangedDirectory()
+	{
+		TestTree tree;
+		KxVFS_Check(tree.Write());
+
+		// Adding a file updates modification time of the directory in the layer
+		WriteFile(std::filesystem::path(tree.m_Layers[0].data()) / L"A" / L"New.txt", {});
+
+		FileTreeSnapshot snapshot;
+		KxVFS_Check(snapshot.Open(tree.GetSnapshotPath().c_str()));
+
+		FileNodeArena arena;
+		FileNode rootNode(&arena);
+		FileNode::RefVector changedDirectories;
+		KxVFS_Check(snapshot.Load(rootNode, arena, changedDirectories));
+		KxVFS_Check(changedDirectories.size() == 1);
+		KxVFS_Check(changedDirectories[0]->GetName() == L"A");
+		KxVFS_Check(!changedDirectories[0]->HasChildren());
+
+		const FileNode* b = FindChild(rootNode, L"B");
+		KxVFS_Check(b && b->GetChildrenCount() == 2);
+	}
+
+	void TestTruncatedFile()
+	{
+		TestTree tree;
+		KxVFS_Check(tree.Write());
+
+		KxVFS_Check(LoadCorrupted(tree, [](std::vector<uint8_t>& data)
+		{
+			data.pop_back();
+		}) == LoadResult::OpenFailed);
+		KxVFS_Check(LoadCorrupted(tree, [](std::vector<uint8_t>& data)
+		{
+			data.resize(sizeof(FileTreeSnapshot::Header) - 1);
+		}) == LoadResult::OpenFailed);
+		KxVFS_Check(LoadCorrupted(tree, [](std::vector<uint8_t>& data)
+		{
+			GetHeader(data).NodeCount++;
+		}) == LoadResult::OpenFailed);
+		KxVFS_Check(LoadCorrupted(tree, [](std::vector<uint8_t>& data)
+		{
+			GetHeader(data).Signature = 0;
+		}) == LoadResult::OpenFailed);
+	}
+	void TestOutOfRangeChildren()
+	{
+		TestTree tree;
+		KxVFS_Check(tree.Write());
+
+		KxVFS_Check(LoadCorrupted(tree, [](std::vector<uint8_t>& data)
+		{
+			GetNode(data, L"A").FirstChild = GetHeader(data).NodeCount;
+		}) == LoadResult::LoadFailed);
+		KxVFS_Check(LoadCorrupted(tree, [](std::vector<uint8_t>& data)
+		{
+			GetNode(data, L"B").ChildCount = std::numeric_limits<uint32_t>::max();
+		}) == LoadResult::LoadFailed);
+
+		// Children preceding their parent could form a cycle
+		KxVFS_Check(LoadCorrupted(tree, [](std::vector<uint8_t>& data)
+		{
+			GetNode(data, L"A").FirstChild = GetNodeIndex(data, L"A");
+		}) == LoadResult::LoadFailed);
+	}
+	void TestOverlappingChildren()
+	{
+		TestTree tree;
+		KxVFS_Check(tree.Write());
+
+		// Both directories claim the same child
+		KxVFS_Check(LoadCorrupted(tree, [](std::vector<uint8_t>& data)
+		{
+			FileTreeSnapshot::NodeRecord& a = GetNode(data, L"A");
+			FileTreeSnapshot::NodeRecord& b = GetNode(data, L"B");
+			b.FirstChild = a.FirstChild;
+			b.ChildCount = 1;
+		}) == LoadResult::LoadFailed);
+
+		// Directory claims a sibling of its own
+		KxVFS_Check(LoadCorrupted(tree, [](std::vector<uint8_t>& data)
+		{
+			FileTreeSnapshot::NodeRecord& a = GetNode(data, L"A");
+			a.FirstChild = GetNodeIndex(data, L"B");
+			a.ChildCount = 1;
+		}) == LoadResult::LoadFailed);
+	}
+	void TestInvalidVirtualDirectory()
+	{
+		TestTree tree;
+		KxVFS_Check(tree.Write());
+
+		KxVFS_Check(LoadCorrupted(tree, [](std::vector<uint8_t>& data)
+		{
+			GetNode(data, L"b.txt").VirtualDirectory = GetHeader(data).LayerCount;
+		}) == LoadResult::LoadFailed);
+		KxVFS_Check(LoadCorrupted(tree, [](std::vector<uint8_t>& data)
+		{
+			GetNode(data, L"A").VirtualDirectory = FileTreeSnapshot::InvalidIndex;
+		}) == LoadResult::LoadFailed);
+	}
+}
+
+int main()
+{
+	KxVFS_RunTest(TestRoundTrip);
+	KxVFS_RunTest(TestChangedDirectory);
+	KxVFS_RunTest(TestTruncatedFile);
+	KxVFS_RunTest(TestOutOfRangeChildren);
+	KxVFS_RunTest(TestOverlappingChildren);
+	KxVFS_RunTest(TestInvalidVirtualDirectory);
+	return 0;
+}
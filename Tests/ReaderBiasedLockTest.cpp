@@ -0,0 +1,265 @@
+#include "Check.h"
+#include "KxVFS/Utility/ReaderBiasedLock.h"
+#include <shared_mutex>
+#include <vector>
+#include <chrono>
+
+using namespace KxVFS;
+
+namespace
+{
+	// Portable stand-in for 'NativeSRWLock'
+	class SharedMutexLock final
+	{
+		private:
+			std::shared_mutex m_Mutex;
+
+		public:
+			void AcquireShared()
+			{
+				m_Mutex.lock_shared();
+			}
+			void AcquireExclusive()
+			{
+				m_Mutex.lock();
+			}
+			bool TryAcquireShared()
+			{
+				return m_Mutex.try_lock_shared();
+			}
+			bool TryAcquireExclusive()
+			{
+				return m_Mutex.try_lock();
+			}
+			void ReleaseShared()
+			{
+				m_Mutex.unlock_shared();
+			}
+			void ReleaseExclusive()
+			{
+				m_Mutex.unlock();
+			}
+	};
+	using TestLock = BasicReaderBiasedLock<SharedMutexLock>;
+
+	void RunMixedLoad(bool enableBiasMidway)
+	{
+		constexpr size_t readerCount = 6;
+		constexpr size_t writerCount = 2;
+		constexpr size_t iterations = 20000;
+
+		TestLock lock;
+		std::atomic<size_t> readersInside = 0;
+		std::atomic<size_t> writersInside = 0;
+		std::atomic<size_t> progress = 0;
+		std::atomic<size_t> failures = 0;
+
+		// Guarded by the lock, readers must always see them equal
+		size_t first = 0;
+		size_t second = 0;
+
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < readerCount; i++)
+		{
+			threads.emplace_back([&, i]()
+			{
+				for (size_t j = 0; j < iterations; j++)
+				{
+					const bool useTry = (i + j) % 8 == 0;
+					if (!useTry || !lock.TryAcquireShared())
+					{
+						lock.AcquireShared();
+					}
+
+					readersInside++;
+					if (writersInside != 0 || first != second)
+					{
+						failures++;
+					}
+					readersInside--;
+
+					lock.ReleaseShared();
+					progress++;
+				}
+			});
+		}
+		for (size_t i = 0; i < writerCount; i++)
+		{
+			threads.emplace_back([&, i]()
+			{
+				for (size_t j = 0; j < iterations / 10; j++)
+				{
+					const bool useTry = (i + j) % 4 == 0;
+					if (!useTry || !lock.TryAcquireExclusive())
+					{
+						lock.AcquireExclusive();
+					}
+
+					if (++writersInside != 1 || readersInside != 0)
+					{
+						failures++;
+					}
+					first++;
+					std::this_thread::yield();
+					second++;
+					writersInside--;
+
+					lock.ReleaseExclusive();
+					progress++;
+				}
+			});
+		}
+
+		if (enableBiasMidway)
+		{
+			// Switch while readers and writers are contending for the lock
+			while (progress < iterations)
+			{
+				std::this_thread::yield();
+			}
+			lock.EnableReaderBias();
+			KxVFS_Check(lock.IsReaderBiased());
+		}
+
+		for (std::thread& thread: threads)
+		{
+			thread.join();
+		}
+		KxVFS_Check(failures == 0);
+		KxVFS_Check(first == writerCount * (iterations / 10));
+		KxVFS_Check(first == second);
+	}
+
+	void TestMixedLoad()
+	{
+		RunMixedLoad(false);
+	}
+	void TestEnableBiasUnderLoad()
+	{
+		RunMixedLoad(true);
+	}
+	void TestMixedLoadBiased()
+	{
+		TestLock lock;
+		lock.EnableReaderBias();
+		lock.EnableReaderBias();
+		KxVFS_Check(lock.IsReaderBiased());
+
+		std::atomic<size_t> readersInside = 0;
+		std::atomic<size_t> failures = 0;
+		size_t value = 0;
+
+		std::vector<std::thread> threads;
+		for (size_t i = 0; i < 4; i++)
+		{
+			threads.emplace_back([&, i]()
+			{
+				for (size_t j = 0; j < 20000; j++)
+				{
+					if ((i + j) % 16 == 0)
+					{
+						lock.AcquireExclusive();
+						if (readersInside != 0)
+						{
+							failures++;
+						}
+						value++;
+						lock.ReleaseExclusive();
+					}
+					else
+					{
+						lock.AcquireShared();
+						readersInside++;
+						readersInside--;
+						lock.ReleaseShared();
+					}
+				}
+			});
+		}
+		for (std::thread& thread: threads)
+		{
+			thread.join();
+		}
+		KxVFS_Check(failures == 0);
+		KxVFS_Check(value == 4 * 20000 / 16);
+	}
+
+	void TestTryAcquire()
+	{
+		for (bool isBiased: {false, true})
+		{
+			TestLock lock;
+			if (isBiased)
+			{
+				lock.EnableReaderBias();
+			}
+
+			// Shared owner blocks exclusive but not other shared owners
+			lock.AcquireShared();
+			std::thread([&]()
+			{
+				KxVFS_Check(!lock.TryAcquireExclusive());
+				KxVFS_Check(lock.TryAcquireShared());
+				lock.ReleaseShared();
+			}).join();
+			lock.ReleaseShared();
+
+			// Exclusive owner blocks everyone
+			lock.AcquireExclusive();
+			std::thread([&]()
+			{
+				KxVFS_Check(!lock.TryAcquireExclusive());
+				KxVFS_Check(!lock.TryAcquireShared());
+			}).join();
+			lock.ReleaseExclusive();
+
+			KxVFS_Check(lock.TryAcquireExclusive());
+			lock.ReleaseExclusive();
+		}
+	}
+	void TestReleaseOnAnotherThread()
+	{
+		// Shared ownership handed over to another thread, as an async operation completing elsewhere does.
+		// Only valid in biased mode, 'std::shared_mutex' itself doesn't allow it.
+		TestLock lock;
+		lock.EnableReaderBias();
+
+		std::thread([&]()
+		{
+			lock.AcquireShared();
+		}).join();
+
+		std::atomic<bool> isAcquired = false;
+		std::thread writer([&]()
+		{
+			lock.AcquireExclusive();
+			isAcquired = true;
+			lock.ReleaseExclusive();
+		});
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		KxVFS_Check(!isAcquired);
+
+		std::thread([&]()
+		{
+			lock.ReleaseShared();
+		}).join();
+
+		writer.join();
+		KxVFS_Check(isAcquired);
+
+		// Slot counters must have drained back to zero in total
+		KxVFS_Check(lock.TryAcquireExclusive());
+		lock.ReleaseExclusive();
+	}
+}
+
+int main()
+{
+	KxVFS_RunTest(TestMixedLoad);
+	KxVFS_RunTest(TestEnableBiasUnderLoad);
+	KxVFS_RunTest(TestMixedLoadBiased);
+	KxVFS_RunTest(TestTryAcquire);
+	KxVFS_RunTest(TestReleaseOnAnotherThread);
+	return 0;
+}